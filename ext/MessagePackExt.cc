@@ -3,6 +3,7 @@
 #include "ruby/st.h"
 #include <assert.h>
 #include <stdio.h> /* fopen() */
+#include <stdarg.h> /* va_list */
 #include <sys/types.h> /* fstat() */
 #include <sys/stat.h> /* fstat() */
 #include <unistd.h> /* fstat() */
@@ -163,13 +164,53 @@ Packer_s__dump_to_file(VALUE self, VALUE obj, VALUE filename, VALUE depth)
   return Qnil;
 }
 
-VALUE unpack_value(MessagePack::Decoder &dec, bool &success, bool *in_dynarray)
+/*
+ * Outcome of decoding. rb_raise() and a non-local exit of the block
+ * longjmp, which would skip the destructors of the C++ frames
+ * (Decoder::Nesting, the Reader). So failures are recorded here on the
+ * way up and raised by the module functions once those frames are gone.
+ */
+struct unpack_status
+{
+  VALUE error_class;  // Qnil if none
+  char message[128];
+  int jump;           // tag of a non-local exit of the block (rb_protect)
+
+  unpack_status() : error_class(Qnil), jump(0) { message[0] = '\0'; }
+
+  bool ok() const { return NIL_P(error_class) && jump == 0; }
+
+  VALUE fail(VALUE klass, const char *fmt, ...)
+  {
+    if (NIL_P(error_class))
+    {
+      va_list args;
+      va_start(args, fmt);
+      vsnprintf(message, sizeof(message), fmt, args);
+      va_end(args);
+      error_class = klass;
+    }
+    return Qnil;
+  }
+
+  void raise() const
+  {
+    if (jump) rb_jump_tag(jump);
+    if (!NIL_P(error_class)) rb_raise(error_class, "%s", message);
+  }
+};
+
+static VALUE
+charge_failed(MessagePack::Decoder &dec, unpack_status &st)
+{
+  return st.fail(rb_eRuntimeError, "Exception: %s", dec.get_reader()->error_message());
+}
+
+VALUE unpack_value(MessagePack::Decoder &dec, unpack_status &st, bool *in_dynarray)
 {
   using namespace MessagePack;
   DataValue value;
 
-  success = true;
-
   switch (dec.read_next(value)) {
     case MSGPACK_T_UINT:
       return ULONG2NUM(value.u);
@@ -181,32 +222,78 @@ VALUE unpack_value(MessagePack::Decoder &dec, bool &success, bool *in_dynarray)
       return (value.b ? Qtrue : Qfalse);
     case MSGPACK_T_ARRAY:
       {
+        MessagePack::Decoder::Nesting nest(dec);
+        if (!nest.ok() || !dec.charge(value.len * sizeof(VALUE))) return charge_failed(dec, st);
         VALUE ary = rb_ary_new2(value.len);
         for (size_t i=0; i < value.len; i++)
         {
-          rb_ary_store(ary, i, unpack_value(dec, success, NULL));
-          if (!success) return Qnil;
+          rb_ary_store(ary, i, unpack_value(dec, st, NULL));
+          if (!st.ok()) return Qnil;
         }
         return ary;
       }
       break;
     case MSGPACK_T_MAP:
       {
+        MessagePack::Decoder::Nesting nest(dec);
+        if (!nest.ok() || !dec.charge(value.len * 2 * sizeof(VALUE))) return charge_failed(dec, st);
         VALUE hash = rb_hash_new();
         VALUE key = Qnil;
         VALUE val = Qnil;
         for (size_t i=0; i < value.len; i++)
         {
-          key = unpack_value(dec, success, NULL);
-          if (!success) return Qnil;
-          val = unpack_value(dec, success, NULL);
-          if (!success) return Qnil;
+          key = unpack_value(dec, st, NULL);
+          if (!st.ok()) return Qnil;
+          val = unpack_value(dec, st, NULL);
+          if (!st.ok()) return Qnil;
+          rb_hash_aset(hash, key, val);
+        }
+        return hash;
+      }
+    case MSGPACK_T_ARRAY_BEG:
+      {
+        MessagePack::Decoder::Nesting nest(dec);
+        if (!nest.ok()) return charge_failed(dec, st);
+        VALUE ary = rb_ary_new();
+        for (;;)
+        {
+          bool in_array = true;
+          VALUE v = unpack_value(dec, st, &in_array);
+          if (!st.ok()) return Qnil;
+          if (!in_array) break;
+          if (!dec.charge(sizeof(VALUE))) return charge_failed(dec, st);
+          rb_ary_push(ary, v);
+        }
+        return ary;
+      }
+    case MSGPACK_T_MAP_BEG:
+      {
+        MessagePack::Decoder::Nesting nest(dec);
+        if (!nest.ok()) return charge_failed(dec, st);
+        VALUE hash = rb_hash_new();
+        for (;;)
+        {
+          bool in_map = true;
+          VALUE key = unpack_value(dec, st, &in_map);
+          if (!st.ok()) return Qnil;
+          if (!in_map) break;
+          if (!dec.charge(2 * sizeof(VALUE))) return charge_failed(dec, st);
+          VALUE val = unpack_value(dec, st, NULL);
+          if (!st.ok()) return Qnil;
           rb_hash_aset(hash, key, val);
         }
         return hash;
       }
+    case MSGPACK_T_END:
+      if (in_dynarray)
+      {
+        *in_dynarray = false;
+        return Qnil;
+      }
+      return st.fail(rb_eArgError, "Unexpected end of size-less array");
     case MSGPACK_T_RAW:
       {
+        if (!dec.charge(value.len)) return charge_failed(dec, st);
         VALUE str = rb_str_buf_new(value.len);
         rb_str_set_len(str, value.len);
         assert(RSTRING_LEN(str) == value.len);
@@ -218,98 +305,138 @@ VALUE unpack_value(MessagePack::Decoder &dec, bool &success, bool *in_dynarray)
     case MSGPACK_T_DOUBLE:
       return DBL2NUM((double)value.d);
 
+    case MSGPACK_T_EXT:
+      return st.fail(rb_eArgError, "Unsupported ext type %d", (int)value.ext.type);
+
     case MSGPACK_T_RESERVED:
-      rb_raise(rb_eArgError, "Reserved data type");
-      success = false;
-      return Qnil;
+      return st.fail(rb_eArgError, "Reserved data type");
 
     case MSGPACK_T_INVALID:
     default:
-      rb_raise(rb_eArgError, "Invalid data type");
-      success = false;
-      return Qnil;
+      return st.fail(rb_eArgError, "Invalid data type");
   }
 
-  success = false;
-  return Qnil;
+  return st.fail(rb_eArgError, "Invalid msgpack string");
 }
 
 static VALUE
-unpack_each(MessagePack::Decoder &dec)
+yield_value(VALUE v)
 {
-  bool success = true; 
-  VALUE v = Qnil;
+  return rb_yield(v);
+}
 
+static VALUE
+unpack_each(MessagePack::Decoder &dec, unpack_status &st)
+{
   while (!dec.get_reader()->at_end())
   {
-    v = unpack_value(dec, success, NULL);
-    if (!success)
-    {
-      return Qfalse;
-    }
-    rb_yield(v);
+    VALUE v = unpack_value(dec, st, NULL);
+    if (!st.ok()) return Qfalse;
+    dec.reset_usage();
+    rb_protect(yield_value, v, &st.jump);
+    if (st.jump) return Qfalse;
   }
 
   return Qtrue;
 }
 
-static VALUE
-unpack_load(MessagePack::Decoder &dec)
+/*
+ * Objects are built recursively on the C stack, and running into Ruby's
+ * stack overflow check would longjmp over the C++ frames. So nesting is
+ * limited to DEFAULT_MAX_DEPTH unless a max_depth is given.
+ */
+static const uint32_t DEFAULT_MAX_DEPTH = 512;
+
+/*
+ * limits is nil or [max_depth, max_elements, max_bytes], where nil
+ * stands for no limit (the default depth for max_depth). Declared
+ * lengths are always checked against the input before anything is
+ * allocated.
+ */
+static MessagePack::DecodeLimits
+to_limits(VALUE limits)
 {
-  bool success = true;
-  VALUE v = unpack_value(dec, success, NULL);
-  if (!success)
-    rb_raise(rb_eArgError, "Invalid msgpack string");
-  return v;
+  MessagePack::DecodeLimits l;
+  l.max_depth = DEFAULT_MAX_DEPTH;
+
+  if (!NIL_P(limits))
+  {
+    Check_Type(limits, T_ARRAY);
+    VALUE v;
+    v = rb_ary_entry(limits, 0);
+    if (!NIL_P(v)) l.max_depth = NUM2UINT(v);
+    v = rb_ary_entry(limits, 1);
+    if (!NIL_P(v)) l.max_elements = NUM2UINT(v);
+    v = rb_ary_entry(limits, 2);
+    if (!NIL_P(v)) l.max_bytes = NUM2SIZET(v);
+  }
+  return l;
 }
 
 static VALUE
-Unpacker_s_each(VALUE self, VALUE str)
+Unpacker_s_each(VALUE self, VALUE str, VALUE limits)
 {
   Check_Type(str, T_STRING);
+  const MessagePack::DecodeLimits l = to_limits(limits);
+  unpack_status st;
+  VALUE result = Qfalse;
   try {
     MessagePack::MemoryReader reader(RSTRING_PTR(str), RSTRING_LEN(str));
     MessagePack::Decoder dec(&reader);
-    return unpack_each(dec);
+    dec.set_limits(l);
+    result = unpack_each(dec, st);
   }
   catch(MessagePack::Exception &e)
   {
-    rb_raise(rb_eRuntimeError, "Exception: %s", e.msg);
+    st.fail(rb_eRuntimeError, "Exception: %s", e.msg);
   }
+  st.raise();
+  return result;
 }
 
 /*
  * Reads only first object from "stream"
  */
 static VALUE
-Unpacker_s_load(VALUE self, VALUE str)
+Unpacker_s__load(VALUE self, VALUE str, VALUE limits)
 {
   Check_Type(str, T_STRING);
+  const MessagePack::DecodeLimits l = to_limits(limits);
+  unpack_status st;
+  VALUE result = Qnil;
   try {
     MessagePack::MemoryReader reader(RSTRING_PTR(str), RSTRING_LEN(str));
     MessagePack::Decoder dec(&reader);
-    return unpack_load(dec);
+    dec.set_limits(l);
+    result = unpack_value(dec, st, NULL);
   }
   catch(MessagePack::Exception &e)
   {
-    rb_raise(rb_eRuntimeError, "Exception: %s", e.msg);
+    st.fail(rb_eRuntimeError, "Exception: %s", e.msg);
   }
+  st.raise();
+  return result;
 }
 
 static VALUE
-Unpacker_s_load_from_file(VALUE self, VALUE filename)
+Unpacker_s__load_from_file(VALUE self, VALUE filename, VALUE limits)
 {
   Check_Type(filename, T_STRING);
-
+  const MessagePack::DecodeLimits l = to_limits(limits);
+  unpack_status st;
+  VALUE result = Qnil;
   try {
     MessagePack::FileReader reader(RSTRING_PTR(filename));
     MessagePack::Decoder dec(&reader);
-    return unpack_load(dec);
+    dec.set_limits(l);
+    result = unpack_value(dec, st, NULL);
   }
   catch(MessagePack::Exception &e)
   {
-    rb_raise(rb_eRuntimeError, "Exception: %s", e.msg);
+    st.fail(rb_eRuntimeError, "Exception: %s", e.msg);
   }
+  st.raise();
+  return result;
 }
 
 extern "C"
@@ -319,9 +446,9 @@ void Init_MessagePackExt()
   to_msgpack = rb_intern("to_msgpack");
 
   mMessagePack = rb_define_module("MessagePack");
-  rb_define_module_function(mMessagePack, "_each", (VALUE (*)(...))Unpacker_s_each, 1);
-  rb_define_module_function(mMessagePack, "load", (VALUE (*)(...))Unpacker_s_load, 1);
-  rb_define_module_function(mMessagePack, "load_from_file", (VALUE (*)(...))Unpacker_s_load_from_file, 1);
+  rb_define_module_function(mMessagePack, "_each", (VALUE (*)(...))Unpacker_s_each, 2);
+  rb_define_module_function(mMessagePack, "_load", (VALUE (*)(...))Unpacker_s__load, 2);
+  rb_define_module_function(mMessagePack, "_load_from_file", (VALUE (*)(...))Unpacker_s__load_from_file, 2);
   rb_define_module_function(mMessagePack, "_dump", (VALUE (*)(...))Packer_s__dump, 3);
   rb_define_module_function(mMessagePack, "_dump_to_file", (VALUE (*)(...))Packer_s__dump_to_file, 3);
 }
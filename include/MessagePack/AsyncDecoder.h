@@ -0,0 +1,513 @@
+#ifndef __MESSAGEPACK_ASYNC_DECODER__HEADER__
+#define __MESSAGEPACK_ASYNC_DECODER__HEADER__
+
+#ifndef __cpp_impl_coroutine
+  #error "AsyncDecoder.h requires C++20 coroutines"
+#endif
+
+#include <sys/mman.h> /* mmap() */
+#include <ucontext.h> /* makecontext(), swapcontext() */
+#include <unistd.h>   /* sysconf() */
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#if defined(__SANITIZE_ADDRESS__)
+  #define MSGPACK_ASAN_FIBERS 1
+#elif defined(__has_feature)
+  #if __has_feature(address_sanitizer)
+    #define MSGPACK_ASAN_FIBERS 1
+  #endif
+#endif
+#ifdef MSGPACK_ASAN_FIBERS
+  #include <sanitizer/common_interface_defs.h>
+#endif
+
+/*
+ * Decoding in coroutines (C++20, POSIX), over an asynchronous byte
+ * source:
+ *
+ *   AsyncDecoder<Connection> dec(conn);
+ *   Request req;
+ *   while (co_await (dec >> req)) handle(req);
+ *
+ * The source is any object with a member
+ *
+ *   Awaitable read_some(char *buf, size_t len);
+ *
+ * whose co_await result is the number of bytes read (at most len), 0 at
+ * the end of the input.
+ *
+ * A value is decoded as its bytes arrive, by the ordinary Decoder, which
+ * runs on a small stack of its own (a fiber, in the calling thread). When
+ * it needs more bytes than have been read, the fiber switches back to the
+ * coroutine, which suspends in read_some() and resumes the fiber where it
+ * stopped once the bytes are there. So the half-decoded state stays where
+ * it is, in the value and on the fiber stack, and the input is never
+ * buffered beyond read_size bytes, however large a value is.
+ *
+ * All errors (of the input, of the value, max_size) are reported through
+ * the AsyncDecoder (see ErrorState).
+ */
+
+namespace MessagePack
+{
+
+  /*
+   * Lazy coroutine result, started by co_await.
+   */
+  template <class T>
+  class AsyncTask
+  {
+    public:
+
+    struct promise_type
+    {
+      T value;
+      std::coroutine_handle<> continuation;
+      std::exception_ptr error;
+
+      promise_type() : value() {}
+
+      AsyncTask get_return_object()
+      {
+        return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      std::suspend_always initial_suspend() noexcept { return {}; }
+
+      struct FinalAwaiter
+      {
+        bool await_ready() noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          std::coroutine_handle<> c = h.promise().continuation;
+          return c ? c : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+      };
+
+      FinalAwaiter final_suspend() noexcept { return {}; }
+
+      void return_value(T v) { value = std::move(v); }
+
+      void unhandled_exception()
+      {
+#ifdef MSGPACK_USE_EXCEPTIONS
+        error = std::current_exception();
+#else
+        abort();
+#endif
+      }
+    };
+
+    private:
+
+    std::coroutine_handle<promise_type> _h;
+
+    explicit AsyncTask(std::coroutine_handle<promise_type> h) : _h(h) {}
+
+    AsyncTask(const AsyncTask&);
+    AsyncTask& operator=(const AsyncTask&);
+
+    public:
+
+    AsyncTask(AsyncTask &&other) noexcept : _h(other._h)
+    {
+      other._h = nullptr;
+    }
+
+    ~AsyncTask()
+    {
+      if (_h) _h.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+      return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+      _h.promise().continuation = caller;
+      return _h;
+    }
+
+    T await_resume()
+    {
+#ifdef MSGPACK_USE_EXCEPTIONS
+      if (_h.promise().error) std::rethrow_exception(_h.promise().error);
+#endif
+      return std::move(_h.promise().value);
+    }
+  };
+
+  /*
+   * A stack to run a synchronous function on, in the calling thread. The
+   * function can switch back to whoever resumed it (yield()) and goes on
+   * from there when resumed again. The lowest page of the stack is a
+   * guard page.
+   */
+  class _Fiber
+  {
+    private:
+
+    ucontext_t _caller;
+    ucontext_t _self;
+    char *_stack;
+    size_t _stack_size;
+    void (*_fn)(void*);
+    void *_arg;
+    bool _running;      // started and not finished
+    bool _inside;       // running right now
+    const void *_caller_stack;      // for AddressSanitizer
+    size_t _caller_stack_size;
+
+    _Fiber(const _Fiber&);
+    _Fiber& operator=(const _Fiber&);
+
+    public:
+
+    _Fiber(size_t stack_size) : _fn(nullptr), _arg(nullptr), _running(false), _inside(false),
+      _caller_stack(nullptr), _caller_stack_size(0)
+    {
+      const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+      _stack_size = (stack_size + page - 1) / page * page + page;
+      _stack = (char*)mmap(nullptr, _stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (_stack != MAP_FAILED) mprotect(_stack, page, PROT_NONE);
+    }
+
+    ~_Fiber()
+    {
+      if (_stack != MAP_FAILED) munmap(_stack, _stack_size);
+    }
+
+    bool ok() const
+    {
+      return _stack != MAP_FAILED;
+    }
+
+    bool running() const
+    {
+      return _running;
+    }
+
+    bool inside() const
+    {
+      return _inside;
+    }
+
+    /*
+     * Runs fn(arg) until it yields or returns. Returns true if it yielded.
+     */
+    bool start(void (*fn)(void*), void *arg)
+    {
+      _fn = fn;
+      _arg = arg;
+      getcontext(&_self);
+      _self.uc_stack.ss_sp = _stack;
+      _self.uc_stack.ss_size = _stack_size;
+      _self.uc_link = &_caller;
+      const uint64_t self = (uint64_t)(uintptr_t)this;
+      makecontext(&_self, (void (*)())&entry, 2, (unsigned)(self >> 32), (unsigned)self);
+      _running = true;
+      return resume();
+    }
+
+    /*
+     * Goes on after yield(). Returns true if the function yielded again.
+     */
+    bool resume()
+    {
+      void *fake = nullptr;
+      switch_begin(&fake, _stack, _stack_size);
+      _inside = true;
+      swapcontext(&_caller, &_self);
+      _inside = false;
+      switch_end(fake);
+      return _running;
+    }
+
+    /*
+     * Called by the function: switches back to resume() (or start()).
+     */
+    void yield()
+    {
+      void *fake = nullptr;
+      switch_begin(&fake, _caller_stack, _caller_stack_size);
+      swapcontext(&_self, &_caller);
+      switch_end(fake, &_caller_stack, &_caller_stack_size);
+    }
+
+    private:
+
+    static void entry(unsigned hi, unsigned lo)
+    {
+      _Fiber *f = (_Fiber*)(uintptr_t)(((uint64_t)hi << 32) | lo);
+      switch_end(nullptr, &f->_caller_stack, &f->_caller_stack_size);
+      f->_fn(f->_arg);
+      f->_running = false;
+      switch_begin(nullptr, f->_caller_stack, f->_caller_stack_size);
+    }   // continues at uc_link
+
+    // tell AddressSanitizer about stack switches
+    static void switch_begin(void **fake, const void *stack, size_t size)
+    {
+#ifdef MSGPACK_ASAN_FIBERS
+      __sanitizer_start_switch_fiber(fake, stack, size);
+#else
+      (void)fake; (void)stack; (void)size;
+#endif
+    }
+
+    static void switch_end(void *fake, const void **stack = nullptr, size_t *size = nullptr)
+    {
+#ifdef MSGPACK_ASAN_FIBERS
+      __sanitizer_finish_switch_fiber(fake, stack, size);
+#else
+      (void)fake; (void)stack; (void)size;
+#endif
+    }
+  };
+
+  template <class Source>
+  class AsyncDecoder : public Reader
+  {
+    private:
+
+    Source &_source;
+    std::vector<char> _buf;
+    const char *_pos;
+    const char *_end;
+    bool _eof;          // the source has ended
+    bool _cancelled;    // a run() is given up, no more input for it
+    Decoder _dec;
+    _Fiber _fiber;
+#ifdef MSGPACK_USE_EXCEPTIONS
+    std::exception_ptr _exception;  // thrown on the fiber
+#endif
+
+    template <class F>
+    struct Call
+    {
+      AsyncDecoder *dec;
+      F *f;
+
+      static void run(void *arg)
+      {
+        Call *c = (Call*)arg;
+#ifdef MSGPACK_USE_EXCEPTIONS
+        try { (*c->f)(c->dec->_dec); }
+        catch (...) { c->dec->_exception = std::current_exception(); }
+#else
+        (*c->f)(c->dec->_dec);
+#endif
+      }
+    };
+
+    /*
+     * Finishes a run() that is destroyed while the fiber waits for input
+     * (the awaiting coroutine is destroyed, or read_some() threw): the
+     * fiber gets no more bytes, so the decoding fails and everything on
+     * its stack is destroyed.
+     */
+    struct Unwind
+    {
+      AsyncDecoder &dec;
+
+      ~Unwind()
+      {
+        if (!dec._fiber.running()) return;
+        NoThrowScope s(dec);
+        dec._cancelled = true;
+        while (dec._fiber.resume()) {}
+        dec._cancelled = false;
+#ifdef MSGPACK_USE_EXCEPTIONS
+        dec._exception = nullptr;
+#endif
+      }
+    };
+
+    AsyncDecoder(const AsyncDecoder&);
+    AsyncDecoder& operator=(const AsyncDecoder&);
+
+    public:
+
+    /*
+     * Reads from source in pieces of up to read_size bytes. Decoding a
+     * value that allocates more than max_size bytes fails with
+     * MSGPACK_E_LIMIT (max_bytes of the limits of decoder(), which can be
+     * changed there). stack_size is the size of the fiber stack.
+     */
+    AsyncDecoder(Source &source, size_t read_size = 64 << 10, size_t max_size = SIZE_MAX,
+        size_t stack_size = 256 << 10) :
+      _source(source), _buf(read_size > 0 ? read_size : 64 << 10), _pos(&_buf[0]), _end(&_buf[0]),
+      _eof(false), _cancelled(false), _dec(this), _fiber(stack_size)
+    {
+      DecodeLimits limits;
+      limits.max_bytes = max_size;
+      _dec.set_limits(limits);
+    }
+
+    /*
+     * Waits for the first byte of the next value. Returns false at the
+     * end of the input or on error.
+     */
+    AsyncTask<bool> next()
+    {
+      while (_pos == _end && !_eof && !failed())
+      {
+        fill(co_await _source.read_some(&_buf[0], _buf.size()));
+      }
+      _dec.reset_usage();
+      co_return _pos < _end && !failed();
+    }
+
+    /*
+     * Runs f(decoder()) on the fiber, suspending whenever it needs bytes
+     * that have not arrived yet. Returns false on error.
+     */
+    template <class F>
+    AsyncTask<bool> run(F f)
+    {
+      if (!_fiber.ok())
+      {
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+        co_return false;
+      }
+      Call<F> call = { this, &f };
+      Unwind unwind = { *this };
+      bool waiting = _fiber.start(&Call<F>::run, &call);
+      while (waiting)
+      {
+        fill(co_await _source.read_some(&_buf[0], _buf.size()));
+        waiting = _fiber.resume();
+      }
+#ifdef MSGPACK_USE_EXCEPTIONS
+      if (_exception)
+      {
+        std::exception_ptr e = nullptr;
+        std::swap(e, _exception);
+        std::rethrow_exception(e);
+      }
+#endif
+      co_return !failed();
+    }
+
+    /*
+     * The Decoder of run(), for its settings (see Decoder::set_limits).
+     * It must not be used elsewhere.
+     */
+    Decoder &decoder()
+    {
+      return _dec;
+    }
+
+    /*
+     * Reader interface of decoder(). A pointer from peek() is valid until
+     * the next read.
+     */
+    virtual void read(void *buffer, size_t sz)
+    {
+      if (sz <= (size_t)(_end - _pos))
+      {
+        memcpy(buffer, _pos, sz);
+        _pos += sz;
+        return;
+      }
+      read_slow((char*)buffer, sz);
+    }
+
+    virtual const char *peek(size_t &avail)
+    {
+      if (_pos == _end) refill();
+      avail = _end - _pos;
+      return _pos;
+    }
+
+    virtual void skip(size_t sz)
+    {
+      while (sz > (size_t)(_end - _pos))
+      {
+        sz -= _end - _pos;
+        _pos = _end;
+        if (!refill())
+        {
+          eof();
+          return;
+        }
+      }
+      _pos += sz;
+    }
+
+    virtual bool at_end()
+    {
+      return _pos == _end && !refill();
+    }
+
+    private:
+
+    void fill(size_t n)
+    {
+      _pos = &_buf[0];
+      _end = _pos + n;
+      if (n == 0) _eof = true;
+    }
+
+    /*
+     * On the fiber: waits until run() has read more input. Returns false
+     * at the end of it.
+     */
+    bool refill()
+    {
+      if (_eof || _cancelled || !_fiber.inside()) return false;
+      _fiber.yield();
+      return _pos < _end;
+    }
+
+    void read_slow(char *buffer, size_t sz)
+    {
+      char *const start = buffer;
+      const size_t total = sz;
+      for (;;)
+      {
+        size_t n = _end - _pos;
+        if (sz <= n) break;
+        if (n > 0) memcpy(buffer, _pos, n);
+        buffer += n;
+        sz -= n;
+        _pos = _end;
+        if (!refill())
+        {
+          memset(start, 0, total);
+          eof();
+          return;
+        }
+      }
+      memcpy(buffer, _pos, sz);
+      _pos += sz;
+    }
+
+    void eof()
+    {
+      if (!failed()) fail(MSGPACK_E_EOF, "truncated input");
+    }
+  };
+
+  /*
+   * co_await (dec >> value): decodes the next value into value. Returns
+   * false at the end of the input or on error.
+   */
+  template <class Source, class T>
+  AsyncTask<bool> operator>>(AsyncDecoder<Source> &dec, T &value)
+  {
+    if (!co_await dec.next()) co_return false;
+    co_return co_await dec.run([&value](Decoder &d) { d >> value; });
+  }
+
+} /* namespace MessagePack */
+
+#endif
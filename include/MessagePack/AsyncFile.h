@@ -0,0 +1,802 @@
+#ifndef __MESSAGEPACK_ASYNC_FILE__HEADER__
+#define __MESSAGEPACK_ASYNC_FILE__HEADER__
+
+#include <sys/stat.h> /* fstat() */
+#include <sys/mman.h> /* mmap() */
+#include <fcntl.h>    /* open() */
+#include <unistd.h>   /* pread(), pwrite() */
+#include <errno.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(__linux__) && defined(__has_include)
+  #if __has_include(<linux/io_uring.h>)
+    #include <linux/io_uring.h>
+    #include <sys/syscall.h> /* __NR_io_uring_setup ... */
+    #ifdef __NR_io_uring_setup
+      #define MSGPACK_USE_IO_URING 1
+    #endif
+  #endif
+#endif
+
+/*
+ * Asynchronous file output and input (POSIX, C++11).
+ *
+ * AsyncFileWriter fills a buffer and hands it to the kernel as soon as it
+ * is full, keeping up to depth writes in flight while encoding goes on in
+ * the next buffer. AsyncFileReader keeps depth reads queued ahead of the
+ * decoder.
+ *
+ * On Linux the requests go through io_uring (raw system calls, no
+ * liburing needed). Where io_uring is unavailable (older kernels,
+ * seccomp) or with MSGPACK_AIO_THREADS, a small pool of threads doing
+ * pwrite()/pread() takes their place.
+ *
+ *   AsyncFileWriter w("snapshot.mpk");
+ *   Encoder enc(&w);
+ *   enc << state;
+ *   w.close();
+ */
+
+namespace MessagePack
+{
+
+  enum AsyncIOMode
+  {
+    MSGPACK_AIO_AUTO,     // io_uring if available, threads otherwise
+    MSGPACK_AIO_THREADS
+  };
+
+  /*
+   * Positional reads and writes completing asynchronously. Completions
+   * are reported by wait() with the tag of the request and the number of
+   * bytes transferred (or -errno).
+   */
+  class _AsyncBackend
+  {
+    public:
+
+    virtual ~_AsyncBackend() {}
+
+    virtual bool submit(bool write, int fd, char *buf, size_t len, uint64_t offset, uint64_t tag) = 0;
+    virtual bool wait(uint64_t &tag, int64_t &res) = 0;
+  };
+
+  class _ThreadBackend : public _AsyncBackend
+  {
+    private:
+
+    struct Request
+    {
+      bool write;
+      int fd;
+      char *buf;
+      size_t len;
+      uint64_t offset;
+      uint64_t tag;
+    };
+
+    std::deque<Request> _queue;
+    std::deque<std::pair<uint64_t, int64_t> > _done;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _queued;
+    std::condition_variable _completed;
+    bool _stop;
+
+    public:
+
+    _ThreadBackend(unsigned nthreads) : _stop(false)
+    {
+      for (unsigned i = 0; i < nthreads; ++i)
+      {
+        _threads.push_back(std::thread(&_ThreadBackend::run, this));
+      }
+    }
+
+    virtual ~_ThreadBackend()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _queued.notify_all();
+      for (size_t i = 0; i < _threads.size(); ++i) _threads[i].join();
+    }
+
+    virtual bool submit(bool write, int fd, char *buf, size_t len, uint64_t offset, uint64_t tag)
+    {
+      Request r = { write, fd, buf, len, offset, tag };
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(r);
+      }
+      _queued.notify_one();
+      return true;
+    }
+
+    virtual bool wait(uint64_t &tag, int64_t &res)
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _completed.wait(lock, [&]{ return !_done.empty(); });
+      tag = _done.front().first;
+      res = _done.front().second;
+      _done.pop_front();
+      return true;
+    }
+
+    private:
+
+    void run()
+    {
+      for (;;)
+      {
+        Request r;
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _queued.wait(lock, [&]{ return _stop || !_queue.empty(); });
+          if (_queue.empty()) return;
+          r = _queue.front();
+          _queue.pop_front();
+        }
+
+        ssize_t n;
+        do
+        {
+          n = r.write ? pwrite(r.fd, r.buf, r.len, (off_t)r.offset)
+                      : pread(r.fd, r.buf, r.len, (off_t)r.offset);
+        } while (n < 0 && errno == EINTR);
+
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _done.push_back(std::make_pair(r.tag, n < 0 ? -(int64_t)errno : (int64_t)n));
+        }
+        _completed.notify_one();
+      }
+    }
+  };
+
+#ifdef MSGPACK_USE_IO_URING
+  class _UringBackend : public _AsyncBackend
+  {
+    private:
+
+    int _ring;
+    void *_sq_map;
+    size_t _sq_map_size;
+    void *_cq_map;
+    size_t _cq_map_size;
+    struct io_uring_sqe *_sqes;
+    size_t _sqes_size;
+
+    unsigned *_sq_tail;
+    unsigned *_sq_mask;
+    unsigned *_sq_array;
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned *_cq_mask;
+    struct io_uring_cqe *_cqes;
+
+    std::vector<struct iovec> _iovs; // one per tag, must stay valid until completion
+
+    _UringBackend(const _UringBackend&);
+    _UringBackend& operator=(const _UringBackend&);
+
+    public:
+
+    _UringBackend() : _ring(-1), _sq_map(MAP_FAILED), _cq_map(MAP_FAILED), _sqes((struct io_uring_sqe*)MAP_FAILED) {}
+
+    virtual ~_UringBackend()
+    {
+      if (_sqes != MAP_FAILED) munmap(_sqes, _sqes_size);
+      if (_cq_map != MAP_FAILED && _cq_map != _sq_map) munmap(_cq_map, _cq_map_size);
+      if (_sq_map != MAP_FAILED) munmap(_sq_map, _sq_map_size);
+      if (_ring >= 0) ::close(_ring);
+    }
+
+    /*
+     * Sets up a ring for up to depth requests in flight (tags 0 ..
+     * depth-1). Returns false if io_uring is not available.
+     */
+    bool init(unsigned depth)
+    {
+      struct io_uring_params p;
+      memset(&p, 0, sizeof(p));
+      _ring = (int)syscall(__NR_io_uring_setup, depth, &p);
+      if (_ring < 0) return false;
+
+      _sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+      _cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+      if (p.features & IORING_FEAT_SINGLE_MMAP)
+      {
+        if (_cq_map_size > _sq_map_size) _sq_map_size = _cq_map_size;
+        _cq_map_size = _sq_map_size;
+      }
+
+      _sq_map = mmap(nullptr, _sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+      if (_sq_map == MAP_FAILED) return false;
+      if (p.features & IORING_FEAT_SINGLE_MMAP)
+      {
+        _cq_map = _sq_map;
+      }
+      else
+      {
+        _cq_map = mmap(nullptr, _cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+        if (_cq_map == MAP_FAILED) return false;
+      }
+      _sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+      _sqes = (struct io_uring_sqe*)mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+      if (_sqes == MAP_FAILED) return false;
+
+      char *sq = (char*)_sq_map;
+      char *cq = (char*)_cq_map;
+      _sq_tail = (unsigned*)(sq + p.sq_off.tail);
+      _sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+      _sq_array = (unsigned*)(sq + p.sq_off.array);
+      _cq_head = (unsigned*)(cq + p.cq_off.head);
+      _cq_tail = (unsigned*)(cq + p.cq_off.tail);
+      _cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+      _cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+      _iovs.resize(depth);
+      return true;
+    }
+
+    virtual bool submit(bool write, int fd, char *buf, size_t len, uint64_t offset, uint64_t tag)
+    {
+      struct iovec &iov = _iovs[tag];
+      iov.iov_base = buf;
+      iov.iov_len = len;
+
+      // the caller never has more than depth requests in flight, so the
+      // submission queue cannot be full
+      unsigned tail = *_sq_tail;
+      unsigned idx = tail & *_sq_mask;
+      struct io_uring_sqe *sqe = &_sqes[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+      sqe->fd = fd;
+      sqe->addr = (uint64_t)(uintptr_t)&iov;
+      sqe->len = 1;
+      sqe->off = offset;
+      sqe->user_data = tag;
+      _sq_array[idx] = idx;
+      __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+      int r;
+      do
+      {
+        r = (int)syscall(__NR_io_uring_enter, _ring, 1, 0, 0, nullptr, 0);
+      } while (r < 0 && errno == EINTR);
+      return r >= 0;
+    }
+
+    virtual bool wait(uint64_t &tag, int64_t &res)
+    {
+      for (;;)
+      {
+        unsigned head = *_cq_head;
+        if (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+        {
+          struct io_uring_cqe *cqe = &_cqes[head & *_cq_mask];
+          tag = cqe->user_data;
+          res = cqe->res;
+          __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+          return true;
+        }
+        int r = (int)syscall(__NR_io_uring_enter, _ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (r < 0 && errno != EINTR) return false;
+      }
+    }
+  };
+#endif
+
+  inline _AsyncBackend *_make_async_backend(unsigned depth, AsyncIOMode mode)
+  {
+#ifdef MSGPACK_USE_IO_URING
+    if (mode == MSGPACK_AIO_AUTO)
+    {
+      _UringBackend *u = new _UringBackend();
+      if (u->init(depth)) return u;
+      delete u;
+    }
+#else
+    (void)mode;
+#endif
+    return new _ThreadBackend(depth);
+  }
+
+  class AsyncFileWriter MSGPACK_FINAL : public Writer
+  {
+    private:
+
+    struct Buffer
+    {
+      std::vector<char> data;
+      size_t len;
+      size_t done;      // bytes written so far (short writes continue)
+      uint64_t offset;
+      bool busy;
+
+      Buffer() : len(0), done(0), offset(0), busy(false) {}
+    };
+
+    int _fd;
+    _AsyncBackend *_backend;
+    std::vector<Buffer> _bufs;
+    size_t _cur;
+    char *_pos;
+    char *_end;
+    uint64_t _offset;   // file offset of the current buffer
+
+    AsyncFileWriter(const AsyncFileWriter&);
+    AsyncFileWriter& operator=(const AsyncFileWriter&);
+
+    public:
+
+    /*
+     * Creates (or truncates) filename. Failures throw, unless throws is
+     * false (then they are recorded and writes are dropped).
+     */
+    AsyncFileWriter(const char *filename, size_t buffer_size = 1 << 20, unsigned depth = 4,
+        AsyncIOMode mode = MSGPACK_AIO_AUTO, bool throws = true)
+    {
+      set_throws(throws);
+      if (buffer_size == 0) buffer_size = 1 << 20;
+      if (depth < 2) depth = 2;
+
+      _fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      _backend = nullptr;
+      _bufs.resize(depth);
+      for (size_t i = 0; i < depth; ++i)
+      {
+        _bufs[i].data.resize(buffer_size);
+      }
+      _cur = 0;
+      _offset = 0;
+      _pos = &_bufs[0].data[0];
+      _end = _pos + buffer_size;
+
+      if (_fd < 0)
+      {
+        _pos = _end = nullptr;
+        fail(MSGPACK_E_FILE, "Failed to open file");
+        return;
+      }
+      _backend = _make_async_backend(depth, mode);
+    }
+
+    virtual ~AsyncFileWriter()
+    {
+      NoThrowScope s(*this);
+      close();
+    }
+
+    /*
+     * Writes out the pending data, waits for all writes and closes the
+     * file. Returns false if anything failed.
+     */
+    bool close()
+    {
+      if (_fd < 0) return !failed();
+
+      if (_backend)
+      {
+        submit_current();
+        for (size_t i = 0; i < _bufs.size(); ++i) acquire(i);
+      }
+      delete _backend;
+      _backend = nullptr;
+      if (::close(_fd) != 0) fail(MSGPACK_E_FILE, "close failed");
+      _fd = -1;
+      _pos = _end = nullptr;
+      return !failed();
+    }
+
+    virtual void write_byte(uint8_t byte)
+    {
+      if (_pos < _end)
+      {
+        *_pos++ = (char)byte;
+        return;
+      }
+      write_slow((const char*)&byte, 1);
+    }
+
+    virtual void write2(uint16_t v)
+    {
+      v = htobe16(v);
+      write(&v, 2);
+    }
+
+    virtual void write4(uint32_t v)
+    {
+      v = htobe32(v);
+      write(&v, 4);
+    }
+
+    virtual void write8(uint64_t v)
+    {
+      v = htobe64(v);
+      write(&v, 8);
+    }
+
+    virtual void write_float(float v)
+    {
+      uint32_t u;
+      memcpy(&u, &v, 4);
+      write4(u);
+    }
+
+    virtual void write_double(double v)
+    {
+      uint64_t u;
+      memcpy(&u, &v, 8);
+      write8(u);
+    }
+
+    virtual void write(const void *buf, size_t len)
+    {
+      if (len <= (size_t)(_end - _pos))
+      {
+        memcpy(_pos, buf, len);
+        _pos += len;
+        return;
+      }
+      write_slow((const char*)buf, len);
+    }
+
+    private:
+
+    void write_slow(const char *buf, size_t len)
+    {
+      if (_fd < 0)
+      {
+        fail(MSGPACK_E_FILE, "write to closed file");
+        return;
+      }
+      if (!_backend)
+      {
+        fail(MSGPACK_E_FILE, "write failed");
+        return;
+      }
+      for (;;)
+      {
+        size_t n = _end - _pos;
+        if (len <= n) break;
+        memcpy(_pos, buf, n);
+        _pos += n;
+        buf += n;
+        len -= n;
+        submit_current();
+        _cur = (_cur + 1) % _bufs.size();
+        acquire(_cur);
+        if (!_backend) return;
+        _pos = &_bufs[_cur].data[0];
+        _end = _pos + _bufs[_cur].data.size();
+      }
+      memcpy(_pos, buf, len);
+      _pos += len;
+    }
+
+    void submit_current()
+    {
+      Buffer &b = _bufs[_cur];
+      b.len = _pos - &b.data[0];
+      b.done = 0;
+      b.offset = _offset;
+      _offset += b.len;
+      _pos = _end;
+      if (b.len == 0) return;
+      b.busy = true;
+      submit(_cur);
+    }
+
+    void submit(size_t i)
+    {
+      Buffer &b = _bufs[i];
+      if (!_backend->submit(true, _fd, &b.data[b.done], b.len - b.done, b.offset + b.done, i))
+      {
+        b.busy = false;
+        fail(MSGPACK_E_FILE, "write failed");
+      }
+    }
+
+    // waits until buffer i is written
+    void acquire(size_t i)
+    {
+      while (_bufs[i].busy)
+      {
+        uint64_t tag;
+        int64_t res;
+        if (!_backend->wait(tag, res))
+        {
+          abandon();
+          fail(MSGPACK_E_FILE, "write failed");
+          return;
+        }
+        Buffer &b = _bufs[tag];
+        if (res <= 0)
+        {
+          b.busy = false;
+          fail(MSGPACK_E_FILE, "write failed");
+          continue;
+        }
+        b.done += (size_t)res;
+        if (b.done < b.len) submit(tag);
+        else b.busy = false;
+      }
+    }
+
+    /*
+     * Gives up after wait() failed. Writes may still be in flight, so the
+     * buffers and the backend are leaked instead of being reused or freed.
+     */
+    void abandon()
+    {
+      (new std::vector<Buffer>())->swap(_bufs);
+      _backend = nullptr;
+      _pos = _end = nullptr;
+    }
+  };
+
+  class AsyncFileReader MSGPACK_FINAL : public Reader
+  {
+    private:
+
+    struct Buffer
+    {
+      std::vector<char> data;
+      size_t len;       // bytes requested
+      size_t got;       // bytes read so far (short reads continue)
+      uint64_t offset;
+      bool queued;
+
+      Buffer() : len(0), got(0), offset(0), queued(false) {}
+    };
+
+    int _fd;
+    _AsyncBackend *_backend;
+    std::vector<Buffer> _bufs;
+    size_t _cur;
+    bool _holding;      // _bufs[_cur] is being consumed
+    uint64_t _next;     // file offset of the next request
+    size_t _size;
+    size_t _consumed;
+    const char *_pos;
+    const char *_end;
+
+    AsyncFileReader(const AsyncFileReader&);
+    AsyncFileReader& operator=(const AsyncFileReader&);
+
+    public:
+
+    /*
+     * Opens filename (a regular file). Failures throw, unless throws is
+     * false (then they are recorded and the reader is empty).
+     */
+    AsyncFileReader(const char *filename, size_t buffer_size = 1 << 20, unsigned depth = 4,
+        AsyncIOMode mode = MSGPACK_AIO_AUTO, bool throws = true)
+    {
+      set_throws(throws);
+      if (buffer_size == 0) buffer_size = 1 << 20;
+      if (depth < 2) depth = 2;
+
+      _backend = nullptr;
+      _cur = 0;
+      _holding = false;
+      _next = 0;
+      _size = 0;
+      _consumed = 0;
+      _pos = _end = nullptr;
+
+      _fd = open(filename, O_RDONLY);
+      struct stat st;
+      if (_fd < 0 || fstat(_fd, &st) != 0)
+      {
+        fail(MSGPACK_E_FILE, "Failed to open file");
+        return;
+      }
+      _size = (size_t)st.st_size;
+
+      _bufs.resize(depth);
+      for (size_t i = 0; i < depth; ++i)
+      {
+        _bufs[i].data.resize(buffer_size);
+      }
+      _backend = _make_async_backend(depth, mode);
+      for (size_t i = 0; i < depth; ++i) queue(i);
+    }
+
+    virtual ~AsyncFileReader()
+    {
+      if (_backend)
+      {
+        // the buffers must outlive pending reads
+        for (size_t i = 0; _backend && i < _bufs.size(); ++i)
+        {
+          while (_bufs[i].queued)
+          {
+            uint64_t tag;
+            int64_t res;
+            if (!_backend->wait(tag, res))
+            {
+              abandon();
+              break;
+            }
+            _bufs[tag].queued = false;
+          }
+        }
+        delete _backend;
+      }
+      if (_fd >= 0) ::close(_fd);
+    }
+
+    virtual void read(void *buffer, size_t sz)
+    {
+      if (sz <= (size_t)(_end - _pos))
+      {
+        memcpy(buffer, _pos, sz);
+        _pos += sz;
+        _consumed += sz;
+        return;
+      }
+      read_slow((char*)buffer, sz);
+    }
+
+    virtual const char *peek(size_t &avail)
+    {
+      if (_pos == _end) next_buffer();
+      avail = _end - _pos;
+      return _pos;
+    }
+
+    virtual void skip(size_t sz)
+    {
+      while (sz > (size_t)(_end - _pos))
+      {
+        sz -= _end - _pos;
+        _consumed += _end - _pos;
+        _pos = _end;
+        if (!next_buffer())
+        {
+          eof();
+          return;
+        }
+      }
+      _pos += sz;
+      _consumed += sz;
+    }
+
+    virtual bool at_end()
+    {
+      return _consumed >= _size || failed();
+    }
+
+    virtual size_t remaining()
+    {
+      return _consumed < _size ? _size - _consumed : 0;
+    }
+
+    private:
+
+    void queue(size_t i)
+    {
+      Buffer &b = _bufs[i];
+      if (_next >= _size) return;
+      b.len = _bufs[i].data.size();
+      if (b.len > _size - _next) b.len = _size - _next;
+      b.got = 0;
+      b.offset = _next;
+      _next += b.len;
+      b.queued = true;
+      submit(i);
+    }
+
+    void submit(size_t i)
+    {
+      Buffer &b = _bufs[i];
+      if (!_backend->submit(false, _fd, &b.data[b.got], b.len - b.got, b.offset + b.got, i))
+      {
+        b.queued = false;
+        b.len = 0;
+        fail(MSGPACK_E_FILE, "read failed");
+      }
+    }
+
+    /*
+     * Requeues the current buffer and moves on to the next one, waiting
+     * for it if necessary. Returns false at the end of the input.
+     */
+    bool next_buffer()
+    {
+      if (!_backend) return false;
+      if (_holding)
+      {
+        _holding = false;
+        queue(_cur);
+        _cur = (_cur + 1) % _bufs.size();
+      }
+
+      Buffer &b = _bufs[_cur];
+      while (b.queued)
+      {
+        uint64_t tag;
+        int64_t res;
+        if (!_backend->wait(tag, res))
+        {
+          abandon();
+          fail(MSGPACK_E_FILE, "read failed");
+          return false;
+        }
+        Buffer &c = _bufs[tag];
+        if (res <= 0)
+        {
+          // error, or the file shrank
+          c.queued = false;
+          c.len = c.got;
+          fail(MSGPACK_E_FILE, "read failed");
+          continue;
+        }
+        c.got += (size_t)res;
+        if (c.got < c.len) submit(tag);
+        else c.queued = false;
+      }
+
+      if (b.got == 0 || _consumed >= _size) return false;
+      _holding = true;
+      _pos = &b.data[0];
+      _end = _pos + b.got;
+      b.got = 0;
+      return true;
+    }
+
+    void read_slow(char *buffer, size_t sz)
+    {
+      char *const start = buffer;
+      const size_t total = sz;
+      for (;;)
+      {
+        size_t n = _end - _pos;
+        if (sz <= n) break;
+        if (n > 0) memcpy(buffer, _pos, n);
+        buffer += n;
+        sz -= n;
+        _consumed += n;
+        _pos = _end;
+        if (!next_buffer())
+        {
+          memset(start, 0, total);
+          eof();
+          return;
+        }
+      }
+      memcpy(buffer, _pos, sz);
+      _pos += sz;
+      _consumed += sz;
+    }
+
+    void eof()
+    {
+      if (!failed()) fail(MSGPACK_E_EOF, "read over buffer boundaries");
+    }
+
+    /*
+     * Gives up after wait() failed. Reads may still be in flight, so the
+     * buffers and the backend are leaked instead of being reused or freed.
+     */
+    void abandon()
+    {
+      (new std::vector<Buffer>())->swap(_bufs);
+      _backend = nullptr;
+      _holding = false;
+      _pos = _end = nullptr;
+    }
+  };
+
+} /* namespace MessagePack */
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef __MESSAGEPACK_CHUNKED_ENCODER__HEADER__
+#define __MESSAGEPACK_CHUNKED_ENCODER__HEADER__
+
+#include <vector>
+#include <deque>
+#include <string>
+
+/*
+ * Resumable encoding in bounded steps (C++11), for event loops that
+ * stream large responses:
+ *
+ *   ChunkedEncoder enc;
+ *   enc.encode(response);       // kept by reference until done()
+ *
+ *   // whenever the socket is writable
+ *   size_t n = enc.step(buf, sizeof(buf));
+ *   send(fd, buf, n, 0);
+ *   if (enc.done()) ...
+ *
+ * step() produces at most n bytes and returns, remembering where it
+ * stopped; the next call continues from there. Nothing is encoded twice
+ * and memory use does not depend on the size of the value.
+ *
+ * The encoder keeps a stack of the containers being walked (vector, set,
+ * map, unordered_set, unordered_map), one frame per nesting level. Long
+ * strings and pre-encoded values (EncodedValue) are copied into the
+ * output piece by piece, straight from the source. Any other value
+ * (numbers, tuples, Fields.h structs, ...) is encoded with the
+ * Serialize.h operators into a small staging buffer as a whole, so it
+ * should be small compared to n.
+ *
+ * The values passed to encode() are referenced, not copied (except
+ * numbers): they must stay alive and unchanged until done().
+ */
+
+namespace MessagePack
+{
+
+  template <class Profile> class BasicChunkedEncoder;
+
+  /*
+   * A value being encoded by a BasicChunkedEncoder.
+   */
+  template <class Profile>
+  struct _ChunkFrame
+  {
+    virtual ~_ChunkFrame() {}
+
+    /*
+     * Emits the next piece of the value: header, elements until the
+     * encoder yields (see BasicChunkedEncoder::yielded()). Returns false
+     * once there is nothing left to emit.
+     */
+    virtual bool next(BasicChunkedEncoder<Profile> &enc) = 0;
+  };
+
+  template <class Profile = CompactProfile>
+  class BasicChunkedEncoder
+  {
+    private:
+
+    BufferedMemoryWriter _stage;
+    BasicEncoder<Profile, BufferedMemoryWriter> _enc;
+    size_t _stage_pos;          // staged bytes already handed out
+
+    const char *_raw;           // string body being copied out
+    size_t _raw_len;
+
+    std::vector<_ChunkFrame<Profile>*> _stack;
+    std::deque<_ChunkFrame<Profile>*> _roots;  // values not started yet
+    size_t _budget;             // room left in the current step
+
+    BasicChunkedEncoder(const BasicChunkedEncoder&);
+    BasicChunkedEncoder& operator=(const BasicChunkedEncoder&);
+
+    public:
+
+    BasicChunkedEncoder() : _stage(256), _enc(&_stage), _stage_pos(0),
+      _raw(nullptr), _raw_len(0), _budget(0) {}
+
+    ~BasicChunkedEncoder()
+    {
+      clear();
+    }
+
+    /*
+     * Appends v to the output, after everything encoded before.
+     */
+    template <class T>
+    void encode(const T &v);
+
+    /*
+     * Writes up to n bytes of output to out and returns their number,
+     * less than n only once everything is written (or on error).
+     */
+    size_t step(char *out, size_t n)
+    {
+      size_t len = 0;
+      for (;;)
+      {
+        size_t staged = _stage.size() - _stage_pos;
+        if (staged > 0)
+        {
+          size_t k = staged < n - len ? staged : n - len;
+          memcpy(out + len, (const char*)_stage.data() + _stage_pos, k);
+          _stage_pos += k;
+          len += k;
+          if (k < staged) return len;
+        }
+        _stage.reset();
+        _stage_pos = 0;
+
+        if (_raw_len > 0)
+        {
+          size_t k = _raw_len < n - len ? _raw_len : n - len;
+          memcpy(out + len, _raw, k);
+          _raw += k;
+          _raw_len -= k;
+          len += k;
+          if (_raw_len > 0) return len;
+        }
+
+        if (len == n || _stage.failed()) return len;
+
+        _budget = n - len;
+        if (_stack.empty())
+        {
+          if (_roots.empty()) return len;
+          _ChunkFrame<Profile> *root = _roots.front();
+          _roots.pop_front();
+          root->next(*this);
+          delete root;
+          continue;
+        }
+
+        _ChunkFrame<Profile> *top = _stack.back();
+        if (!top->next(*this))
+        {
+          assert(_stack.back() == top);
+          _stack.pop_back();
+          delete top;
+        }
+      }
+    }
+
+    /*
+     * Whether all output has been produced by step().
+     */
+    bool done() const
+    {
+      return _stack.empty() && _roots.empty() && _raw_len == 0 &&
+             _stage_pos == _stage.size();
+    }
+
+    /*
+     * Drops the remaining output.
+     */
+    void clear()
+    {
+      for (size_t i = 0; i < _stack.size(); ++i) delete _stack[i];
+      for (size_t i = 0; i < _roots.size(); ++i) delete _roots[i];
+      _stack.clear();
+      _roots.clear();
+      _raw = nullptr;
+      _raw_len = 0;
+      _stage.reset();
+      _stage_pos = 0;
+    }
+
+    /*
+     * Errors of the staging buffer (out of memory, see ErrorState).
+     */
+    Error error() const
+    {
+      return _stage.error();
+    }
+
+    bool failed() const
+    {
+      return _stage.failed();
+    }
+
+    //
+    // Used by the frames.
+    //
+
+    BasicEncoder<Profile, BufferedMemoryWriter> &stage()
+    {
+      return _enc;
+    }
+
+    void push_frame(_ChunkFrame<Profile> *frame)
+    {
+      _stack.push_back(frame);
+    }
+
+    /*
+     * Copies len bytes from raw to the output after the staged bytes.
+     */
+    void stream_raw(const char *raw, size_t len)
+    {
+      _raw = raw;
+      _raw_len = len;
+    }
+
+    /*
+     * Whether frame has to return to step(): it pushed a child frame,
+     * started a string body, or staged enough for this step.
+     */
+    bool yielded(const _ChunkFrame<Profile> *frame) const
+    {
+      return _stack.back() != frame || _raw_len > 0 || _stage.size() >= _budget;
+    }
+  };
+
+  typedef BasicChunkedEncoder<CompactProfile> ChunkedEncoder;
+
+  //
+  // Frames. _chunk_push() starts a value: containers and long strings get
+  // resumable treatment, everything else is staged in one piece.
+  //
+
+  template <class P, class T>
+  inline void _chunk_push(BasicChunkedEncoder<P> &enc, const T &v)
+  {
+    enc.stage() << v;
+  }
+
+  template <class P>
+  inline void _chunk_push(BasicChunkedEncoder<P> &enc, const std::string &v)
+  {
+    if (v.size() <= 64)
+    {
+      enc.stage() << v;
+      return;
+    }
+    enc.stage().emit_raw_header(boost::numeric_cast<unsigned int>(v.size()));
+    enc.stream_raw(v.data(), v.size());
+  }
+
+  template <class P>
+  inline void _chunk_push(BasicChunkedEncoder<P> &enc, const EncodedValue &v)
+  {
+    if (v.size() <= 64)
+    {
+      enc.stage() << v;
+      return;
+    }
+    enc.stream_raw(v.data(), v.size());
+  }
+
+  template <class P, class C>
+  struct _ChunkSeqFrame : _ChunkFrame<P>
+  {
+    typename C::const_iterator it, end;
+    uint32_t size;
+    bool started;
+
+    _ChunkSeqFrame(const C &c) : it(c.begin()), end(c.end()),
+      size(boost::numeric_cast<unsigned int>(c.size())), started(false) {}
+
+    virtual bool next(BasicChunkedEncoder<P> &enc)
+    {
+      if (!started)
+      {
+        enc.stage().emit_array(size);
+        started = true;
+      }
+      while (it != end)
+      {
+        _chunk_push(enc, *it);
+        ++it;
+        if (enc.yielded(this)) return true;
+      }
+      return false;
+    }
+  };
+
+  template <class P, class C>
+  struct _ChunkMapFrame : _ChunkFrame<P>
+  {
+    typename C::const_iterator it, end;
+    uint32_t size;
+    bool started;
+    bool value;   // the key of *it is out
+
+    _ChunkMapFrame(const C &c) : it(c.begin()), end(c.end()),
+      size(boost::numeric_cast<unsigned int>(c.size())), started(false), value(false) {}
+
+    virtual bool next(BasicChunkedEncoder<P> &enc)
+    {
+      if (!started)
+      {
+        enc.stage().emit_map(size);
+        started = true;
+      }
+      while (it != end)
+      {
+        if (!value)
+        {
+          _chunk_push(enc, it->first);
+          value = true;
+          if (enc.yielded(this)) return true;
+        }
+        _chunk_push(enc, it->second);
+        value = false;
+        ++it;
+        if (enc.yielded(this)) return true;
+      }
+      return false;
+    }
+  };
+
+  template <class P, class T>
+  inline void _chunk_push(BasicChunkedEncoder<P> &enc, const vector<T> &v)
+  {
+    enc.push_frame(new _ChunkSeqFrame<P, vector<T> >(v));
+  }
+
+  template <class P, class T>
+  inline void _chunk_push(BasicChunkedEncoder<P> &enc, const set<T> &v)
+  {
+    enc.push_frame(new _ChunkSeqFrame<P, set<T> >(v));
+  }
+
+  template <class P, class T>
+  inline void _chunk_push(BasicChunkedEncoder<P> &enc, const unordered_set<T> &v)
+  {
+    enc.push_frame(new _ChunkSeqFrame<P, unordered_set<T> >(v));
+  }
+
+  template <class P, class K, class V>
+  inline void _chunk_push(BasicChunkedEncoder<P> &enc, const map<K, V> &v)
+  {
+    enc.push_frame(new _ChunkMapFrame<P, map<K, V> >(v));
+  }
+
+  template <class P, class K, class V>
+  inline void _chunk_push(BasicChunkedEncoder<P> &enc, const unordered_map<K, V> &v)
+  {
+    enc.push_frame(new _ChunkMapFrame<P, unordered_map<K, V> >(v));
+  }
+
+  /*
+   * A value passed to encode(), started once its turn comes. Numbers are
+   * copied, so that encode(42) works.
+   */
+  template <class P, class T>
+  struct _ChunkRootFrame : _ChunkFrame<P>
+  {
+    typename std::conditional<std::is_arithmetic<T>::value, T, const T&>::type value;
+
+    _ChunkRootFrame(const T &v) : value(v) {}
+
+    virtual bool next(BasicChunkedEncoder<P> &enc)
+    {
+      _chunk_push(enc, value);
+      return false;
+    }
+  };
+
+  template <class Profile>
+  template <class T>
+  void BasicChunkedEncoder<Profile>::encode(const T &v)
+  {
+    _roots.push_back(new _ChunkRootFrame<Profile, T>(v));
+  }
+
+} /* namespace MessagePack */
+
+#endif
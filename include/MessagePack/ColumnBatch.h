@@ -0,0 +1,444 @@
+#ifndef __MESSAGEPACK_COLUMN_BATCH__HEADER__
+#define __MESSAGEPACK_COLUMN_BATCH__HEADER__
+
+#include <stdint.h>   /* uint32_t ... */
+#include <string.h>   /* memcmp() */
+#include <vector>
+#include <string>
+
+/*
+ * Row-to-columnar batch decoding.
+ *
+ * Decodes a stream of homogeneous records (as produced for
+ * MessagePack.each) into struct-of-arrays form: one contiguous buffer per
+ * column plus a null bitmap. A record is either a map (fields are matched
+ * by column name) or an array (fields are matched by column position, i.e.
+ * the order in which the columns were added).
+ *
+ *   ColumnBatchDecoder batch;
+ *   Column<int64_t> &ts = batch.add_column<int64_t>("ts");
+ *   Column<std::string> &host = batch.add_column<std::string>("host");
+ *
+ *   while (batch.decode(dec, 4096) > 0)
+ *   {
+ *     aggregate(ts.data(), ts.null_bitmap(), batch.rows());
+ *   }
+ *
+ * Fields without a column are skipped without being materialized. Missing
+ * fields and nil values become nulls (the value slot holds T()).
+ */
+
+namespace MessagePack
+{
+
+  /*
+   * Base class of all columns of a ColumnBatchDecoder.
+   */
+  class ColumnBase
+  {
+    private:
+
+    std::string _name;
+    std::vector<uint8_t> _nulls; // bit i set: row i is null
+    size_t _rows;
+
+    ColumnBase(const ColumnBase&);
+    ColumnBase& operator=(const ColumnBase&);
+
+    protected:
+
+    virtual void push_value(Decoder &dec, DataType t, DataValue &d) = 0;
+    virtual void push_default() = 0;
+    virtual void reserve_values(size_t n) = 0;
+    virtual void clear_values() = 0;
+
+    public:
+
+    ColumnBase(const char *name) : _name(name), _rows(0) {}
+
+    virtual ~ColumnBase() {}
+
+    const std::string &name() const
+    {
+      return _name;
+    }
+
+    size_t rows() const
+    {
+      return _rows;
+    }
+
+    bool is_null(size_t row) const
+    {
+      return (_nulls[row >> 3] >> (row & 7)) & 1;
+    }
+
+    /*
+     * One bit per row, least significant bit first.
+     */
+    const uint8_t *null_bitmap() const
+    {
+      return _nulls.empty() ? nullptr : &_nulls[0];
+    }
+
+    /*
+     * Appends the item just returned by dec.read_next() (t, d).
+     */
+    void append(Decoder &dec, DataType t, DataValue &d)
+    {
+      if (t == MSGPACK_T_NIL)
+      {
+        append_null();
+        return;
+      }
+      if ((_rows & 7) == 0) _nulls.push_back(0);
+      push_value(dec, t, d);
+      ++_rows;
+    }
+
+    void append_null()
+    {
+      if ((_rows & 7) == 0) _nulls.push_back(0);
+      _nulls[_rows >> 3] |= (uint8_t)(1 << (_rows & 7));
+      push_default();
+      ++_rows;
+    }
+
+    void reserve(size_t n)
+    {
+      _nulls.reserve((n + 7) / 8);
+      reserve_values(n);
+    }
+
+    /*
+     * Removes all rows but keeps the allocated buffers.
+     */
+    void clear()
+    {
+      _nulls.clear();
+      clear_values();
+      _rows = 0;
+    }
+  };
+
+  /*
+   * Conversion of a decoded item into the value type of a column.
+   */
+  template <class T>
+  struct _ColumnValue;
+
+  #define DEF_COLUMN_INTEGER(type, conv) \
+    template <> struct _ColumnValue<type> { \
+      static type convert(Decoder &dec, DataType t, DataValue &d) { return dec.conv<type>(t, d); } \
+    };
+
+  DEF_COLUMN_INTEGER(uint8_t, convert_unsigned)
+  DEF_COLUMN_INTEGER(uint16_t, convert_unsigned)
+  DEF_COLUMN_INTEGER(uint32_t, convert_unsigned)
+  DEF_COLUMN_INTEGER(uint64_t, convert_unsigned)
+  DEF_COLUMN_INTEGER(int8_t, convert_signed)
+  DEF_COLUMN_INTEGER(int16_t, convert_signed)
+  DEF_COLUMN_INTEGER(int32_t, convert_signed)
+  DEF_COLUMN_INTEGER(int64_t, convert_signed)
+
+  #undef DEF_COLUMN_INTEGER
+
+  // Floating point columns accept both float and double items.
+  #define DEF_COLUMN_FLOAT(type) \
+    template <> struct _ColumnValue<type> { \
+      static type convert(Decoder &dec, DataType t, DataValue &d) { \
+        if (t == MSGPACK_T_FLOAT) return (type)d.f; \
+        if (t == MSGPACK_T_DOUBLE) return (type)d.d; \
+        dec.fail("column: no float given"); \
+        return 0; \
+      } \
+    };
+
+  DEF_COLUMN_FLOAT(float)
+  DEF_COLUMN_FLOAT(double)
+
+  #undef DEF_COLUMN_FLOAT
+
+  template <> struct _ColumnValue<bool> {
+    static uint8_t convert(Decoder &dec, DataType t, DataValue &d) {
+      if (t != MSGPACK_T_BOOL)
+      {
+        dec.fail("column: no bool given");
+        return 0;
+      }
+      return d.b ? 1 : 0;
+    }
+  };
+
+  template <class T>
+  struct _ColumnStorage {
+    typedef T type;
+  };
+
+  // bool columns are stored one byte per row to keep them contiguous.
+  template <>
+  struct _ColumnStorage<bool> {
+    typedef uint8_t type;
+  };
+
+  template <class T>
+  class Column : public ColumnBase
+  {
+    public:
+
+    typedef typename _ColumnStorage<T>::type value_type;
+
+    private:
+
+    std::vector<value_type> _values;
+
+    protected:
+
+    virtual void push_value(Decoder &dec, DataType t, DataValue &d)
+    {
+      _values.push_back(_ColumnValue<T>::convert(dec, t, d));
+    }
+
+    virtual void push_default()
+    {
+      _values.push_back(value_type());
+    }
+
+    virtual void reserve_values(size_t n)
+    {
+      _values.reserve(n);
+    }
+
+    virtual void clear_values()
+    {
+      _values.clear();
+    }
+
+    public:
+
+    Column(const char *name) : ColumnBase(name) {}
+
+    virtual ~Column() {}
+
+    const std::vector<value_type> &values() const
+    {
+      return _values;
+    }
+
+    const value_type *data() const
+    {
+      return _values.empty() ? nullptr : &_values[0];
+    }
+
+    const value_type &operator[](size_t row) const
+    {
+      return _values[row];
+    }
+  };
+
+  template <>
+  inline void Column<std::string>::push_value(Decoder &dec, DataType t, DataValue &d)
+  {
+    _values.push_back(std::string());
+    if (t != MSGPACK_T_RAW)
+    {
+      dec.fail("column: no raw given");
+      return;
+    }
+    std::string &s = _values.back();
+    s.resize(d.len);
+    dec.read_raw_body((char*)s.data(), d.len);
+  }
+
+  class ColumnBatchDecoder
+  {
+    private:
+
+    std::vector<ColumnBase*> _columns;
+    std::string _key;
+    size_t _rows;
+    size_t _hint;
+
+    ColumnBatchDecoder(const ColumnBatchDecoder&);
+    ColumnBatchDecoder& operator=(const ColumnBatchDecoder&);
+
+    public:
+
+    ColumnBatchDecoder() : _rows(0), _hint(0) {}
+
+    ~ColumnBatchDecoder()
+    {
+      for (size_t i = 0; i < _columns.size(); ++i)
+      {
+        delete _columns[i];
+      }
+      _columns.clear();
+    }
+
+    /*
+     * Adds a column. For array records, it takes the field at the position
+     * of the column (0 for the first column added, and so on).
+     */
+    template <class T>
+    Column<T> &add_column(const char *name)
+    {
+      Column<T> *c = new Column<T>(name);
+      _columns.push_back(c);
+      return *c;
+    }
+
+    size_t columns() const
+    {
+      return _columns.size();
+    }
+
+    const ColumnBase &column(size_t i) const
+    {
+      return *_columns[i];
+    }
+
+    size_t rows() const
+    {
+      return _rows;
+    }
+
+    /*
+     * Removes all rows from all columns but keeps their buffers.
+     */
+    void clear()
+    {
+      for (size_t i = 0; i < _columns.size(); ++i)
+      {
+        _columns[i]->clear();
+      }
+      _rows = 0;
+    }
+
+    /*
+     * Clears the batch and decodes up to max_records records (fewer if
+     * the reader runs out of input). Returns the number of records read.
+     */
+    size_t decode(Decoder &dec, size_t max_records)
+    {
+      clear();
+      for (size_t i = 0; i < _columns.size(); ++i)
+      {
+        _columns[i]->reserve(max_records);
+      }
+
+      while (_rows < max_records && !dec.get_reader()->at_end() && !dec.failed())
+      {
+        decode_record(dec);
+      }
+      return _rows;
+    }
+
+    /*
+     * Appends a single record. Size-less maps and arrays are accepted,
+     * too.
+     */
+    void decode_record(Decoder &dec)
+    {
+      DataValue d;
+      const DataType t = dec.read_next(d);
+      const bool open = (t == MSGPACK_T_MAP_BEG || t == MSGPACK_T_ARRAY_BEG);
+      if (open) d.len = 0;
+
+      switch (t)
+      {
+        case MSGPACK_T_MAP:
+        case MSGPACK_T_MAP_BEG:
+          for (uint32_t n = d.len; (open ? !dec.read_end() : n > 0) && !dec.failed(); --n)
+          {
+            ColumnBase *c = read_key(dec);
+            if (c && c->rows() == _rows)
+            {
+              DataType t = dec.read_next(d);
+              c->append(dec, t, d);
+            }
+            else
+            {
+              // unknown or duplicate field
+              dec.skip_value();
+            }
+          }
+          break;
+        case MSGPACK_T_ARRAY:
+        case MSGPACK_T_ARRAY_BEG:
+          for (uint32_t i = 0; (open ? !dec.read_end() : i < d.len) && !dec.failed(); ++i)
+          {
+            if (i < _columns.size())
+            {
+              DataValue v;
+              DataType t = dec.read_next(v);
+              _columns[i]->append(dec, t, v);
+            }
+            else
+            {
+              dec.skip_value();
+            }
+          }
+          break;
+        default:
+          dec.fail("column batch: record is neither map nor array");
+          return;
+      }
+
+      for (size_t i = 0; i < _columns.size(); ++i)
+      {
+        if (_columns[i]->rows() == _rows) _columns[i]->append_null();
+      }
+      ++_rows;
+    }
+
+    private:
+
+    /*
+     * Reads a map key and returns the matching column (or nullptr).
+     * Keys are compared in place when the reader holds them in memory.
+     * Records of one stream usually list their fields in the same order,
+     * so the column following the last match is tried first.
+     */
+    ColumnBase *read_key(Decoder &dec)
+    {
+      DataValue d;
+      DataType t = dec.read_next(d);
+      if (t != MSGPACK_T_RAW)
+      {
+        dec.skip_body(t, d);
+        return nullptr;
+      }
+
+      Reader *r = dec.get_reader();
+      size_t avail;
+      const char *key = r->peek(avail);
+      const bool in_place = (avail >= d.len);
+      if (!in_place)
+      {
+        _key.resize(d.len);
+        dec.read_raw_body((char*)_key.data(), d.len);
+        key = _key.data();
+      }
+
+      ColumnBase *match = nullptr;
+      const size_t n = _columns.size();
+      for (size_t j = 0; j < n; ++j)
+      {
+        size_t i = (_hint + j) % n;
+        const std::string &name = _columns[i]->name();
+        if (name.size() == d.len && memcmp(name.data(), key, d.len) == 0)
+        {
+          _hint = i + 1;
+          match = _columns[i];
+          break;
+        }
+      }
+
+      if (in_place) r->skip(d.len);
+      return match;
+    }
+  };
+
+} /* namespace MessagePack */
+
+#endif
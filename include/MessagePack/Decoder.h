@@ -15,6 +15,10 @@ namespace MessagePack
     MSGPACK_T_ARRAY,
     MSGPACK_T_MAP,
     MSGPACK_T_RAW,
+    MSGPACK_T_EXT,
+    MSGPACK_T_ARRAY_BEG,  // size-less array (extension), see read_end()
+    MSGPACK_T_MAP_BEG,    // size-less map (extension)
+    MSGPACK_T_END,        // end of a size-less array or map
     MSGPACK_T_RESERVED,
     MSGPACK_T_INVALID
   };
@@ -27,6 +31,38 @@ namespace MessagePack
     float    f;
     double   d;
     uint32_t len;
+    struct { uint32_t len; int8_t type; } ext; // ext.len aliases len
+  };
+
+  /*
+   * Resource limits for decoding untrusted input (see Decoder::set_limits).
+   * The defaults do not limit anything.
+   */
+  struct DecodeLimits
+  {
+    uint32_t max_depth;     // nesting of arrays and maps
+    uint32_t max_elements;  // elements of one array, entries of one map
+    size_t max_bytes;       // memory allocated for decoded values in total
+
+    DecodeLimits() :
+      max_depth(UINT32_MAX), max_elements(UINT32_MAX), max_bytes(SIZE_MAX) {}
+  };
+
+  /*
+   * Totals of a message, as gathered by Decoder::scan_value().
+   */
+  struct DecodeStats
+  {
+    size_t items;      // data items, including arrays and maps
+    size_t arrays;
+    size_t maps;
+    size_t elements;   // array elements plus map entries
+    size_t raws;
+    size_t raw_bytes;
+    size_t ext_bytes;
+
+    DecodeStats() :
+      items(0), arrays(0), maps(0), elements(0), raws(0), raw_bytes(0), ext_bytes(0) {}
   };
 
   class Decoder
@@ -34,31 +70,144 @@ namespace MessagePack
     private:
 
     Reader *buffer;
+    bool _reuse;
+    bool _limited;
+    DecodeLimits _limits;
+    uint32_t _depth;
+    size_t _bytes;
+    int _lookahead;     // byte read by read_end(), or -1
 
     public:
 
     Reader *get_reader() const { return buffer; }
 
-    Decoder(Reader *buf) : buffer(buf) { }
+    Decoder(Reader *buf) : buffer(buf), _reuse(false), _limited(false),
+      _depth(0), _bytes(0), _lookahead(-1) { }
+
+    /*
+     * In reuse mode, the Serialize.h operators decode over the elements a
+     * vector already holds instead of discarding them. Decoding into a
+     * long-lived object then keeps the capacity of its vectors and
+     * strings.
+     */
+    void set_reuse(bool reuse) { _reuse = reuse; }
+    bool reuse() const { return _reuse; }
+
+    /*
+     * Reports invalid input through the Reader (see ErrorState): throws
+     * an InvalidDecodeException or records the error.
+     */
+    void fail(const char *msg) { buffer->fail(MSGPACK_E_INVALID_DECODE, msg); }
+
+    bool failed() const { return buffer->failed(); }
+    Error error() const { return buffer->error(); }
+
+    /*
+     * Enables checking of untrusted input. Every array, map, raw or ext
+     * header must then announce no more than what is left in the input
+     * (each element takes at least one byte), and the limits are enforced
+     * by read_next() (max_elements), enter() (max_depth) and charge()
+     * (max_bytes). Violations fail with MSGPACK_E_LIMIT (or MSGPACK_E_EOF
+     * for truncated input); a failing header reads as empty.
+     */
+    void set_limits(const DecodeLimits &limits)
+    {
+      _limits = limits;
+      _limited = true;
+      reset_usage();
+    }
+
+    bool limited() const { return _limited; }
+    const DecodeLimits &limits() const { return _limits; }
+
+    /*
+     * Resets the bytes charged so far, e.g. between two messages.
+     */
+    void reset_usage() { _bytes = 0; }
+
+    /*
+     * Accounts for memory about to be allocated for a decoded value.
+     * Returns false if this exceeds max_bytes, which the caller must
+     * not allocate then.
+     */
+    bool charge(size_t bytes)
+    {
+      if (!_limited) return true;
+      if (bytes > _limits.max_bytes - _bytes)
+      {
+        buffer->fail(MSGPACK_E_LIMIT, "decode: max_bytes exceeded");
+        return false;
+      }
+      _bytes += bytes;
+      return true;
+    }
+
+    /*
+     * Bracket the decoding of the elements of an array or map. Returns
+     * false if this exceeds max_depth (leave() must still be called).
+     */
+    bool enter()
+    {
+      if (++_depth > _limits.max_depth && _limited)
+      {
+        buffer->fail(MSGPACK_E_LIMIT, "decode: max_depth exceeded");
+        return false;
+      }
+      return true;
+    }
+
+    void leave() { --_depth; }
+
+    uint32_t depth() const { return _depth; }
+
+    /*
+     * Scoped enter()/leave().
+     */
+    class Nesting
+    {
+      private:
+
+      Decoder &_dec;
+      bool _ok;
+
+      Nesting(const Nesting&);
+      Nesting& operator=(const Nesting&);
+
+      public:
+
+      Nesting(Decoder &dec) : _dec(dec), _ok(dec.enter()) {}
+      ~Nesting() { _dec.leave(); }
+
+      bool ok() const { return _ok; }
+    };
 
     /*
      * Returns the next data item in data.
      */
     inline DataType read_next(DataValue &data)
     {
-      uint8_t c = buffer->read_byte();
+      uint8_t c;
+      if (_lookahead < 0)
+      {
+        c = buffer->read_byte();
+      }
+      else
+      {
+        c = (uint8_t)_lookahead;
+        _lookahead = -1;
+      }
       if (c <= 0x7f) {
         data.u = c;
         return MSGPACK_T_UINT;
       } else if (c <= 0x8f) {
         data.len = c & 0x0F;
-        return MSGPACK_T_MAP;
+        return sized(MSGPACK_T_MAP, data);
       } else if (c <= 0x9f) {
         data.len = c & 0x0F;
-        return MSGPACK_T_ARRAY;
+        return sized(MSGPACK_T_ARRAY, data);
       } else if (c <= 0xbf) {
         data.len = c & 0x1F;
-        return MSGPACK_T_RAW;
+        return sized(MSGPACK_T_RAW, data);
       } else if (c >= 0xe0) {
         data.i = (int8_t) c;
         return MSGPACK_T_INT;
@@ -67,19 +216,35 @@ namespace MessagePack
           case 0xc0:
             return MSGPACK_T_NIL;
           case 0xc4:
+            return MSGPACK_T_ARRAY_BEG;
+          case 0xc6:
+            return MSGPACK_T_MAP_BEG;
           case 0xc5:
+            return MSGPACK_T_END;
           case 0xc1:
-          case 0xc6:
+          case 0xd9:
+            return MSGPACK_T_RESERVED;
           case 0xc7:
+            data.ext.len = buffer->read_byte();
+            data.ext.type = (int8_t)buffer->read_byte();
+            return sized(MSGPACK_T_EXT, data);
           case 0xc8:
+            data.ext.len = buffer->read2();
+            data.ext.type = (int8_t)buffer->read_byte();
+            return sized(MSGPACK_T_EXT, data);
           case 0xc9:
+            data.ext.len = buffer->read4();
+            data.ext.type = (int8_t)buffer->read_byte();
+            return sized(MSGPACK_T_EXT, data);
           case 0xd4:
           case 0xd5:
           case 0xd6:
           case 0xd7:
           case 0xd8:
-          case 0xd9:
-            return MSGPACK_T_RESERVED;
+            // fixext 1, 2, 4, 8, 16
+            data.ext.len = 1 << (c - 0xd4);
+            data.ext.type = (int8_t)buffer->read_byte();
+            return sized(MSGPACK_T_EXT, data);
           case 0xc2: 
             data.b = false;
             return MSGPACK_T_BOOL;
@@ -118,40 +283,92 @@ namespace MessagePack
             return MSGPACK_T_INT;
           case 0xda:
             data.len = buffer->read2();
-            return MSGPACK_T_RAW;
+            return sized(MSGPACK_T_RAW, data);
           case 0xdb:
             data.len = buffer->read4();
-            return MSGPACK_T_RAW;
+            return sized(MSGPACK_T_RAW, data);
           case 0xdc:
             data.len = buffer->read2();
-            return MSGPACK_T_ARRAY;
+            return sized(MSGPACK_T_ARRAY, data);
           case 0xdd:
             data.len = buffer->read4();
-            return MSGPACK_T_ARRAY;
+            return sized(MSGPACK_T_ARRAY, data);
           case 0xde:
             data.len = buffer->read2();
-            return MSGPACK_T_MAP;
+            return sized(MSGPACK_T_MAP, data);
           case 0xdf:
             data.len = buffer->read4();
-            return MSGPACK_T_MAP;
+            return sized(MSGPACK_T_MAP, data);
         };
       }
 
       return MSGPACK_T_INVALID;
     }
 
+    private:
+
+    inline DataType sized(DataType t, DataValue &data)
+    {
+      if (_limited) check_size(t, data);
+      return t;
+    }
+
+    void check_size(DataType t, DataValue &data)
+    {
+      uint64_t need = data.len;
+      if (t == MSGPACK_T_ARRAY || t == MSGPACK_T_MAP)
+      {
+        if (data.len > _limits.max_elements)
+        {
+          data.len = 0;
+          buffer->fail(MSGPACK_E_LIMIT, "decode: max_elements exceeded");
+          return;
+        }
+        if (t == MSGPACK_T_MAP) need *= 2;
+      }
+      if (need > buffer->remaining())
+      {
+        data.len = 0;
+        buffer->fail(MSGPACK_E_EOF, "decode: length exceeds input");
+      }
+    }
+
+    public:
+
     // T should be an unsigned type!
     template <class T>
     T read_unsigned()
     {
       DataValue d;
+      DataType t = read_next(d);
+      return convert_unsigned<T>(t, d);
+    }
+ 
+    // T should be a signed type
+    template <class T>
+    T read_signed()
+    {
+      DataValue d;
+      DataType t = read_next(d);
+      return convert_signed<T>(t, d);
+    }
 
-      switch (read_next(d))
+    /*
+     * Converts an item returned by read_next() into the unsigned type T.
+     */
+    template <class T>
+    T convert_unsigned(DataType t, const DataValue &d)
+    {
+      switch (t)
       {
         case MSGPACK_T_UINT:
           break;
         case MSGPACK_T_INT:
-          if (d.i < 0) throw InvalidDecodeException("unpack_unsigned: negative value");
+          if (d.i < 0)
+          {
+            fail("unpack_unsigned: negative value");
+            return 0;
+          }
           break;
 	case MSGPACK_T_FLOAT:
 	case MSGPACK_T_DOUBLE:
@@ -160,9 +377,14 @@ namespace MessagePack
 	case MSGPACK_T_ARRAY:
 	case MSGPACK_T_MAP:
 	case MSGPACK_T_RAW:
+	case MSGPACK_T_EXT:
+	case MSGPACK_T_ARRAY_BEG:
+	case MSGPACK_T_MAP_BEG:
+	case MSGPACK_T_END:
 	case MSGPACK_T_RESERVED:
 	case MSGPACK_T_INVALID:
-          throw InvalidDecodeException("unpack_unsigned: no integer given");
+          fail("unpack_unsigned: no integer given");
+          return 0;
       }
 
       if (d.u <= std::numeric_limits<T>::max())
@@ -171,23 +393,27 @@ namespace MessagePack
       }
       else
       {
-        throw InvalidDecodeException("unpack_unsigned: out of range");
+        fail("unpack_unsigned: out of range");
+        return 0;
       }
     }
- 
-    // T should be a signed type
+
+    /*
+     * Converts an item returned by read_next() into the signed type T.
+     */
     template <class T>
-    T read_signed()
+    T convert_signed(DataType t, const DataValue &d)
     {
-      DataValue d;
-
-      switch (read_next(d))
+      switch (t)
       {
         case MSGPACK_T_INT:
           break;
         case MSGPACK_T_UINT:
           if (d.u > (uint64_t)std::numeric_limits<int64_t>::max())
-            throw InvalidDecodeException("unpack_signed: unsigned value too large");
+          {
+            fail("unpack_signed: unsigned value too large");
+            return 0;
+          }
           break;
 	case MSGPACK_T_FLOAT:
 	case MSGPACK_T_DOUBLE:
@@ -196,9 +422,14 @@ namespace MessagePack
 	case MSGPACK_T_ARRAY:
 	case MSGPACK_T_MAP:
 	case MSGPACK_T_RAW:
+	case MSGPACK_T_EXT:
+	case MSGPACK_T_ARRAY_BEG:
+	case MSGPACK_T_MAP_BEG:
+	case MSGPACK_T_END:
 	case MSGPACK_T_RESERVED:
 	case MSGPACK_T_INVALID:
-          throw InvalidDecodeException("unpack_signed: no integer given");
+          fail("unpack_signed: no integer given");
+          return 0;
       }
 
       if (d.i >= std::numeric_limits<T>::min() && d.i <= std::numeric_limits<T>::max())
@@ -207,7 +438,8 @@ namespace MessagePack
       }
       else
       {
-        throw InvalidDecodeException("unpack_signed: out of range");
+        fail("unpack_signed: out of range");
+        return 0;
       }
     }
 
@@ -215,7 +447,8 @@ namespace MessagePack
       rettype read_ ## fnname() { \
       DataValue d; \
       if (read_next(d) == MSGPACK_T_ ## msgpacktype) return d.field; \
-      throw InvalidDecodeException("read_" # fnname); \
+      fail("read_" # fnname); \
+      return rettype(); \
     }
 
     DEF_READ(uint64_t, uint, UINT, u)
@@ -235,20 +468,326 @@ namespace MessagePack
       buffer->read(buf, sz);
     }
 
+    /*
+     * Zero-copy alternative to read_raw_body(): if the sz bytes of the
+     * body are held contiguously by the reader (see Reader::peek), returns
+     * a pointer to them, valid as long as the reader's input, and consumes
+     * them. Otherwise returns nullptr and consumes nothing; then the body
+     * must be read with read_raw_body().
+     */
+    const char *read_raw_body_view(size_t sz)
+    {
+      size_t avail;
+      const char *p = buffer->peek(avail);
+      if (!p || avail < sz) return nullptr;
+      buffer->skip(sz);
+      return p;
+    }
+
+    /*
+     * Reads an ext header. Returns the length of the body (to be read
+     * with read_raw_body) and stores the type in type.
+     */
+    uint32_t read_ext(int8_t &type)
+    {
+      DataValue d;
+      if (read_next(d) != MSGPACK_T_EXT)
+      {
+        fail("read_ext");
+        return 0;
+      }
+      type = d.ext.type;
+      return d.ext.len;
+    }
+
     void read_nil()
     {
       DataValue d;
       if (read_next(d) != MSGPACK_T_NIL)
-        throw InvalidDecodeException("read_nil");
+        fail("read_nil");
     }
 
     void read_array(uint32_t size)
     {
       if (read_array() != size) {
-        throw InvalidDecodeException("read_array gave invalid size");
+        fail("read_array gave invalid size");
       }
     }
 
+    /*
+     * Like read_array() and read_map(), but also accept a size-less array
+     * or map (see BasicEncoder::begin_array). For one of those, open is
+     * set and 0 returned; its elements follow until read_end() returns
+     * true:
+     *
+     *   uint32_t n = dec.read_array_header(open);
+     *   for (; open ? !dec.read_end() : n > 0; --n) ...
+     */
+    uint32_t read_array_header(bool &open)
+    {
+      return read_header(MSGPACK_T_ARRAY, MSGPACK_T_ARRAY_BEG, open);
+    }
+
+    uint32_t read_map_header(bool &open)
+    {
+      return read_header(MSGPACK_T_MAP, MSGPACK_T_MAP_BEG, open);
+    }
+
+    /*
+     * Within a size-less array or map, consumes the end marker if it comes
+     * next and returns true; otherwise returns false and the next element
+     * is read as usual. Also true once decoding failed, to end loops.
+     */
+    bool read_end()
+    {
+      if (_lookahead >= 0) return false;
+      size_t avail;
+      const char *p = buffer->peek(avail);
+      if (p && avail > 0)
+      {
+        if ((uint8_t)*p != 0xc5) return false;
+        buffer->skip(1);
+        return true;
+      }
+      uint8_t c = buffer->read_byte();
+      if (c == 0xc5 || failed()) return true;
+      _lookahead = c;
+      return false;
+    }
+
+    /*
+     * Skips the next data item including everything nested in it, without
+     * materializing any of it.
+     */
+    void skip_value()
+    {
+      DataValue d;
+      DataType t = read_next(d);
+      skip_body(t, d);
+    }
+
+    /*
+     * Skips what follows the item (t, d) just returned by read_next(): the
+     * body of a raw or the elements of an array or map.
+     */
+    void skip_body(DataType t, const DataValue &d)
+    {
+      walk_body(t, d, nullptr);
+    }
+
+    /*
+     * Like skip_value(), but adds up what it skips in stats, e.g. to size
+     * all buffers for a message before decoding it (see measure_message()
+     * in Serialize.h).
+     */
+    void scan_value(DecodeStats &stats)
+    {
+      DataValue d;
+      DataType t = read_next(d);
+      walk_body(t, d, &stats);
+    }
+
+    private:
+
+    uint32_t read_header(DataType sized, DataType open_type, bool &open)
+    {
+      DataValue d;
+      DataType t = read_next(d);
+      open = (t == open_type);
+      if (t == sized) return d.len;
+      if (!open) fail("read_header");
+      return 0;
+    }
+
+    /*
+     * A size-less array or map being walked: the items pending outside of
+     * it and the elements seen so far.
+     */
+    struct OpenLevel
+    {
+      uint64_t pending;
+      uint64_t elements;
+      bool map;
+    };
+
+    /*
+     * Walks iteratively: the nesting of size-less containers is kept on a
+     * heap stack, so deep input cannot overflow the C++ stack.
+     */
+    inline void walk_body(DataType t, const DataValue &d, DecodeStats *stats)
+    {
+      DataValue v = d;
+      uint64_t pending = 0;
+      ResizableBuffer open;     // OpenLevel stack
+      size_t levels = 0;
+
+      bool more = true;
+      while (more)
+      {
+        if (stats) ++stats->items;
+        switch (t)
+        {
+          case MSGPACK_T_ARRAY:
+            pending += v.len;
+            if (stats)
+            {
+              ++stats->arrays;
+              stats->elements += v.len;
+            }
+            break;
+          case MSGPACK_T_MAP:
+            pending += 2*(uint64_t)v.len;
+            if (stats)
+            {
+              ++stats->maps;
+              stats->elements += v.len;
+            }
+            break;
+          case MSGPACK_T_RAW:
+            if (stats)
+            {
+              ++stats->raws;
+              stats->raw_bytes += v.len;
+            }
+            buffer->skip(v.len);
+            break;
+          case MSGPACK_T_EXT:
+            if (stats) stats->ext_bytes += v.len;
+            buffer->skip(v.len);
+            break;
+          case MSGPACK_T_ARRAY_BEG:
+          case MSGPACK_T_MAP_BEG:
+            if (stats)
+            {
+              if (t == MSGPACK_T_MAP_BEG) ++stats->maps;
+              else ++stats->arrays;
+            }
+            if (_limited && _depth + levels >= _limits.max_depth)
+            {
+              buffer->fail(MSGPACK_E_LIMIT, "decode: max_depth exceeded");
+            }
+            else
+            {
+              OpenLevel *l = (OpenLevel*)open.try_ptr_at(levels * sizeof(OpenLevel), sizeof(OpenLevel));
+              if (!l)
+              {
+                buffer->fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+                break;
+              }
+              l->pending = pending;
+              l->elements = 0;
+              l->map = (t == MSGPACK_T_MAP_BEG);
+              ++levels;
+              pending = 0;
+            }
+            break;
+          case MSGPACK_T_END:
+          case MSGPACK_T_RESERVED:
+          case MSGPACK_T_INVALID:
+            fail("skip_value");
+            return;
+          default:
+            break;
+        }
+
+        // the next item: one still pending, or an element (or the end) of
+        // the innermost size-less container
+        more = false;
+        while (!failed())
+        {
+          if (pending > 0)
+          {
+            --pending;
+            t = read_next(v);
+            more = true;
+            break;
+          }
+          if (levels == 0) break;
+          OpenLevel *l = (OpenLevel*)open.ptr_at((levels - 1) * sizeof(OpenLevel), sizeof(OpenLevel));
+          t = read_next(v);
+          if (t != MSGPACK_T_END)
+          {
+            ++l->elements;
+            more = true;
+            break;
+          }
+          if (stats) stats->elements += l->map ? l->elements / 2 : l->elements;
+          pending = l->pending;
+          --levels;
+        }
+      }
+    }
+
+    public:
+
+    //
+    // Exception-free API. These never throw (whatever Reader::throws()
+    // says) and return MSGPACK_OK or the first error recorded on the
+    // Reader, which sticks until Reader::clear_error().
+    //
+
+    Error try_read_next(DataType &t, DataValue &data) MSGPACK_NOEXCEPT
+    {
+      NoThrowScope s(*buffer);
+      t = read_next(data);
+      return buffer->error();
+    }
+
+    template <class T>
+    Error try_read_unsigned(T &v) MSGPACK_NOEXCEPT
+    {
+      NoThrowScope s(*buffer);
+      v = read_unsigned<T>();
+      return buffer->error();
+    }
+
+    template <class T>
+    Error try_read_signed(T &v) MSGPACK_NOEXCEPT
+    {
+      NoThrowScope s(*buffer);
+      v = read_signed<T>();
+      return buffer->error();
+    }
+
+    #define DEF_TRY_READ(rettype, fnname) \
+      Error try_read_ ## fnname(rettype &v) MSGPACK_NOEXCEPT { \
+      NoThrowScope s(*buffer); \
+      v = read_ ## fnname(); \
+      return buffer->error(); \
+    }
+
+    DEF_TRY_READ(uint64_t, uint)
+    DEF_TRY_READ(int64_t, int)
+    DEF_TRY_READ(float, float)
+    DEF_TRY_READ(double, double)
+    DEF_TRY_READ(uint32_t, raw)
+    DEF_TRY_READ(uint32_t, array)
+    DEF_TRY_READ(uint32_t, map)
+    DEF_TRY_READ(bool, bool)
+
+    #undef DEF_TRY_READ
+
+    Error try_read_raw_body(void *buf, size_t sz) MSGPACK_NOEXCEPT
+    {
+      NoThrowScope s(*buffer);
+      read_raw_body(buf, sz);
+      return buffer->error();
+    }
+
+    Error try_read_nil() MSGPACK_NOEXCEPT
+    {
+      NoThrowScope s(*buffer);
+      read_nil();
+      return buffer->error();
+    }
+
+    Error try_skip_value() MSGPACK_NOEXCEPT
+    {
+      NoThrowScope s(*buffer);
+      skip_value();
+      return buffer->error();
+    }
+
   };
 
 } /* namespace MessagePack */
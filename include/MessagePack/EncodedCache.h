@@ -0,0 +1,175 @@
+#ifndef __MESSAGEPACK_ENCODED_CACHE__HEADER__
+#define __MESSAGEPACK_ENCODED_CACHE__HEADER__
+
+#include <mutex>
+#include <unordered_map>
+
+#include "Serialize.h"
+
+/*
+ * Memoized encodings of immutable objects (C++11), for sub-documents that
+ * are embedded in many messages (configuration, static profiles, ...):
+ *
+ *   EncodedCache cache(64 << 20);
+ *
+ *   // per response
+ *   enc.emit_map(2);
+ *   enc << "user" << cache.get(profile, profile.version);
+ *   enc << "items" << items;
+ *
+ * get() returns the EncodedValue stored for the key if it was encoded at
+ * the same version; otherwise it encodes the object and stores the
+ * result. A cache hit is a hash lookup under a mutex plus a reference
+ * count increment, and emitting the value is a single write().
+ *
+ * EncodedCache is keyed by the address of the object, so an object must
+ * either stay alive as long as the cache or be removed with erase(&object)
+ * before it is destroyed; a version that changes with every modification
+ * (a counter, a timestamp) keeps the cache from returning stale bytes.
+ * Other keys (an id, a name) work with BasicEncodedCache<Key> and
+ * get(key, version, v).
+ *
+ * At most max_bytes of encodings are kept; beyond that, arbitrary entries
+ * are dropped. Values returned by get() stay valid after their entry is
+ * gone. The encoding itself runs outside the lock, so a slow miss does
+ * not hold up the hits of other threads.
+ */
+
+namespace MessagePack
+{
+
+  template <class Key, class Profile = CompactProfile>
+  class BasicEncodedCache
+  {
+    private:
+
+    struct Entry
+    {
+      uint64_t version;
+      EncodedValue value;
+    };
+
+    std::unordered_map<Key, Entry> _entries;
+    std::mutex _mutex;
+    size_t _bytes;
+    size_t _max_bytes;
+    size_t _hits;
+    size_t _misses;
+
+    BasicEncodedCache(const BasicEncodedCache&);
+    BasicEncodedCache& operator=(const BasicEncodedCache&);
+
+    public:
+
+    BasicEncodedCache(size_t max_bytes = SIZE_MAX) :
+      _bytes(0), _max_bytes(max_bytes), _hits(0), _misses(0) {}
+
+    /*
+     * The encoding of v, which is stored under key at the given version.
+     */
+    template <class T>
+    EncodedValue get(const Key &key, uint64_t version, const T &v)
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        typename std::unordered_map<Key, Entry>::iterator it = _entries.find(key);
+        if (it != _entries.end() && it->second.version == version)
+        {
+          ++_hits;
+          return it->second.value;
+        }
+        ++_misses;
+      }
+
+      EncodedValue value = encode_value<Profile>(v);
+      if (value.empty()) return value;
+      put(key, version, value);
+      return value;
+    }
+
+    /*
+     * Keyed by the address of v (EncodedCache).
+     */
+    template <class T>
+    EncodedValue get(const T &v, uint64_t version = 0)
+    {
+      return get(Key(&v), version, v);
+    }
+
+    /*
+     * Stores value under key, e.g. bytes received from elsewhere.
+     */
+    void put(const Key &key, uint64_t version, const EncodedValue &value)
+    {
+      if (value.size() > _max_bytes) return;
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      Entry &e = _entries[key];
+      // another thread may have stored a newer version meanwhile
+      if (!e.value.empty())
+      {
+        if (e.version > version) return;
+        _bytes -= e.value.size();
+      }
+      e.version = version;
+      e.value = value;
+      _bytes += value.size();
+
+      typename std::unordered_map<Key, Entry>::iterator it = _entries.begin();
+      while (_bytes > _max_bytes)
+      {
+        if (it->first == key) { ++it; continue; }
+        _bytes -= it->second.value.size();
+        it = _entries.erase(it);
+      }
+    }
+
+    void erase(const Key &key)
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      typename std::unordered_map<Key, Entry>::iterator it = _entries.find(key);
+      if (it == _entries.end()) return;
+      _bytes -= it->second.value.size();
+      _entries.erase(it);
+    }
+
+    void clear()
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _entries.clear();
+      _bytes = 0;
+    }
+
+    size_t size()
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _entries.size();
+    }
+
+    /*
+     * Bytes of all stored encodings.
+     */
+    size_t bytes()
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _bytes;
+    }
+
+    size_t hits()
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _hits;
+    }
+
+    size_t misses()
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _misses;
+    }
+  };
+
+  typedef BasicEncodedCache<const void*> EncodedCache;
+
+} /* namespace MessagePack */
+
+#endif
@@ -6,26 +6,60 @@
 namespace MessagePack
 {
 
-  class Encoder
+  /*
+   * Encoding profiles select how the typed emit_integer() entry points
+   * (used by Serialize.h) represent integers.
+   *
+   * CompactProfile picks the smallest representation for every value.
+   *
+   * FixedWidthProfile always emits the fixed-width form matching the C++
+   * type, e.g. int32_t -> 0xd2 + 4 bytes. No branch depends on the value,
+   * which pays off on random data at the cost of a few extra bytes.
+   */
+  struct CompactProfile
+  {
+    static const bool fixed_width = false;
+  };
+
+  struct FixedWidthProfile
+  {
+    static const bool fixed_width = true;
+  };
+
+  /*
+   * W is the type of Writer written to. With a final Writer class (like
+   * FixedBufferWriter) all writes are bound statically and can be
+   * inlined; the default goes through the virtual Writer interface.
+   */
+  template <class Profile, class W = Writer>
+  class BasicEncoder
   {
     private:
     
-    Writer *buffer;
+    W *buffer;
 
     public:
 
-    Encoder(Writer *buf) : buffer(buf) {}
+    BasicEncoder(W *buf) : buffer(buf) {}
 
-    void set_writer(Writer *buf)
+    void set_writer(W *buf)
     {
       buffer = buf;
     }
 
-    Writer *get_writer()
+    W *get_writer()
     {
       return buffer;
     }
 
+    /*
+     * Errors are reported through the Writer (see ErrorState).
+     */
+    bool failed() const
+    {
+      return buffer->failed();
+    }
+
     /*
      * handles positive fixnum (1 byte) and uint8 (2 bytes)
      */
@@ -40,20 +74,29 @@ namespace MessagePack
 
     void emit_uint16(uint16_t v)
     {
-      buffer->write_byte(0xcd);
-      buffer->write2(v);
+      uint8_t b[3];
+      b[0] = 0xcd;
+      v = htobe16(v);
+      memcpy(b+1, &v, 2);
+      buffer->write(b, 3);
     }
 
     void emit_uint32(uint32_t v)
     {
-      buffer->write_byte(0xce);
-      buffer->write4(v);
+      uint8_t b[5];
+      b[0] = 0xce;
+      v = htobe32(v);
+      memcpy(b+1, &v, 4);
+      buffer->write(b, 5);
     }
 
     void emit_uint64(uint64_t v)
     {
-      buffer->write_byte(0xcf);
-      buffer->write8(v);
+      uint8_t b[9];
+      b[0] = 0xcf;
+      v = htobe64(v);
+      memcpy(b+1, &v, 8);
+      buffer->write(b, 9);
     }
 
     void emit_uint(uint64_t v)
@@ -77,33 +120,77 @@ namespace MessagePack
       buffer->write_byte((uint8_t)v);
     }
 
+    // The casts to unsigned below only reinterpret the two's complement
+    // bits; a numeric_cast would reject every negative value.
+
     void emit_int16(int16_t v)
     {
-      buffer->write_byte(0xd1);
-      buffer->write2(boost::numeric_cast<unsigned short>(v));
+      uint8_t b[3];
+      b[0] = 0xd1;
+      uint16_t u = htobe16((uint16_t)v);
+      memcpy(b+1, &u, 2);
+      buffer->write(b, 3);
     }
 
     void emit_int32(int32_t v)
     {
-      buffer->write_byte(0xd2);
-      buffer->write4(boost::numeric_cast<unsigned int>(v));
+      uint8_t b[5];
+      b[0] = 0xd2;
+      uint32_t u = htobe32((uint32_t)v);
+      memcpy(b+1, &u, 4);
+      buffer->write(b, 5);
     }
 
     void emit_int64(int64_t v)
     {
-      buffer->write_byte(0xd3);
-      buffer->write8(boost::numeric_cast<unsigned long>(v));
+      uint8_t b[9];
+      b[0] = 0xd3;
+      uint64_t u = htobe64((uint64_t)v);
+      memcpy(b+1, &u, 8);
+      buffer->write(b, 9);
     }
 
     void emit_int(int64_t v)
     {
-      using boost::numeric_cast;
-      if      (v >= -(1L<<7)  && v <= (1L<<7)-1)  emit_int8(numeric_cast<char>(v));
-      else if (v >= -(1L<<15) && v <= (1L<<15)-1) emit_int16(numeric_cast<short>(v));
-      else if (v >= -(1L<<31) && v <= (1L<<31)-1) emit_int32(numeric_cast<int>(v));
+      if      (v >= -(1L<<7)  && v <= (1L<<7)-1)  emit_int8((int8_t)v);
+      else if (v >= -(1L<<15) && v <= (1L<<15)-1) emit_int16((int16_t)v);
+      else if (v >= -(1L<<31) && v <= (1L<<31)-1) emit_int32((int32_t)v);
       else /*if (v >= -(1L<<63) && v <= (1L<<63)-1)*/ emit_int64(v);
     }
 
+    /*
+     * Typed entry points. The Profile decides between the compact and the
+     * fixed-width representation at compile time.
+     */
+
+    void emit_integer(uint8_t v)
+    {
+      if (Profile::fixed_width)
+      {
+        uint8_t b[2] = {0xcc, v};
+        buffer->write(b, 2);
+      }
+      else emit_uint(v);
+    }
+
+    void emit_integer(uint16_t v) { if (Profile::fixed_width) emit_uint16(v); else emit_uint(v); }
+    void emit_integer(uint32_t v) { if (Profile::fixed_width) emit_uint32(v); else emit_uint(v); }
+    void emit_integer(uint64_t v) { if (Profile::fixed_width) emit_uint64(v); else emit_uint(v); }
+
+    void emit_integer(int8_t v)
+    {
+      if (Profile::fixed_width)
+      {
+        uint8_t b[2] = {0xd0, (uint8_t)v};
+        buffer->write(b, 2);
+      }
+      else emit_int(v);
+    }
+
+    void emit_integer(int16_t v) { if (Profile::fixed_width) emit_int16(v); else emit_int(v); }
+    void emit_integer(int32_t v) { if (Profile::fixed_width) emit_int32(v); else emit_int(v); }
+    void emit_integer(int64_t v) { if (Profile::fixed_width) emit_int64(v); else emit_int(v); }
+
     void emit_nil()
     {
       buffer->write_byte(0xc0);
@@ -138,6 +225,19 @@ namespace MessagePack
     }
 
     void emit_raw(const char *raw, uint32_t len)
+    {
+      emit_raw_header(len);
+      if (len > 0)
+      {
+        buffer->write(raw, len);
+      }
+    }
+
+    /*
+     * Emits the header of a raw, to be followed by len bytes of body
+     * (written directly to the Writer).
+     */
+    void emit_raw_header(uint32_t len)
     {
       using boost::numeric_cast;
       if (len <= 31)
@@ -156,11 +256,6 @@ namespace MessagePack
         buffer->write_byte(0xdb);
         buffer->write4(len);
       }
-
-      if (len > 0)
-      {
-        buffer->write(raw, len);
-      }
     }
 
     void emit_array(uint32_t len)
@@ -203,8 +298,114 @@ namespace MessagePack
       }
     }
 
+    /*
+     * Arrays and maps whose length is not known up front:
+     *
+     *   size_t mark = enc.begin_array();
+     *   for (n = 0; cursor.next(); ++n) enc << cursor.row();
+     *   enc.end_array(mark, n);
+     *
+     * If the Writer can backpatch (see Writer::tell), begin_array()
+     * reserves a 32-bit header that end_array() fills in, and the output
+     * is plain msgpack. Otherwise the size-less extension is written:
+     * 0xc4 (0xc6 for a map), the elements, 0xc5 (see Decoder::read_end).
+     */
+    size_t begin_array()
+    {
+      return begin_open(0xdd, 0xc4);
+    }
+
+    void end_array(size_t mark, uint32_t len)
+    {
+      end_open(mark, len);
+    }
+
+    size_t begin_map()
+    {
+      return begin_open(0xdf, 0xc6);
+    }
+
+    void end_map(size_t mark, uint32_t len)
+    {
+      end_open(mark, len);
+    }
+
+    /*
+     * Emits the header of an ext item, to be followed by len bytes of
+     * body (written directly to the Writer).
+     */
+    void emit_ext(int8_t type, uint32_t len)
+    {
+      uint8_t b[6];
+      size_t n;
+
+      switch (len)
+      {
+        case 1:  b[0] = 0xd4; n = 1; break;
+        case 2:  b[0] = 0xd5; n = 1; break;
+        case 4:  b[0] = 0xd6; n = 1; break;
+        case 8:  b[0] = 0xd7; n = 1; break;
+        case 16: b[0] = 0xd8; n = 1; break;
+        default:
+          if (len <= 0xFF)
+          {
+            b[0] = 0xc7;
+            b[1] = (uint8_t)len;
+            n = 2;
+          }
+          else if (len <= 0xFFFF)
+          {
+            uint16_t v = htobe16((uint16_t)len);
+            b[0] = 0xc8;
+            memcpy(b+1, &v, 2);
+            n = 3;
+          }
+          else
+          {
+            uint32_t v = htobe32(len);
+            b[0] = 0xc9;
+            memcpy(b+1, &v, 4);
+            n = 5;
+          }
+      }
+
+      b[n++] = (uint8_t)type;
+      buffer->write(b, n);
+    }
+
+    private:
+
+    size_t begin_open(uint8_t header, uint8_t marker)
+    {
+      const size_t mark = buffer->tell();
+      if (mark == SIZE_MAX)
+      {
+        buffer->write_byte(marker);
+        return SIZE_MAX;
+      }
+      uint8_t b[5] = {header, 0, 0, 0, 0};
+      buffer->write(b, 5);
+      return mark;
+    }
+
+    void end_open(size_t mark, uint32_t len)
+    {
+      if (mark == SIZE_MAX)
+      {
+        buffer->write_byte(0xc5);
+        return;
+      }
+      if (buffer->tell() < mark + 5) return;   // the header was dropped
+      len = htobe32(len);
+      buffer->patch(mark + 1, &len, 4);
+    }
+
   };
 
+  typedef BasicEncoder<CompactProfile> Encoder;
+  typedef BasicEncoder<FixedWidthProfile> FixedWidthEncoder;
+  typedef BasicEncoder<CompactProfile, FixedBufferWriter> FixedBufferEncoder;
+
 } /* namespace MessagePack */
 
 #endif
@@ -1,38 +1,191 @@
 #ifndef __MESSAGEPACK_EXCEPTION__HEADER__
 #define __MESSAGEPACK_EXCEPTION__HEADER__
 
+#include <exception>
+
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+  #define MSGPACK_USE_EXCEPTIONS 1
+#endif
+
+#if (defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L)
+  #define MSGPACK_NOEXCEPT noexcept
+  #define MSGPACK_FINAL final
+#else
+  #define MSGPACK_NOEXCEPT throw()
+  #define MSGPACK_FINAL
+#endif
+
 namespace MessagePack
 {
 
-  struct Exception
+  enum Error
+  {
+    MSGPACK_OK = 0,
+    MSGPACK_E_INVALID_DECODE,
+    MSGPACK_E_EOF,
+    MSGPACK_E_OUT_OF_MEMORY,
+    MSGPACK_E_FILE,
+    MSGPACK_E_LIMIT,
+    MSGPACK_E_BUFFER_FULL
+  };
+
+  struct Exception : std::exception
   {
     const char *msg;
     Exception() : msg("") {}
     Exception(const char *_msg) : msg(_msg) {}
+    virtual const char *what() const MSGPACK_NOEXCEPT { return msg; }
+    virtual Error error() const { return MSGPACK_E_INVALID_DECODE; }
    };
 
   struct InvalidDecodeException : Exception
   {
     InvalidDecodeException() {}
     InvalidDecodeException(const char *_msg) : Exception(_msg) {}
+    virtual Error error() const { return MSGPACK_E_INVALID_DECODE; }
   };
 
   struct EofException : Exception
   {
     EofException() {}
     EofException(const char *_msg) : Exception(_msg) {}
+    virtual Error error() const { return MSGPACK_E_EOF; }
   };
 
   struct OutOfMemoryException : Exception
   {
     OutOfMemoryException() {}
     OutOfMemoryException(const char *_msg) : Exception(_msg) {}
+    virtual Error error() const { return MSGPACK_E_OUT_OF_MEMORY; }
   };
 
   struct FileException : Exception
   {
     FileException() {}
     FileException(const char *_msg) : Exception(_msg) {}
+    virtual Error error() const { return MSGPACK_E_FILE; }
+  };
+
+  /*
+   * A DecodeLimits policy was violated.
+   */
+  struct LimitException : Exception
+  {
+    LimitException() {}
+    LimitException(const char *_msg) : Exception(_msg) {}
+    virtual Error error() const { return MSGPACK_E_LIMIT; }
+  };
+
+  /*
+   * A fixed-size buffer (FixedBufferWriter, ShmRingWriter) ran out of space.
+   */
+  struct BufferFullException : Exception
+  {
+    BufferFullException() {}
+    BufferFullException(const char *_msg) : Exception(_msg) {}
+    virtual Error error() const { return MSGPACK_E_BUFFER_FULL; }
+  };
+
+  /*
+   * Throws the exception matching e. Without exception support, aborts.
+   */
+  inline void raise_error(Error e, const char *msg)
+  {
+#ifdef MSGPACK_USE_EXCEPTIONS
+    switch (e)
+    {
+      case MSGPACK_E_EOF:           throw EofException(msg);
+      case MSGPACK_E_OUT_OF_MEMORY: throw OutOfMemoryException(msg);
+      case MSGPACK_E_FILE:          throw FileException(msg);
+      case MSGPACK_E_LIMIT:         throw LimitException(msg);
+      case MSGPACK_E_BUFFER_FULL:   throw BufferFullException(msg);
+      case MSGPACK_E_INVALID_DECODE:
+      case MSGPACK_OK:
+      default:                      throw InvalidDecodeException(msg);
+    }
+#else
+    (void)e; (void)msg;
+    abort();
+#endif
+  }
+
+  /*
+   * Error handling of Readers and Writers (a Decoder or Encoder reports
+   * through the Reader or Writer it works on).
+   *
+   * By default a failure throws the matching exception. With
+   * set_throws(false), and always when compiled without exceptions, the
+   * first failure is recorded instead (see error()) and processing goes
+   * on harmlessly: failed reads return zeros, failed writes are dropped
+   * and decoding loops stop early. It is enough to check error() once at
+   * the end; clear_error() resets it.
+   *
+   * Builds with -fno-exceptions have to define boost::throw_exception
+   * (used by boost::numeric_cast), as usual with BOOST_NO_EXCEPTIONS.
+   */
+  class ErrorState
+  {
+    private:
+
+    Error _error;
+    const char *_error_msg;
+    bool _throws;
+
+    public:
+
+    ErrorState() : _error(MSGPACK_OK), _error_msg(""), _throws(true) {}
+
+    Error error() const { return _error; }
+    const char *error_message() const { return _error_msg; }
+    bool failed() const { return _error != MSGPACK_OK; }
+
+    void clear_error()
+    {
+      _error = MSGPACK_OK;
+      _error_msg = "";
+    }
+
+    bool throws() const { return _throws; }
+    void set_throws(bool throws) { _throws = throws; }
+
+    void fail(Error e, const char *msg)
+    {
+#ifdef MSGPACK_USE_EXCEPTIONS
+      if (_throws) raise_error(e, msg);
+#endif
+      if (_error == MSGPACK_OK)
+      {
+        _error = e;
+        _error_msg = msg;
+      }
+    }
+  };
+
+  /*
+   * Switches an ErrorState to recording mode for the lifetime of the
+   * object.
+   */
+  class NoThrowScope
+  {
+    private:
+
+    ErrorState &_state;
+    bool _throws;
+
+    NoThrowScope(const NoThrowScope&);
+    NoThrowScope& operator=(const NoThrowScope&);
+
+    public:
+
+    NoThrowScope(ErrorState &state) : _state(state), _throws(state.throws())
+    {
+      _state.set_throws(false);
+    }
+
+    ~NoThrowScope()
+    {
+      _state.set_throws(_throws);
+    }
   };
 
 } /* namespace MessagePack */
@@ -0,0 +1,281 @@
+#ifndef __MESSAGEPACK_FIELDS__HEADER__
+#define __MESSAGEPACK_FIELDS__HEADER__
+
+#include "Serialize.h"
+
+/*
+ * Field reflection for user structs.
+ *
+ *   struct Point
+ *   {
+ *     int32_t x, y;
+ *     std::string label;
+ *
+ *     MSGPACK_FIELDS(x, y, label)
+ *   };
+ *
+ *   enc << pt;            // {"x": .., "y": .., "label": ..}
+ *   enc << as_array(pt);  // [x, y, label]
+ *   dec >> pt;
+ *
+ * MSGPACK_FIELDS makes the map layout the default, MSGPACK_FIELDS_ARRAY
+ * the array layout. Both generate the codecs for either layout, and
+ * as_map() / as_array() select one explicitly.
+ *
+ * The map encoder writes each key as a single block whose header byte is
+ * known at compile time. The map decoder hashes the incoming key once and
+ * dispatches through a switch over the compile-time hashes of the field
+ * names (a hash collision between two fields is a duplicate case label,
+ * i.e. a compile error), followed by a length + memcmp check. Unknown keys
+ * and surplus array elements are skipped; missing fields keep their value.
+ *
+ * At most 32 fields are supported.
+ */
+
+#define MSGPACK_PP_NARGS(...) MSGPACK_PP_NARGS_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define MSGPACK_PP_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+
+#define MSGPACK_PP_CAT(a, b) MSGPACK_PP_CAT_(a, b)
+#define MSGPACK_PP_CAT_(a, b) a ## b
+
+#define MSGPACK_PP_FOR_EACH(M, ...) MSGPACK_PP_CAT(MSGPACK_PP_FOR_EACH_, MSGPACK_PP_NARGS(__VA_ARGS__))(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_1(M, a) M(a)
+#define MSGPACK_PP_FOR_EACH_2(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_1(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_3(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_2(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_4(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_3(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_5(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_4(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_6(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_5(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_7(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_6(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_8(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_7(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_9(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_8(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_10(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_9(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_11(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_10(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_12(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_11(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_13(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_12(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_14(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_13(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_15(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_14(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_16(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_15(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_17(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_16(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_18(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_17(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_19(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_18(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_20(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_19(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_21(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_20(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_22(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_21(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_23(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_22(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_24(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_23(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_25(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_24(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_26(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_25(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_27(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_26(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_28(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_27(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_29(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_28(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_30(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_29(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_31(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_30(M, __VA_ARGS__)
+#define MSGPACK_PP_FOR_EACH_32(M, a, ...) M(a) MSGPACK_PP_FOR_EACH_31(M, __VA_ARGS__)
+
+namespace MessagePack
+{
+
+  /*
+   * FNV-1a. The constexpr version produces the case labels, the loop
+   * hashes keys at runtime.
+   */
+  constexpr uint32_t _field_hash(const char *s, uint32_t len, uint32_t h = 2166136261u)
+  {
+    return len == 0 ? h : _field_hash(s + 1, len - 1, (h ^ (uint8_t)s[0]) * 16777619u);
+  }
+
+  inline uint32_t _field_hash_rt(const char *s, uint32_t len)
+  {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; ++i)
+    {
+      h = (h ^ (uint8_t)s[i]) * 16777619u;
+    }
+    return h;
+  }
+
+  /*
+   * Writes header and bytes of a field name in one go. N is the size of
+   * the string literal, so the header is a constant.
+   */
+  template <class P, class W, size_t N>
+  inline void _emit_field_key(BasicEncoder<P, W> &enc, const char (&key)[N])
+  {
+    if (N - 1 <= 31)
+    {
+      uint8_t buf[N];
+      buf[0] = (uint8_t)(0xa0 | (N - 1));
+      memcpy(buf + 1, key, N - 1);
+      enc.get_writer()->write(buf, N);
+    }
+    else
+    {
+      enc.emit_raw(key, N - 1);
+    }
+  }
+
+  /*
+   * Whether element i of an array read with read_array_header() follows
+   * (never after a failure). Once a size-less array ends, open is cleared
+   * and n set to i.
+   */
+  inline bool _next_element(Decoder &dec, bool &open, uint32_t i, uint32_t &n)
+  {
+    if (!open) return i < n && !dec.failed();
+    if (!dec.read_end()) return true;
+    open = false;
+    n = i;
+    return false;
+  }
+
+  /*
+   * Reads a map key into buf. Returns false (with the key skipped) if it
+   * is not a raw or longer than buf, so that it cannot name a field.
+   */
+  template <size_t N>
+  inline bool _read_field_key(Decoder &dec, char (&buf)[N], uint32_t &len)
+  {
+    DataValue d;
+    DataType t = dec.read_next(d);
+    if (t != MSGPACK_T_RAW || d.len > N)
+    {
+      dec.skip_body(t, d);
+      return false;
+    }
+    len = d.len;
+    dec.read_raw_body(buf, len);
+    return true;
+  }
+
+  template <class T>
+  struct ArrayLayout
+  {
+    T &value;
+    ArrayLayout(T &v) : value(v) {}
+  };
+
+  template <class T>
+  struct MapLayout
+  {
+    T &value;
+    MapLayout(T &v) : value(v) {}
+  };
+
+  template <class T>
+  inline ArrayLayout<T> as_array(T &v) { return ArrayLayout<T>(v); }
+
+  template <class T>
+  inline MapLayout<T> as_map(T &v) { return MapLayout<T>(v); }
+
+  template <class P, class W, class T>
+  inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& enc, const ArrayLayout<T> &v)
+  {
+    v.value.msgpack_encode_array(enc);
+    return enc;
+  }
+
+  template <class P, class W, class T>
+  inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& enc, const MapLayout<T> &v)
+  {
+    v.value.msgpack_encode_map(enc);
+    return enc;
+  }
+
+  template <class T>
+  inline Decoder& operator>>(Decoder &dec, const ArrayLayout<T> &v)
+  {
+    v.value.msgpack_decode_array(dec);
+    return dec;
+  }
+
+  template <class T>
+  inline Decoder& operator>>(Decoder &dec, const MapLayout<T> &v)
+  {
+    v.value.msgpack_decode_map(dec);
+    return dec;
+  }
+
+  template <class P, class W, class T>
+  inline auto operator<<(BasicEncoder<P, W>& enc, const T &v) -> decltype(v.msgpack_encode_map(enc), enc)
+  {
+    if (T::msgpack_as_map) v.msgpack_encode_map(enc);
+    else v.msgpack_encode_array(enc);
+    return enc;
+  }
+
+  template <class T>
+  inline auto operator>>(Decoder &dec, T &v) -> decltype(v.msgpack_decode_map(dec), dec)
+  {
+    if (T::msgpack_as_map) v.msgpack_decode_map(dec);
+    else v.msgpack_decode_array(dec);
+    return dec;
+  }
+
+} /* namespace MessagePack */
+
+#define _MSGPACK_ENCODE_ARRAY_FIELD(f) _mp_enc << this->f;
+
+#define _MSGPACK_ENCODE_MAP_FIELD(f) \
+  ::MessagePack::_emit_field_key(_mp_enc, #f); \
+  _mp_enc << this->f;
+
+#define _MSGPACK_DECODE_ARRAY_FIELD(f) \
+  if (::MessagePack::_next_element(_mp_dec, _mp_open, _mp_i, _mp_n)) { _mp_dec >> this->f; ++_mp_i; }
+
+#define _MSGPACK_DECODE_MAP_CASE(f) \
+  case ::MessagePack::_field_hash(#f, sizeof(#f) - 1): \
+    if (_mp_len != sizeof(#f) - 1 || memcmp(_mp_key, #f, sizeof(#f) - 1) != 0) return false; \
+    _mp_dec >> this->f; \
+    return true;
+
+#define _MSGPACK_FIELDS(as_map, ...) \
+  static const bool msgpack_as_map = as_map; \
+  template <class MsgpackProfile_, class MsgpackWriter_> \
+  void msgpack_encode_array(::MessagePack::BasicEncoder<MsgpackProfile_, MsgpackWriter_> &_mp_enc) const \
+  { \
+    _mp_enc.emit_array(MSGPACK_PP_NARGS(__VA_ARGS__)); \
+    MSGPACK_PP_FOR_EACH(_MSGPACK_ENCODE_ARRAY_FIELD, __VA_ARGS__) \
+  } \
+  template <class MsgpackProfile_, class MsgpackWriter_> \
+  void msgpack_encode_map(::MessagePack::BasicEncoder<MsgpackProfile_, MsgpackWriter_> &_mp_enc) const \
+  { \
+    _mp_enc.emit_map(MSGPACK_PP_NARGS(__VA_ARGS__)); \
+    MSGPACK_PP_FOR_EACH(_MSGPACK_ENCODE_MAP_FIELD, __VA_ARGS__) \
+  } \
+  void msgpack_decode_array(::MessagePack::Decoder &_mp_dec) \
+  { \
+    ::MessagePack::Decoder::Nesting _mp_nest(_mp_dec); \
+    bool _mp_open; \
+    uint32_t _mp_n = _mp_dec.read_array_header(_mp_open), _mp_i = 0; \
+    MSGPACK_PP_FOR_EACH(_MSGPACK_DECODE_ARRAY_FIELD, __VA_ARGS__) \
+    for (; ::MessagePack::_next_element(_mp_dec, _mp_open, _mp_i, _mp_n); ++_mp_i) _mp_dec.skip_value(); \
+  } \
+  bool msgpack_decode_field(::MessagePack::Decoder &_mp_dec, const char *_mp_key, uint32_t _mp_len) \
+  { \
+    switch (::MessagePack::_field_hash_rt(_mp_key, _mp_len)) \
+    { \
+      MSGPACK_PP_FOR_EACH(_MSGPACK_DECODE_MAP_CASE, __VA_ARGS__) \
+      default: return false; \
+    } \
+  } \
+  void msgpack_decode_map(::MessagePack::Decoder &_mp_dec) \
+  { \
+    char _mp_key[256]; \
+    uint32_t _mp_len; \
+    bool _mp_open; \
+    ::MessagePack::Decoder::Nesting _mp_nest(_mp_dec); \
+    uint32_t _mp_n = _mp_dec.read_map_header(_mp_open); \
+    for (; (_mp_open ? !_mp_dec.read_end() : _mp_n > 0) && !_mp_dec.failed(); --_mp_n) \
+    { \
+      if (!::MessagePack::_read_field_key(_mp_dec, _mp_key, _mp_len) || \
+          !msgpack_decode_field(_mp_dec, _mp_key, _mp_len)) \
+      { \
+        _mp_dec.skip_value(); \
+      } \
+    } \
+  }
+
+#define MSGPACK_FIELDS(...) _MSGPACK_FIELDS(true, __VA_ARGS__)
+#define MSGPACK_FIELDS_ARRAY(...) _MSGPACK_FIELDS(false, __VA_ARGS__)
+
+#endif
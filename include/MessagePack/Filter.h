@@ -0,0 +1,514 @@
+#ifndef __MESSAGEPACK_FILTER__HEADER__
+#define __MESSAGEPACK_FILTER__HEADER__
+
+#include <string.h>   /* memchr(), memmem() */
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+/*
+ * Filtering of record streams by predicates on their fields (C++11),
+ * without decoding the records:
+ *
+ *   Filter f;
+ *   f.equals("level", "error");
+ *   f.range("latency_ms", 100, 5000);
+ *   f.prefix("req.path", "/api/");
+ *
+ *   MemoryReader in(data, len);         // e.g. an mmap'ed log
+ *   size_t n = f.filter(in, out, 8);    // matching records -> out
+ *
+ * A record matches if it is a map and every condition holds (missing
+ * fields fail). Paths name map keys separated by '.'. Matching records
+ * are copied to the Writer verbatim.
+ *
+ * Keys and string values are compared in place. Before a record is
+ * looked at, its bytes are searched for the longest string that any
+ * match must contain (a key or a compared string) with memmem(), which
+ * is vectorized by the C library; records without it are only skipped
+ * over, and once it does not occur anymore the rest of the input is
+ * dropped unread (and so not checked for errors).
+ *
+ * With threads > 1 and the whole input in memory (see Reader::peek),
+ * the input is cut into as many chunks, each scanned by its own thread
+ * starting from a guess of where the first record begins. The chunks
+ * are then joined in order: a chunk whose records line up with the end
+ * of the previous one is taken as is (once the scan hits a real record
+ * boundary, it follows the real records), otherwise it is scanned again
+ * from the right place. So the result is always that of a sequential
+ * scan.
+ *
+ * Invalid input is reported through the Reader, write errors through the
+ * Writer (see ErrorState).
+ */
+
+namespace MessagePack
+{
+
+  class Filter
+  {
+    private:
+
+    enum CondKind
+    {
+      COND_STRING,      // equal raw
+      COND_PREFIX,      // raw starting with str
+      COND_INT,         // integer (or float) in [lo, hi]
+      COND_DOUBLE       // number in [dlo, dhi]
+    };
+
+    struct Cond
+    {
+      CondKind kind;
+      std::string str;
+      int64_t lo, hi;
+      double dlo, dhi;
+    };
+
+    struct Node
+    {
+      std::string name;
+      std::vector<size_t> conds;    // on the value of this key
+      std::vector<Node> children;
+
+      const Node *find(const char *key, size_t len) const
+      {
+        for (size_t i = 0; i < children.size(); ++i)
+        {
+          const std::string &n = children[i].name;
+          if (n.size() == len && memcmp(n.data(), key, len) == 0) return &children[i];
+        }
+        return nullptr;
+      }
+    };
+
+    /*
+     * The result of scanning a piece of the input: the records found,
+     * those that match, and where the scan stopped.
+     */
+    struct Run
+    {
+      std::vector<size_t> starts;     // offsets of the records looked at
+      std::vector<size_t> matches;    // offset, length, offset, length, ...
+      size_t end;                     // offset of the first record not looked at
+      bool failed;                    // invalid record at end
+      Error error;
+      const char *error_msg;
+
+      Run() : end(0), failed(false), error(MSGPACK_OK), error_msg("") {}
+    };
+
+    Node _root;
+    std::vector<Cond> _conds;
+    std::string _literal;           // occurs in every matching record
+    DecodeLimits _limits;
+    bool _too_many;                 // add() was called with 64 conditions
+    RecordingReader _rec;           // records not held in memory by the Reader
+
+    public:
+
+    Filter() : _too_many(false), _rec(nullptr)
+    {
+      _rec.set_throws(false);
+    }
+
+    /*
+     * Conditions. All must hold. There can be at most 64; with more,
+     * filter() fails with MSGPACK_E_LIMIT and match() is false.
+     */
+    Filter &equals(const std::string &path, const std::string &value)
+    {
+      Cond c = { COND_STRING, value, 0, 0, 0, 0 };
+      return add(path, c);
+    }
+
+    Filter &equals(const std::string &path, int64_t value)
+    {
+      return range(path, value, value);
+    }
+
+    Filter &prefix(const std::string &path, const std::string &value)
+    {
+      Cond c = { COND_PREFIX, value, 0, 0, 0, 0 };
+      return add(path, c);
+    }
+
+    /*
+     * Numbers between lo and hi (inclusive). Integer bounds compare
+     * integers exactly.
+     */
+    Filter &range(const std::string &path, int64_t lo, int64_t hi)
+    {
+      Cond c = { COND_INT, std::string(), lo, hi, (double)lo, (double)hi };
+      return add(path, c);
+    }
+
+    Filter &range(const std::string &path, int lo, int hi)
+    {
+      return range(path, (int64_t)lo, (int64_t)hi);
+    }
+
+    Filter &range(const std::string &path, double lo, double hi)
+    {
+      Cond c = { COND_DOUBLE, std::string(), 0, 0, lo, hi };
+      return add(path, c);
+    }
+
+    /*
+     * Checks the records against the limits (see Decoder::set_limits).
+     */
+    void set_limits(const DecodeLimits &limits)
+    {
+      _limits = limits;
+    }
+
+    /*
+     * Whether the record at data (len bytes) matches.
+     */
+    bool match(const char *data, size_t len) const
+    {
+      if (_too_many) return false;
+      MemoryReader r(data, len);
+      r.set_throws(false);
+      Decoder dec(&r);
+      dec.set_limits(_limits);
+      return evaluate(dec) && !r.failed();
+    }
+
+    /*
+     * Copies the matching records of in to out and returns their number.
+     */
+    template <class W>
+    size_t filter(Reader &in, W &out, unsigned threads = 1)
+    {
+      size_t n = 0;
+      if (_too_many)
+      {
+        in.fail(MSGPACK_E_LIMIT, "filter: more than 64 conditions");
+        return n;
+      }
+      while (!in.failed() && !in.at_end())
+      {
+        size_t avail;
+        const char *p = in.peek(avail);
+        if (p && avail > 0)
+        {
+          const bool whole = (avail >= in.remaining());
+          Run run;
+          if (whole && threads > 1 && avail >= threads * (size_t)(64 << 10))
+          {
+            if (find(p, avail, 0) < avail)
+              scan_parallel(p, avail, threads, run);
+            else
+              run.end = avail;    // nothing can match
+          }
+          else
+          {
+            scan(p, avail, 0, avail, whole, false, run);
+          }
+
+          n += emit(p, run, out);
+          in.skip(run.end);
+          if (run.failed && whole)
+          {
+            in.fail(run.error, run.error_msg);
+            break;
+          }
+          if (run.end > 0 || whole) continue;
+        }
+
+        // the next record is not (completely) in memory: copy it first
+        _rec.set_reader(&in);
+        _rec.reset();
+        _rec.clear_error();
+        Decoder dec(&_rec);
+        dec.set_limits(_limits);
+        dec.skip_value();
+        if (_rec.failed())
+        {
+          if (!in.failed()) in.fail(_rec.error(), _rec.error_message());
+          break;
+        }
+        if (match(_rec.data(), _rec.size()))
+        {
+          out.write(_rec.data(), _rec.size());
+          ++n;
+        }
+      }
+      return n;
+    }
+
+    private:
+
+    Filter &add(const std::string &path, const Cond &c)
+    {
+      if (_conds.size() == 64)
+      {
+        _too_many = true;
+        return *this;
+      }
+      Node *node = &_root;
+      size_t begin = 0;
+      for (;;)
+      {
+        size_t end = path.find('.', begin);
+        if (end == std::string::npos) end = path.size();
+        const std::string name = path.substr(begin, end - begin);
+        if (name.size() > _literal.size()) _literal = name;
+
+        Node *child = (Node*)node->find(name.data(), name.size());
+        if (!child)
+        {
+          node->children.push_back(Node());
+          child = &node->children.back();
+          child->name = name;
+        }
+        node = child;
+
+        if (end == path.size()) break;
+        begin = end + 1;
+      }
+      node->conds.push_back(_conds.size());
+      _conds.push_back(c);
+      if (c.kind != COND_INT && c.kind != COND_DOUBLE && c.str.size() > _literal.size())
+        _literal = c.str;
+      return *this;
+    }
+
+    /*
+     * Offset of the next occurrence of _literal in data at or after pos,
+     * or len.
+     */
+    size_t find(const char *data, size_t len, size_t pos) const
+    {
+      const size_t m = _literal.size();
+      if (m == 0) return pos;
+      if (len - pos < m) return len;
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+      const char *p = (const char*)memmem(data + pos, len - pos, _literal.data(), m);
+      return p ? (size_t)(p - data) : len;
+#else
+      const char *p = data + pos;
+      const char *last = data + len - m;
+      while (p <= last)
+      {
+        p = (const char*)memchr(p, _literal[0], last - p + 1);
+        if (!p) break;
+        if (memcmp(p, _literal.data(), m) == 0) return (size_t)(p - data);
+        ++p;
+      }
+      return len;
+#endif
+    }
+
+    /*
+     * Scans the records starting at from (up to the first one at or
+     * after to) of data, which holds len bytes. whole: data ends with the
+     * input. speculative: from is a guess; until a record is found, start
+     * over at the next byte on invalid bytes, and look no further than
+     * the next chunk (the join goes on where the scan stopped).
+     */
+    void scan(const char *data, size_t len, size_t from, size_t to,
+              bool whole, bool speculative, Run &run) const
+    {
+      const size_t window = speculative ? std::min(len, to + (to - from)) : len;
+      size_t searched = window;   // _literal was looked for up to here
+      size_t pos = from;
+      size_t hit = find(data, searched, pos);
+      const size_t m = _literal.size();
+      size_t restarts = 0;
+
+      // a guess inside a raw can look like nesting as deep as the raw is
+      // long: keep it from walking far before it fails
+      DecodeLimits limits = _limits;
+      if (speculative && limits.max_depth > 32) limits.max_depth = 32;
+
+      while (pos < to)
+      {
+        if (hit == len && whole && m > 0)
+        {
+          pos = len;    // nothing can match anymore
+          break;
+        }
+
+        MemoryReader r(data + pos, window - pos);
+        r.set_throws(false);
+        Decoder dec(&r);
+        dec.set_limits(limits);
+        dec.skip_value();
+        const size_t n = window - pos - r.remaining();
+
+        if (r.failed())
+        {
+          if (speculative)
+          {
+            if (!run.starts.empty() || ++restarts > 64) break;
+            hit = find(data, searched, ++pos);
+            continue;
+          }
+          if (r.error() != MSGPACK_E_EOF || whole)
+          {
+            run.failed = true;
+            run.error = r.error();
+            run.error_msg = r.error_message();
+          }
+          break;
+        }
+
+        if (pos + n > searched)
+        {
+          searched = len;
+          hit = find(data, searched, pos);
+        }
+        run.starts.push_back(pos);
+        if (hit + m <= pos + n && match(data + pos, n))
+        {
+          run.matches.push_back(pos);
+          run.matches.push_back(n);
+        }
+        pos += n;
+        if (hit < pos) hit = find(data, searched, pos);
+      }
+      run.end = pos;
+    }
+
+    void scan_parallel(const char *data, size_t len, unsigned threads, Run &run) const
+    {
+      std::vector<Run> runs(threads);
+      std::vector<std::thread> workers;
+      for (unsigned t = 1; t < threads; ++t)
+      {
+        workers.push_back(std::thread(&Filter::scan, this, data, len,
+          chunk(len, threads, t), chunk(len, threads, t + 1), true, true, std::ref(runs[t])));
+      }
+      scan(data, len, 0, chunk(len, threads, 1), true, false, runs[0]);
+      for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+
+      // join the chunks, from the end of the (exact) first one
+      run = runs[0];
+      for (unsigned t = 1; t < threads && !run.failed; ++t)
+      {
+        const size_t to = chunk(len, threads, t + 1);
+        if (run.end >= to) continue;
+
+        const Run &r = runs[t];
+        std::vector<size_t>::const_iterator it =
+          std::lower_bound(r.starts.begin(), r.starts.end(), run.end);
+        if (it != r.starts.end() && *it == run.end)
+        {
+          append(run, r);
+          run.end = r.end;
+        }
+        if (run.end < to)
+        {
+          // out of step, or stopped early: go on sequentially
+          Run rest;
+          scan(data, len, run.end, to, true, false, rest);
+          append(run, rest);
+          run.end = rest.end;
+          run.failed = rest.failed;
+          run.error = rest.error;
+          run.error_msg = rest.error_msg;
+        }
+      }
+    }
+
+    /*
+     * Adds the matches of from at or after the end of run.
+     */
+    static void append(Run &run, const Run &from)
+    {
+      for (size_t i = 0; i < from.matches.size(); i += 2)
+      {
+        if (from.matches[i] < run.end) continue;
+        run.matches.push_back(from.matches[i]);
+        run.matches.push_back(from.matches[i + 1]);
+      }
+    }
+
+    static size_t chunk(size_t len, unsigned threads, unsigned t)
+    {
+      return t >= threads ? len : len / threads * t;
+    }
+
+    template <class W>
+    static size_t emit(const char *data, const Run &run, W &out)
+    {
+      for (size_t i = 0; i < run.matches.size(); i += 2)
+      {
+        out.write(data + run.matches[i], run.matches[i + 1]);
+      }
+      return run.matches.size() / 2;
+    }
+
+    bool evaluate(Decoder &dec) const
+    {
+      DataValue d;
+      DataType t = dec.read_next(d);
+      if (t != MSGPACK_T_MAP && t != MSGPACK_T_MAP_BEG) return false;
+      uint64_t met = 0;
+      evaluate_map(dec, _root, t == MSGPACK_T_MAP_BEG, d.len, met);
+      const uint64_t all = (_conds.size() == 64) ? ~(uint64_t)0 : (((uint64_t)1 << _conds.size()) - 1);
+      return met == all;
+    }
+
+    void evaluate_map(Decoder &dec, const Node &node, bool open, uint32_t n, uint64_t &met) const
+    {
+      for (; open ? !dec.read_end() : n > 0; --n)
+      {
+        if (dec.failed()) return;
+        DataValue k;
+        DataType kt = dec.read_next(k);
+        const char *key = (kt == MSGPACK_T_RAW) ? dec.read_raw_body_view(k.len) : nullptr;
+        const Node *child = key ? node.find(key, k.len) : nullptr;
+        if (!key) dec.skip_body(kt, k);
+        if (!child)
+        {
+          dec.skip_value();
+          continue;
+        }
+
+        DataValue v;
+        DataType t = dec.read_next(v);
+        if ((t == MSGPACK_T_MAP || t == MSGPACK_T_MAP_BEG) && !child->children.empty())
+        {
+          evaluate_map(dec, *child, t == MSGPACK_T_MAP_BEG, v.len, met);
+          continue;
+        }
+        const char *str = (t == MSGPACK_T_RAW) ? dec.read_raw_body_view(v.len) : nullptr;
+        if (!str) dec.skip_body(t, v);
+        for (size_t i = 0; i < child->conds.size(); ++i)
+        {
+          if (test(_conds[child->conds[i]], t, v, str)) met |= (uint64_t)1 << child->conds[i];
+        }
+      }
+    }
+
+    static bool test(const Cond &c, DataType t, const DataValue &v, const char *str)
+    {
+      switch (c.kind)
+      {
+        case COND_STRING:
+          return str && v.len == c.str.size() && memcmp(str, c.str.data(), v.len) == 0;
+        case COND_PREFIX:
+          return str && v.len >= c.str.size() && memcmp(str, c.str.data(), c.str.size()) == 0;
+        case COND_INT:
+          if (t == MSGPACK_T_UINT) return v.u <= (uint64_t)INT64_MAX && (int64_t)v.u >= c.lo && (int64_t)v.u <= c.hi;
+          if (t == MSGPACK_T_INT) return v.i >= c.lo && v.i <= c.hi;
+          break;
+        case COND_DOUBLE:
+          if (t == MSGPACK_T_UINT) return (double)v.u >= c.dlo && (double)v.u <= c.dhi;
+          if (t == MSGPACK_T_INT) return (double)v.i >= c.dlo && (double)v.i <= c.dhi;
+          break;
+      }
+      if (t == MSGPACK_T_FLOAT) return (double)v.f >= c.dlo && (double)v.f <= c.dhi;
+      if (t == MSGPACK_T_DOUBLE) return v.d >= c.dlo && v.d <= c.dhi;
+      return false;
+    }
+  };
+
+} /* namespace MessagePack */
+
+#endif
@@ -0,0 +1,436 @@
+#ifndef __MESSAGEPACK_FRAMING__HEADER__
+#define __MESSAGEPACK_FRAMING__HEADER__
+
+#include <poll.h>     /* poll() */
+#include <unistd.h>   /* read() */
+#include <limits.h>   /* IOV_MAX */
+#include <errno.h>
+#include <vector>
+
+/*
+ * Length-prefixed framing over a file descriptor (socket, pipe, file).
+ * Every frame is a 4 byte big-endian length followed by that many bytes,
+ * normally one encoded message.
+ *
+ *   FrameWriter out(fd);
+ *   BasicEncoder<CompactProfile, FrameWriter> enc(&out);
+ *   out.begin_frame();
+ *   enc << request;
+ *   out.end_frame();      // backpatches the length
+ *   ...
+ *   out.flush();
+ *
+ *   FrameReader in(fd);
+ *   const char *data;
+ *   size_t len;
+ *   while (in.next(data, len))
+ *   {
+ *     MemoryReader r(data, len);
+ *     Decoder dec(&r);
+ *     dec >> request;
+ *   }
+ *
+ * FrameWriter encodes into one buffer and hands many frames to the
+ * kernel in a single writev() once flush_size bytes are pending (or on
+ * flush()). Large pre-encoded payloads (write_frame()) are referenced by
+ * the iovec instead of copied. FrameReader reads as much as is available
+ * with one read() and returns the complete frames in the buffer, without
+ * copying them.
+ *
+ * Non-blocking descriptors are waited for with poll().
+ */
+
+namespace MessagePack
+{
+
+  class FrameWriter MSGPACK_FINAL : public Writer
+  {
+    private:
+
+    /*
+     * A payload to be written by reference after the first at buffered
+     * bytes.
+     */
+    struct Ref
+    {
+      size_t at;
+      const char *data;
+      size_t len;
+    };
+
+    int _fd;
+    ResizableBuffer _buf;
+    char *_data;
+    size_t _capacity;
+    size_t _pos;
+    size_t _base;           // bytes flushed from the buffer so far
+    size_t _frame;          // offset of the open frame's header
+    size_t _flush_size;
+    size_t _ref_bytes;
+    std::vector<Ref> _refs;
+
+    FrameWriter(const FrameWriter&);
+    FrameWriter& operator=(const FrameWriter&);
+
+    static const size_t NO_FRAME = SIZE_MAX;
+
+    public:
+
+    /*
+     * Writes to fd, which is not closed.
+     */
+    FrameWriter(int fd, size_t flush_size = 64 << 10) :
+      _fd(fd), _data(nullptr), _capacity(0), _pos(0), _base(0), _frame(NO_FRAME),
+      _flush_size(flush_size), _ref_bytes(0)
+    {
+      room(flush_size > 0 ? flush_size : 4096);
+    }
+
+    virtual ~FrameWriter()
+    {
+      NoThrowScope s(*this);
+      flush();
+    }
+
+    /*
+     * Starts a frame: what is written until end_frame() is its body.
+     */
+    void begin_frame()
+    {
+      if (_frame != NO_FRAME) end_frame();
+      if (4 > _capacity - _pos && !room(4)) return;
+      _frame = _pos;
+      _pos += 4;
+    }
+
+    /*
+     * Ends the frame and fills in its length. Flushes if flush_size
+     * bytes are pending.
+     */
+    void end_frame()
+    {
+      if (_frame == NO_FRAME) return;
+      const size_t len = _pos - _frame - 4;
+      if (len > UINT32_MAX)
+      {
+        _pos = _frame;
+        _frame = NO_FRAME;
+        fail(MSGPACK_E_LIMIT, "frame larger than 4 GB");
+        return;
+      }
+      const uint32_t be = htobe32((uint32_t)len);
+      memcpy(_data + _frame, &be, 4);
+      _frame = NO_FRAME;
+      if (pending() >= _flush_size) flush();
+    }
+
+    /*
+     * Appends a frame with an already encoded body. Bodies of 4 KB and
+     * more are not copied and must stay unchanged until the next flush().
+     */
+    void write_frame(const void *body, size_t len)
+    {
+      if (_frame != NO_FRAME) end_frame();
+      if (len < 4096)
+      {
+        begin_frame();
+        write(body, len);
+        end_frame();
+        return;
+      }
+      if (len > UINT32_MAX)
+      {
+        fail(MSGPACK_E_LIMIT, "frame larger than 4 GB");
+        return;
+      }
+      write4((uint32_t)len);
+      Ref r = { _pos, (const char*)body, len };
+      _refs.push_back(r);
+      _ref_bytes += len;
+      if (pending() >= _flush_size) flush();
+    }
+
+    /*
+     * Bytes of complete frames waiting for flush().
+     */
+    size_t pending() const
+    {
+      return (_frame == NO_FRAME ? _pos : _frame) + _ref_bytes;
+    }
+
+    /*
+     * Writes out all complete frames. An open frame stays buffered.
+     */
+    bool flush()
+    {
+      const size_t end = (_frame == NO_FRAME) ? _pos : _frame;
+      if (end == 0 && _refs.empty()) return true;
+
+      std::vector<struct iovec> iov;
+      iov.reserve(2 * _refs.size() + 1);
+      size_t at = 0;
+      for (size_t i = 0; i < _refs.size(); ++i)
+      {
+        add(iov, _data + at, _refs[i].at - at);
+        add(iov, _refs[i].data, _refs[i].len);
+        at = _refs[i].at;
+      }
+      add(iov, _data + at, end - at);
+
+      const bool ok = write_all(&iov[0], iov.size());
+      _refs.clear();
+      _ref_bytes = 0;
+      memmove(_data, _data + end, _pos - end);
+      _pos -= end;
+      _base += end;
+      if (_frame != NO_FRAME) _frame = 0;
+      if (!ok) fail(MSGPACK_E_FILE, "write failed");
+      return ok;
+    }
+
+    virtual void write_byte(uint8_t byte)
+    {
+      if (_pos < _capacity || room(1))
+      {
+        _data[_pos++] = (char)byte;
+      }
+    }
+
+    virtual void write2(uint16_t v)
+    {
+      v = htobe16(v);
+      write(&v, 2);
+    }
+
+    virtual void write4(uint32_t v)
+    {
+      v = htobe32(v);
+      write(&v, 4);
+    }
+
+    virtual void write8(uint64_t v)
+    {
+      v = htobe64(v);
+      write(&v, 8);
+    }
+
+    virtual void write_float(float v)
+    {
+      uint32_t u;
+      memcpy(&u, &v, 4);
+      write4(u);
+    }
+
+    virtual void write_double(double v)
+    {
+      uint64_t u;
+      memcpy(&u, &v, 8);
+      write8(u);
+    }
+
+    virtual void write(const void *buf, size_t len)
+    {
+      if (len <= _capacity - _pos || room(len))
+      {
+        memcpy(_data + _pos, buf, len);
+        _pos += len;
+      }
+    }
+
+    /*
+     * Only bytes of the open frame can be patched.
+     */
+    virtual size_t tell()
+    {
+      return _base + _pos;
+    }
+
+    virtual void patch(size_t pos, const void *buf, size_t len)
+    {
+      if (pos >= _base) memcpy(_data + (pos - _base), buf, len);
+    }
+
+    private:
+
+    bool room(size_t len)
+    {
+      if (!_buf.try_resize(_pos + len))
+      {
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+        return false;
+      }
+      _data = (char*)_buf.data();
+      _capacity = _buf.capacity();
+      return true;
+    }
+
+    static void add(std::vector<struct iovec> &iov, const char *p, size_t len)
+    {
+      if (len == 0) return;
+      struct iovec v;
+      v.iov_base = (void*)p;
+      v.iov_len = len;
+      iov.push_back(v);
+    }
+
+    bool write_all(struct iovec *iov, size_t n)
+    {
+      while (n > 0)
+      {
+        ssize_t w = writev(_fd, iov, (int)(n < IOV_MAX ? n : IOV_MAX));
+        if (w < 0)
+        {
+          if (errno == EINTR) continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+          {
+            struct pollfd p = { _fd, POLLOUT, 0 };
+            poll(&p, 1, -1);
+            continue;
+          }
+          return false;
+        }
+        size_t done = (size_t)w;
+        while (n > 0 && done >= iov->iov_len)
+        {
+          done -= iov->iov_len;
+          ++iov;
+          --n;
+        }
+        if (n > 0)
+        {
+          iov->iov_base = (char*)iov->iov_base + done;
+          iov->iov_len -= done;
+        }
+      }
+      return true;
+    }
+  };
+
+  class FrameReader : public ErrorState
+  {
+    private:
+
+    int _fd;
+    ResizableBuffer _buf;
+    char *_data;
+    size_t _begin;      // first byte not returned yet
+    size_t _end;        // end of the bytes read
+    size_t _read_size;
+    size_t _max_frame;
+
+    FrameReader(const FrameReader&);
+    FrameReader& operator=(const FrameReader&);
+
+    public:
+
+    /*
+     * Reads from fd, which is not closed, up to read_size bytes at a
+     * time. Frames longer than max_frame fail with MSGPACK_E_LIMIT.
+     */
+    FrameReader(int fd, size_t read_size = 64 << 10, size_t max_frame = UINT32_MAX) :
+      _fd(fd), _data(nullptr), _begin(0), _end(0),
+      _read_size(read_size > 0 ? read_size : 64 << 10), _max_frame(max_frame)
+    {
+      if (!_buf.try_resize(_read_size))
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+      else
+        _data = (char*)_buf.data();
+    }
+
+    /*
+     * Returns the next frame in data and len, valid until the next
+     * call. Returns false at the end of the input or on error.
+     */
+    bool next(const char *&data, size_t &len)
+    {
+      for (;;)
+      {
+        const size_t avail = _end - _begin;
+        if (avail >= 4)
+        {
+          uint32_t be;
+          memcpy(&be, _data + _begin, 4);
+          const size_t n = be32toh(be);
+          if (n > _max_frame)
+          {
+            fail(MSGPACK_E_LIMIT, "frame larger than max_frame");
+            return false;
+          }
+          if (avail - 4 >= n)
+          {
+            data = _data + _begin + 4;
+            len = n;
+            _begin += 4 + n;
+            return true;
+          }
+          if (!fill(4 + n)) return false;
+        }
+        else if (!fill(4)) return false;
+      }
+    }
+
+    /*
+     * Whether a complete frame is buffered, i.e. next() will not block.
+     */
+    bool ready() const
+    {
+      const size_t avail = _end - _begin;
+      if (avail < 4) return false;
+      uint32_t be;
+      memcpy(&be, _data + _begin, 4);
+      return avail - 4 >= be32toh(be);
+    }
+
+    private:
+
+    /*
+     * Reads more input, making room for a frame of need bytes.
+     */
+    bool fill(size_t need)
+    {
+      if (!_data) return false;
+      if (_begin > 0 && _buf.capacity() - _begin < need + _read_size / 2)
+      {
+        memmove(_data, _data + _begin, _end - _begin);
+        _end -= _begin;
+        _begin = 0;
+      }
+      if (_buf.capacity() - _begin < need)
+      {
+        if (!_buf.try_resize(_begin + need))
+        {
+          fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+          return false;
+        }
+        _data = (char*)_buf.data();
+      }
+
+      for (;;)
+      {
+        ssize_t r = ::read(_fd, _data + _end, _buf.capacity() - _end);
+        if (r > 0)
+        {
+          _end += (size_t)r;
+          return true;
+        }
+        if (r == 0)
+        {
+          if (_end > _begin) fail(MSGPACK_E_EOF, "truncated frame");
+          return false;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+          struct pollfd p = { _fd, POLLIN, 0 };
+          poll(&p, 1, -1);
+          continue;
+        }
+        fail(MSGPACK_E_FILE, "read failed");
+        return false;
+      }
+    }
+  };
+
+} /* namespace MessagePack */
+
+#endif
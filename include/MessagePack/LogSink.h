@@ -0,0 +1,465 @@
+#ifndef __MESSAGEPACK_LOG_SINK__HEADER__
+#define __MESSAGEPACK_LOG_SINK__HEADER__
+
+#include <new>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/*
+ * Logging pipeline (C++11): many threads encode records, one background
+ * thread writes them.
+ *
+ *   FileWriter out(file);
+ *   LogSink sink(&out);
+ *
+ *   // in every logging thread
+ *   LogProducer log(sink);
+ *   LogEncoder enc(&log);
+ *   enc << record;
+ *   log.commit();
+ *
+ * A LogProducer belongs to one thread and encodes into its own buffer.
+ * Once the committed records reach batch_size bytes, the buffer is handed
+ * to the sink through a lock-free queue (no lock, no system call on the
+ * logging thread) and the flusher thread writes it to the output Writer
+ * in one piece. Records of one producer stay in order.
+ *
+ * Memory is bounded: at most max_pending bytes wait for the flusher. When
+ * a batch does not fit, the policy decides:
+ *
+ *   MSGPACK_LOG_BLOCK  the logging thread waits for the flusher.
+ *   MSGPACK_LOG_DROP   the batch is dropped (see dropped_records()).
+ *
+ * A record larger than max_pending fails with MSGPACK_E_LIMIT (see
+ * ErrorState) and is dropped at commit(), as is any record whose
+ * encoding failed.
+ *
+ * All producers must be destroyed (or flushed) before their sink.
+ */
+
+namespace MessagePack
+{
+
+  enum LogBackpressure
+  {
+    MSGPACK_LOG_BLOCK,
+    MSGPACK_LOG_DROP
+  };
+
+  struct _LogBatch
+  {
+    std::atomic<_LogBatch*> next;
+    char *data;
+    size_t len;
+    size_t records;
+  };
+
+  class LogSink
+  {
+    private:
+
+    Writer *_out;
+    size_t _max_pending;
+    LogBackpressure _policy;
+    std::chrono::milliseconds _interval;
+
+    // intrusive MPSC queue (Vyukov): producers exchange _head, the
+    // flusher pops at _tail
+    std::atomic<_LogBatch*> _head;
+    _LogBatch *_tail;
+    _LogBatch _stub;
+
+    std::atomic<size_t> _pending;
+    std::atomic<size_t> _dropped;
+    Error _error;
+
+    bool _stop;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::condition_variable _drained;
+    std::thread _thread;
+
+    LogSink(const LogSink&);
+    LogSink& operator=(const LogSink&);
+
+    public:
+
+    /*
+     * Writes to out, which is used by the flusher thread only (in
+     * recording mode, see error()).
+     */
+    LogSink(Writer *out, size_t max_pending = 64 << 20,
+        LogBackpressure policy = MSGPACK_LOG_BLOCK, unsigned flush_interval_ms = 10) :
+      _out(out), _max_pending(max_pending), _policy(policy),
+      _interval(flush_interval_ms), _pending(0), _dropped(0), _error(MSGPACK_OK), _stop(false)
+    {
+      _stub.next.store(nullptr);
+      _head.store(&_stub);
+      _tail = &_stub;
+      _thread = std::thread(&LogSink::run, this);
+    }
+
+    ~LogSink()
+    {
+      close();
+    }
+
+    /*
+     * Writes out everything queued and stops the flusher thread.
+     */
+    void close()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stop) return;
+        _stop = true;
+      }
+      _wakeup.notify_one();
+      _thread.join();
+      _drained.notify_all();
+    }
+
+    /*
+     * First error of the output Writer, available after close().
+     */
+    Error error() const
+    {
+      return _error;
+    }
+
+    size_t dropped_records() const
+    {
+      return _dropped.load(std::memory_order_relaxed);
+    }
+
+    size_t max_pending() const
+    {
+      return _max_pending;
+    }
+
+    /*
+     * Takes ownership of batch (allocated with malloc), applying the
+     * backpressure policy. Called by LogProducer.
+     */
+    void enqueue(_LogBatch *batch)
+    {
+      const size_t n = batch->len;
+      const size_t before = _pending.fetch_add(n, std::memory_order_acq_rel);
+
+      // wake up the flusher early once half of the limit is used
+      const size_t half = _max_pending / 2;
+      if (before < half && before + n >= half) _wakeup.notify_one();
+
+      if (before + n > _max_pending)
+      {
+        _pending.fetch_sub(n, std::memory_order_relaxed);
+        if (n > _max_pending || !wait_for_room(n))
+        {
+          _dropped.fetch_add(batch->records, std::memory_order_relaxed);
+          free(batch);
+          return;
+        }
+      }
+
+      batch->next.store(nullptr, std::memory_order_relaxed);
+      _LogBatch *prev = _head.exchange(batch, std::memory_order_acq_rel);
+      prev->next.store(batch, std::memory_order_release);
+    }
+
+    /*
+     * Wakes up the flusher now instead of after the flush interval.
+     */
+    void notify()
+    {
+      _wakeup.notify_one();
+    }
+
+    private:
+
+    // reserves n pending bytes, blocking or failing as the policy says
+    bool wait_for_room(size_t n)
+    {
+      if (_policy == MSGPACK_LOG_DROP) return false;
+
+      std::unique_lock<std::mutex> lock(_mutex);
+      for (;;)
+      {
+        size_t p = _pending.load(std::memory_order_acquire);
+        if (p + n <= _max_pending)
+        {
+          if (_pending.compare_exchange_weak(p, p + n, std::memory_order_acq_rel)) return true;
+          continue;
+        }
+        if (_stop) return false;
+        _wakeup.notify_one();
+        _drained.wait_for(lock, _interval);
+      }
+    }
+
+    _LogBatch *pop()
+    {
+      _LogBatch *tail = _tail;
+      _LogBatch *next = tail->next.load(std::memory_order_acquire);
+      if (tail == &_stub)
+      {
+        if (!next) return nullptr;
+        _tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+      if (next)
+      {
+        _tail = next;
+        return tail;
+      }
+      if (tail != _head.load(std::memory_order_acquire)) return nullptr; // push in progress
+      _stub.next.store(nullptr, std::memory_order_relaxed);
+      _LogBatch *prev = _head.exchange(&_stub, std::memory_order_acq_rel);
+      prev->next.store(&_stub, std::memory_order_release);
+      next = tail->next.load(std::memory_order_acquire);
+      if (next)
+      {
+        _tail = next;
+        return tail;
+      }
+      return nullptr;
+    }
+
+    // writes out what is queued, returns whether there was anything
+    bool drain()
+    {
+      bool any = false;
+      while (_LogBatch *b = pop())
+      {
+        _out->write(b->data, b->len);
+        _pending.fetch_sub(b->len, std::memory_order_acq_rel);
+        free(b);
+        any = true;
+      }
+      if (any) _drained.notify_all();
+      return any;
+    }
+
+    void run()
+    {
+      NoThrowScope s(*_out);
+      for (;;)
+      {
+        drain();
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_stop) break;
+        _wakeup.wait_for(lock, _interval);
+      }
+      // a push may still be completing
+      while (drain() || _tail->next.load(std::memory_order_acquire) || _head.load() != _tail)
+      {
+        std::this_thread::yield();
+      }
+      _error = _out->error();
+    }
+  };
+
+  /*
+   * Per-thread encoding buffer of a LogSink. Call commit() after each
+   * record; flush() hands over the committed records right away.
+   */
+  class LogProducer MSGPACK_FINAL : public Writer
+  {
+    private:
+
+    LogSink &_sink;
+    size_t _batch_size;
+    _LogBatch *_batch;
+    char *_pos;
+    char *_end;
+    size_t _committed;  // bytes of complete records in _batch
+    size_t _records;
+    bool _record_failed; // the record being written is to be dropped
+
+    LogProducer(const LogProducer&);
+    LogProducer& operator=(const LogProducer&);
+
+    public:
+
+    LogProducer(LogSink &sink, size_t batch_size = 64 << 10) :
+      _sink(sink), _batch_size(batch_size > 0 ? batch_size : 64 << 10),
+      _batch(nullptr), _pos(nullptr), _end(nullptr), _committed(0), _records(0),
+      _record_failed(false)
+    {
+      if (_batch_size > sink.max_pending()) _batch_size = sink.max_pending();
+      new_batch(_batch_size, 0);
+    }
+
+    virtual ~LogProducer()
+    {
+      NoThrowScope s(*this);
+      flush();
+      free(_batch);
+    }
+
+    /*
+     * Ends a record. Partly written records are never handed over, nor
+     * are records whose writing failed.
+     */
+    void commit()
+    {
+      if (!_batch) return;
+      if (_record_failed)
+      {
+        _pos = _batch->data + _committed;
+        _record_failed = false;
+        return;
+      }
+      _committed = _pos - _batch->data;
+      ++_records;
+      if (_committed >= _batch_size) push();
+    }
+
+    /*
+     * Hands over the committed records now and wakes up the flusher.
+     */
+    void flush()
+    {
+      if (_committed > 0) push();
+      _sink.notify();
+    }
+
+    virtual void write_byte(uint8_t byte)
+    {
+      if (_pos < _end)
+      {
+        *_pos++ = (char)byte;
+        return;
+      }
+      write_slow((const char*)&byte, 1);
+    }
+
+    virtual void write2(uint16_t v)
+    {
+      v = htobe16(v);
+      write(&v, 2);
+    }
+
+    virtual void write4(uint32_t v)
+    {
+      v = htobe32(v);
+      write(&v, 4);
+    }
+
+    virtual void write8(uint64_t v)
+    {
+      v = htobe64(v);
+      write(&v, 8);
+    }
+
+    virtual void write_float(float v)
+    {
+      uint32_t u;
+      memcpy(&u, &v, 4);
+      write4(u);
+    }
+
+    virtual void write_double(double v)
+    {
+      uint64_t u;
+      memcpy(&u, &v, 8);
+      write8(u);
+    }
+
+    virtual void write(const void *buf, size_t len)
+    {
+      if (len <= (size_t)(_end - _pos))
+      {
+        memcpy(_pos, buf, len);
+        _pos += len;
+        return;
+      }
+      write_slow((const char*)buf, len);
+    }
+
+    private:
+
+    /*
+     * Replaces _batch with a new one of at least the given capacity,
+     * carrying over the bytes from keep on (the record being written).
+     */
+    bool new_batch(size_t capacity, size_t keep)
+    {
+      const size_t tail = _batch ? (_pos - _batch->data) - keep : 0;
+      if (capacity < tail) capacity = tail;
+      void *mem = malloc(sizeof(_LogBatch) + capacity);
+      if (!mem)
+      {
+        _record_failed = true;
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+        return false;
+      }
+      _LogBatch *b = new (mem) _LogBatch();
+      b->data = (char*)(b + 1);
+      if (_batch) memcpy(b->data, _batch->data + keep, tail);
+      _batch = b;
+      _pos = b->data + tail;
+      _end = b->data + capacity;
+      return true;
+    }
+
+    void push()
+    {
+      _LogBatch *full = _batch;
+      if (!new_batch(_batch_size, _committed)) return;
+      full->len = _committed;
+      full->records = _records;
+      _committed = 0;
+      _records = 0;
+      _sink.enqueue(full);
+    }
+
+    // grows the batch for a record that does not fit, up to max_pending
+    void write_slow(const char *buf, size_t len)
+    {
+      if (!_batch)
+      {
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+        return;
+      }
+      if (_record_failed) return;
+      if (_committed > 0)
+      {
+        // hand over the complete records first
+        push();
+        if (len <= (size_t)(_end - _pos))
+        {
+          memcpy(_pos, buf, len);
+          _pos += len;
+          return;
+        }
+      }
+
+      const size_t used = _pos - _batch->data;
+      const size_t max = _sink.max_pending();
+      if (used > max || len > max - used)
+      {
+        _record_failed = true;
+        fail(MSGPACK_E_LIMIT, "log record larger than max_pending");
+        return;
+      }
+      size_t capacity = (_end - _batch->data) * 2;
+      while (capacity < used + len) capacity *= 2;
+      if (capacity > max) capacity = max;
+
+      _LogBatch *old = _batch;
+      if (!new_batch(capacity, 0)) return;
+      free(old);
+      memcpy(_pos, buf, len);
+      _pos += len;
+    }
+  };
+
+  typedef BasicEncoder<CompactProfile, LogProducer> LogEncoder;
+
+} /* namespace MessagePack */
+
+#endif
@@ -18,6 +18,11 @@
  *
  *       This can be used to easily dump objects as arrays, without
  *       manually counting the number of fields beforehand.
+ *
+ *   (2) Size-less maps: 0xc6 key0, value0, ..., keyN, valueN 0xc5
+ *
+ *   BasicEncoder::begin_array/begin_map write (1) and (2) when the Writer
+ *   cannot backpatch a header; the Decoder always reads them.
  */
 
 #ifndef __MESSAGEPACK__HEADER__
@@ -34,6 +39,17 @@
 #else
   #include <sys/endian.h>
 #endif
+#ifdef __linux__
+  #include <sys/mman.h> /* mmap(), mremap() */
+  #include <unistd.h>   /* sysconf() */
+  #ifdef MREMAP_MAYMOVE
+    #define MSGPACK_USE_MREMAP 1
+  #endif
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+  #include <sys/uio.h>  /* struct iovec */
+  #define MSGPACK_USE_IOVEC 1
+#endif
 #include <assert.h>   /* assert */
 #include <limits> /* numeric_limits */
 
@@ -0,0 +1,207 @@
+#ifndef __MESSAGEPACK_MMAP_WRITER__HEADER__
+#define __MESSAGEPACK_MMAP_WRITER__HEADER__
+
+#if !(defined(__unix__) || defined(__APPLE__))
+  #error "MmapWriter.h requires POSIX"
+#endif
+
+#include <sys/mman.h> /* mmap(), mremap() */
+#include <fcntl.h>    /* open(), posix_fallocate() */
+#include <unistd.h>   /* ftruncate(), sysconf() */
+
+namespace MessagePack
+{
+
+  /*
+   * Writes a file through a shared mapping: the file is grown in steps of
+   * increment bytes, data is stored directly into the page cache, and
+   * close() trims the file to the bytes written.
+   *
+   * Every step reserves its disk blocks with posix_fallocate(), so a full
+   * disk fails the write with MSGPACK_E_FILE instead of raising SIGBUS on
+   * a store into the mapping. (macOS has no posix_fallocate(); there the
+   * file grows sparsely with ftruncate() and SIGBUS remains possible.)
+   */
+  class MmapWriter MSGPACK_FINAL : public Writer
+  {
+    private:
+
+    int _fd;
+    char *_map;
+    size_t _mapped;
+    size_t _pos;
+    size_t _increment;
+
+    MmapWriter(const MmapWriter&);
+    MmapWriter& operator=(const MmapWriter&);
+
+    public:
+
+    /*
+     * Creates (or truncates) filename. Failures throw, unless throws is
+     * false (then they are recorded and writes are dropped).
+     */
+    MmapWriter(const char *filename, size_t increment = 64 << 20, bool throws = true)
+    {
+      _map = nullptr;
+      _mapped = 0;
+      _pos = 0;
+      const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+      _increment = (increment + page - 1) / page * page;
+      if (_increment == 0) _increment = page;
+      set_throws(throws);
+
+      _fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (_fd < 0) fail(MSGPACK_E_FILE, "Failed to open file");
+    }
+
+    virtual ~MmapWriter()
+    {
+      NoThrowScope s(*this);
+      close();
+    }
+
+    size_t size() const
+    {
+      return _pos;
+    }
+
+    /*
+     * Unmaps and trims the file to size(). Returns false on failure.
+     */
+    bool close()
+    {
+      if (_fd < 0) return !failed();
+
+      bool ok = true;
+      if (_map && munmap(_map, _mapped) != 0) ok = false;
+      _map = nullptr;
+      _mapped = 0;
+      if (ftruncate(_fd, (off_t)_pos) != 0) ok = false;
+      if (::close(_fd) != 0) ok = false;
+      _fd = -1;
+
+      if (!ok) fail(MSGPACK_E_FILE, "close failed");
+      return ok;
+    }
+
+    virtual void write_byte(uint8_t byte)
+    {
+      if (_pos < _mapped || grow(1))
+      {
+        _map[_pos++] = (char)byte;
+      }
+    }
+
+    virtual void write2(uint16_t v)
+    {
+      v = htobe16(v);
+      write(&v, 2);
+    }
+
+    virtual void write4(uint32_t v)
+    {
+      v = htobe32(v);
+      write(&v, 4);
+    }
+
+    virtual void write8(uint64_t v)
+    {
+      v = htobe64(v);
+      write(&v, 8);
+    }
+
+    virtual void write_float(float v)
+    {
+      uint32_t u;
+      memcpy(&u, &v, 4);
+      write4(u);
+    }
+
+    virtual void write_double(double v)
+    {
+      uint64_t u;
+      memcpy(&u, &v, 8);
+      write8(u);
+    }
+
+    virtual void write(const void *buf, size_t len)
+    {
+      if (len <= _mapped - _pos || grow(len))
+      {
+        memcpy(_map + _pos, buf, len);
+        _pos += len;
+      }
+    }
+
+    virtual size_t tell()
+    {
+      return _pos;
+    }
+
+    virtual void patch(size_t pos, const void *buf, size_t len)
+    {
+      if (_map) memcpy(_map + pos, buf, len);
+    }
+
+    private:
+
+    bool grow(size_t len)
+    {
+      if (_fd < 0)
+      {
+        fail(MSGPACK_E_FILE, "write to closed file");
+        return false;
+      }
+
+      size_t new_size = _mapped + _increment;
+      if (new_size < _pos + len)
+      {
+        new_size = (_pos + len + _increment - 1) / _increment * _increment;
+      }
+
+#ifdef __APPLE__
+      if (ftruncate(_fd, (off_t)new_size) != 0)
+      {
+        fail(MSGPACK_E_FILE, "ftruncate failed");
+        return false;
+      }
+#else
+      if (posix_fallocate(_fd, (off_t)_mapped, (off_t)(new_size - _mapped)) != 0)
+      {
+        fail(MSGPACK_E_FILE, "no space left for the file");
+        return false;
+      }
+#endif
+
+      // on failure, the old mapping stays valid
+      void *m;
+#ifdef MSGPACK_USE_MREMAP
+      if (_map)
+      {
+        m = mremap(_map, _mapped, new_size, MREMAP_MAYMOVE);
+      }
+      else
+      {
+        m = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+      }
+#else
+      m = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+      if (m != MAP_FAILED && _map) munmap(_map, _mapped);
+#endif
+
+      if (m == MAP_FAILED)
+      {
+        fail(MSGPACK_E_FILE, "mmap failed");
+        return false;
+      }
+
+      _map = (char*)m;
+      _mapped = new_size;
+      return true;
+    }
+  };
+
+} /* namespace MessagePack */
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef __MESSAGEPACK_PREFETCH_READER__HEADER__
+#define __MESSAGEPACK_PREFETCH_READER__HEADER__
+
+#include <sys/stat.h> /* fstat() */
+#include <fcntl.h>    /* open() */
+#include <unistd.h>   /* read(), lseek() */
+#include <errno.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Read-ahead file input (POSIX, C++11).
+ *
+ * PrefetchFileReader reads the file sequentially in blocks on a
+ * background thread, up to nbuffers blocks ahead of the decoder, so that
+ * decoding and I/O overlap:
+ *
+ *   PrefetchFileReader r("replay.log");
+ *   Decoder dec(&r);
+ *   while (!r.at_end()) { dec >> record; ... }
+ *
+ * The decoder consumes straight from the current block (peek() exposes
+ * it, see Decoder::read_raw_body_view); a read crossing into the next
+ * block waits for it if it is not loaded yet. The kernel is told about
+ * the sequential access with posix_fadvise(). Works on pipes, too.
+ */
+
+namespace MessagePack
+{
+
+  class PrefetchFileReader MSGPACK_FINAL : public Reader
+  {
+    private:
+
+    int _fd;
+    bool _close_fd;
+    size_t _size;          // SIZE_MAX unless a regular file
+    size_t _consumed;
+
+    std::vector<std::vector<char> > _blocks;
+    std::vector<size_t> _lengths;
+    size_t _produced;      // blocks loaded so far
+    size_t _released;      // blocks consumed so far
+    bool _holding;         // block _released is being consumed
+    bool _done;            // the reader thread has loaded the last block
+    bool _stop;
+    int _errno;
+
+    const char *_cur;
+    const char *_end;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::thread _thread;
+
+    PrefetchFileReader(const PrefetchFileReader&);
+    PrefetchFileReader& operator=(const PrefetchFileReader&);
+
+    public:
+
+    /*
+     * Opens filename. Failures throw, unless throws is false (then they
+     * are recorded and the reader is empty).
+     */
+    PrefetchFileReader(const char *filename, size_t block_size = 1 << 20,
+        size_t nbuffers = 3, bool throws = true)
+    {
+      set_throws(throws);
+      int fd = open(filename, O_RDONLY);
+      init(fd, true, block_size, nbuffers);
+      if (fd < 0) fail(MSGPACK_E_FILE, "Failed to open file");
+    }
+
+    /*
+     * Reads from the current position of fd, which is not closed.
+     */
+    PrefetchFileReader(int fd, size_t block_size, size_t nbuffers)
+    {
+      init(fd, false, block_size, nbuffers);
+    }
+
+    virtual ~PrefetchFileReader()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _cond.notify_all();
+      if (_thread.joinable()) _thread.join();
+      if (_close_fd && _fd >= 0) ::close(_fd);
+      _fd = -1;
+    }
+
+    virtual void read(void *buffer, size_t sz)
+    {
+      if (sz <= (size_t)(_end - _cur))
+      {
+        memcpy(buffer, _cur, sz);
+        _cur += sz;
+        _consumed += sz;
+        return;
+      }
+      read_slow((char*)buffer, sz);
+    }
+
+    virtual const char *peek(size_t &avail)
+    {
+      if (_cur == _end) next_block();
+      avail = _end - _cur;
+      return _cur;
+    }
+
+    virtual void skip(size_t sz)
+    {
+      while (sz > (size_t)(_end - _cur))
+      {
+        sz -= _end - _cur;
+        _consumed += _end - _cur;
+        _cur = _end;
+        if (!next_block())
+        {
+          eof();
+          return;
+        }
+      }
+      _cur += sz;
+      _consumed += sz;
+    }
+
+    virtual bool at_end()
+    {
+      return _cur == _end && !next_block();
+    }
+
+    virtual size_t remaining()
+    {
+      if (_size == SIZE_MAX) return SIZE_MAX;
+      return _consumed < _size ? _size - _consumed : 0;
+    }
+
+    private:
+
+    void init(int fd, bool close_fd, size_t block_size, size_t nbuffers)
+    {
+      _fd = fd;
+      _close_fd = close_fd;
+      _size = SIZE_MAX;
+      _consumed = 0;
+      _produced = 0;
+      _released = 0;
+      _holding = false;
+      _done = false;
+      _stop = false;
+      _errno = 0;
+      _cur = _end = nullptr;
+
+      if (fd < 0)
+      {
+        _done = true;
+        return;
+      }
+
+      struct stat st;
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+      {
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+        _size = (size_t)(st.st_size - (pos > 0 ? pos : 0));
+      }
+#ifdef POSIX_FADV_SEQUENTIAL
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+      if (block_size == 0) block_size = 1 << 20;
+      if (nbuffers < 2) nbuffers = 2;
+      _blocks.resize(nbuffers);
+      _lengths.resize(nbuffers);
+      for (size_t i = 0; i < nbuffers; ++i) _blocks[i].resize(block_size);
+
+      _thread = std::thread(&PrefetchFileReader::run, this);
+    }
+
+    /*
+     * The reader thread: fills the blocks round robin.
+     */
+    void run()
+    {
+      const size_t n = _blocks.size();
+      for (size_t i = 0;; ++i)
+      {
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _cond.wait(lock, [&]{ return _stop || i - _released < n; });
+          if (_stop) return;
+        }
+
+        std::vector<char> &block = _blocks[i % n];
+        size_t len = 0;
+        int err = 0;
+        while (len < block.size())
+        {
+          ssize_t r = ::read(_fd, &block[len], block.size() - len);
+          if (r < 0)
+          {
+            if (errno == EINTR) continue;
+            err = errno;
+            break;
+          }
+          if (r == 0) break;
+          len += (size_t)r;
+        }
+
+        const bool last = (len < block.size() || err != 0);
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _lengths[i % n] = len;
+          _produced = i + 1;
+          _errno = err;
+          _done = last;
+        }
+        _cond.notify_all();
+        if (last) return;
+      }
+    }
+
+    /*
+     * Releases the current block and waits for the next one. Returns
+     * false at the end of the input.
+     */
+    bool next_block()
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (_holding)
+      {
+        _holding = false;
+        ++_released;
+        _cond.notify_all();
+      }
+
+      for (;;)
+      {
+        _cond.wait(lock, [&]{ return _produced > _released || _done; });
+        if (_produced == _released)
+        {
+          _cur = _end = nullptr;
+          if (_errno != 0)
+          {
+            _errno = 0;
+            lock.unlock();
+            fail(MSGPACK_E_FILE, "read failed");
+          }
+          return false;
+        }
+
+        const size_t slot = _released % _blocks.size();
+        if (_lengths[slot] > 0)
+        {
+          _holding = true;
+          _cur = &_blocks[slot][0];
+          _end = _cur + _lengths[slot];
+          return true;
+        }
+        ++_released; // empty last block
+        _cond.notify_all();
+      }
+    }
+
+    void read_slow(char *buffer, size_t sz)
+    {
+      char *const start = buffer;
+      const size_t total = sz;
+      for (;;)
+      {
+        size_t n = _end - _cur;
+        if (sz <= n) break;
+        if (n > 0) memcpy(buffer, _cur, n);
+        buffer += n;
+        sz -= n;
+        _consumed += n;
+        _cur = _end;
+        if (!next_block())
+        {
+          memset(start, 0, total);
+          eof();
+          return;
+        }
+      }
+      memcpy(buffer, _cur, sz);
+      _cur += sz;
+      _consumed += sz;
+    }
+
+    void eof()
+    {
+      if (!failed()) fail(MSGPACK_E_EOF, "read over buffer boundaries");
+    }
+  };
+
+} /* namespace MessagePack */
+
+#endif
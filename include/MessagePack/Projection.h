@@ -0,0 +1,364 @@
+#ifndef __MESSAGEPACK_PROJECTION__HEADER__
+#define __MESSAGEPACK_PROJECTION__HEADER__
+
+#include <string.h>   /* memcmp() */
+#include <vector>
+#include <string>
+
+/*
+ * Projection of records to a subset of their fields, without decoding
+ * them:
+ *
+ *   Projection proj;
+ *   proj.add("id");
+ *   proj.add("user.name");     // only "name" of the map under "user"
+ *   proj.add("items.sku");     // "sku" of every map in the array "items"
+ *
+ *   MemoryReader in(data, len);
+ *   while (proj.project(in, out)) ;
+ *
+ * A record is walked once with the skipping logic of the Decoder. The
+ * bytes of kept entries (key and value) are copied verbatim to the
+ * Writer, consecutive ones in a single write(); only the headers of the
+ * maps (and arrays of maps) the paths go into are written anew, with the
+ * new count. So a projection is mostly memcpy.
+ *
+ * Paths name map keys (raws) separated by '.'. A path ending at a map
+ * keeps the whole value; a path going on into an array applies to every
+ * map in it. Values that a path cannot go into (numbers, strings, nested
+ * arrays, ...) are kept as they are. Keys that are not raws never match.
+ * Size-less maps (BasicEncoder::begin_map) are read, too; they come out
+ * with a count.
+ *
+ * Records are best held in memory by the Reader (MemoryReader, mmap,
+ * SegmentedReader, PrefetchFileReader, ShmRingReader, ...; see
+ * Reader::peek): then they are projected in place. Otherwise, or when a
+ * record crosses a buffer boundary, the record is copied to an internal
+ * buffer first.
+ *
+ * Invalid input is reported through the Reader, write errors through the
+ * Writer (see ErrorState).
+ */
+
+namespace MessagePack
+{
+
+  class Projection
+  {
+    private:
+
+    struct Node
+    {
+      std::string name;
+      bool all;                     // the path ends here: keep everything
+      std::vector<Node> children;
+
+      Node() : all(false) {}
+
+      const Node *find(const char *key, size_t len) const
+      {
+        for (size_t i = 0; i < children.size(); ++i)
+        {
+          const std::string &n = children[i].name;
+          if (n.size() == len && memcmp(n.data(), key, len) == 0) return &children[i];
+        }
+        return nullptr;
+      }
+    };
+
+    /*
+     * The output of a record: verbatim spans and new headers.
+     */
+    enum OpKind
+    {
+      OP_COPY,
+      OP_MAP,
+      OP_ARRAY
+    };
+
+    struct Op
+    {
+      OpKind kind;
+      const char *data;
+      size_t len;         // bytes of OP_COPY, count of OP_MAP/OP_ARRAY
+    };
+
+    Node _root;
+    bool _limited;
+    DecodeLimits _limits;
+    std::vector<Op> _ops;
+    RecordingReader _rec;     // records not held in memory by the Reader
+    Error _error;             // of the last plan()
+    const char *_error_msg;
+
+    public:
+
+    Projection() : _limited(false), _rec(nullptr), _error(MSGPACK_OK), _error_msg("")
+    {
+      _rec.set_throws(false);
+    }
+
+    /*
+     * Keeps the field at path (keys separated by sep).
+     */
+    void add(const std::string &path, char sep = '.')
+    {
+      Node *node = &_root;
+      size_t begin = 0;
+      for (;;)
+      {
+        if (node->all) return;    // an ancestor is kept whole
+
+        size_t end = path.find(sep, begin);
+        if (end == std::string::npos) end = path.size();
+        const std::string name = path.substr(begin, end - begin);
+
+        Node *child = (Node*)node->find(name.data(), name.size());
+        if (!child)
+        {
+          node->children.push_back(Node());
+          child = &node->children.back();
+          child->name = name;
+        }
+        node = child;
+
+        if (end == path.size()) break;
+        begin = end + 1;
+      }
+      node->all = true;
+      node->children.clear();
+    }
+
+    /*
+     * Checks the records against the limits (see Decoder::set_limits).
+     */
+    void set_limits(const DecodeLimits &limits)
+    {
+      _limits = limits;
+      _limited = true;
+    }
+
+    /*
+     * Projects the next record of in to out. Returns false at the end of
+     * the input or on error.
+     */
+    template <class W>
+    bool project(Reader &in, W &out)
+    {
+      if (in.failed() || in.at_end()) return false;
+
+      size_t avail;
+      const char *p = in.peek(avail);
+      if (p && avail > 0)
+      {
+        const size_t remaining = in.remaining();
+        const size_t len = plan(p, avail);
+        if (len > 0)
+        {
+          emit(out);
+          in.skip(len);
+          return !in.failed();
+        }
+        if (avail >= remaining)
+        {
+          in.fail(_error, _error_msg);
+          return false;
+        }
+      }
+
+      // not (completely) in memory: copy the record first
+      _rec.set_reader(&in);
+      _rec.reset();
+      _rec.clear_error();
+      Decoder dec(&_rec);
+      if (_limited) dec.set_limits(_limits);
+      dec.skip_value();
+      if (_rec.failed())
+      {
+        if (!in.failed()) in.fail(_rec.error(), _rec.error_message());
+        return false;
+      }
+      if (plan(_rec.data(), _rec.size()) == 0)
+      {
+        in.fail(_error, _error_msg);
+        return false;
+      }
+      emit(out);
+      return true;
+    }
+
+    /*
+     * Projects all records of in to out and returns their number.
+     */
+    template <class W>
+    size_t project_all(Reader &in, W &out)
+    {
+      size_t n = 0;
+      while (project(in, out)) ++n;
+      return n;
+    }
+
+    private:
+
+    /*
+     * Plans the output of the record at data (at most len bytes) in _ops.
+     * Returns the size of the record, or 0 if it is invalid or longer.
+     */
+    size_t plan(const char *data, size_t len)
+    {
+      _ops.clear();
+      MemoryReader r(data, len);
+      r.set_throws(false);
+      Decoder dec(&r);
+      if (_limited) dec.set_limits(_limits);
+      plan_value(dec, r, _root);
+      _error = r.error();
+      _error_msg = r.error_message();
+      if (r.failed()) return 0;
+      return len - r.remaining();
+    }
+
+    void copy(const char *from, const char *to)
+    {
+      if (from == to) return;
+      if (!_ops.empty() && _ops.back().kind == OP_COPY &&
+          _ops.back().data + _ops.back().len == from)
+      {
+        _ops.back().len += to - from;
+        return;
+      }
+      Op op = { OP_COPY, from, (size_t)(to - from) };
+      _ops.push_back(op);
+    }
+
+    static const char *position(MemoryReader &r)
+    {
+      size_t avail;
+      return r.peek(avail);
+    }
+
+    /*
+     * Plans the value at the position of r, which node applies to.
+     */
+    void plan_value(Decoder &dec, MemoryReader &r, const Node &node)
+    {
+      const char *start = position(r);
+      DataValue d;
+      DataType t = dec.read_next(d);
+
+      if (t == MSGPACK_T_MAP || t == MSGPACK_T_MAP_BEG)
+      {
+        plan_map(dec, r, node, t == MSGPACK_T_MAP_BEG, d.len);
+      }
+      else if (t == MSGPACK_T_ARRAY || t == MSGPACK_T_ARRAY_BEG)
+      {
+        plan_array(dec, r, node, start, t == MSGPACK_T_ARRAY_BEG, d.len);
+      }
+      else
+      {
+        dec.skip_body(t, d);
+        copy(start, position(r));
+      }
+    }
+
+    void plan_map(Decoder &dec, MemoryReader &r, const Node &node,
+                  bool open, uint32_t n)
+    {
+      Decoder::Nesting nest(dec);
+      if (!nest.ok()) return;
+
+      const size_t header = _ops.size();
+      Op op = { OP_MAP, nullptr, 0 };
+      _ops.push_back(op);
+
+      for (; open ? !dec.read_end() : n > 0; --n)
+      {
+        if (dec.failed()) return;
+        const char *entry = position(r);
+        DataValue k;
+        DataType kt = dec.read_next(k);
+        const char *key = (kt == MSGPACK_T_RAW) ? dec.read_raw_body_view(k.len) : nullptr;
+        const Node *child = key ? node.find(key, k.len) : nullptr;
+        if (!key) dec.skip_body(kt, k);
+
+        if (!child)
+        {
+          dec.skip_value();
+          continue;
+        }
+
+        ++_ops[header].len;
+        if (child->all)
+        {
+          dec.skip_value();
+          copy(entry, position(r));
+        }
+        else
+        {
+          copy(entry, position(r));
+          plan_value(dec, r, *child);
+        }
+      }
+    }
+
+    /*
+     * Maps in the array are projected; if none is, the array is kept as
+     * it is.
+     */
+    void plan_array(Decoder &dec, MemoryReader &r, const Node &node,
+                    const char *start, bool open, uint32_t n)
+    {
+      Decoder::Nesting nest(dec);
+      if (!nest.ok()) return;
+
+      const size_t header = _ops.size();
+      Op op = { OP_ARRAY, nullptr, 0 };
+      _ops.push_back(op);
+
+      for (; open ? !dec.read_end() : n > 0; --n)
+      {
+        if (dec.failed()) return;
+        const char *elem = position(r);
+        DataValue d;
+        DataType t = dec.read_next(d);
+        if (t == MSGPACK_T_MAP || t == MSGPACK_T_MAP_BEG)
+        {
+          plan_map(dec, r, node, t == MSGPACK_T_MAP_BEG, d.len);
+        }
+        else
+        {
+          dec.skip_body(t, d);
+          copy(elem, position(r));
+        }
+        ++_ops[header].len;
+      }
+
+      if (!open && (_ops.size() == header + 1 ||
+                    (_ops.size() == header + 2 && _ops[header + 1].kind == OP_COPY)))
+      {
+        // no map inside: the original header can stay
+        _ops.resize(header);
+        copy(start, position(r));
+      }
+    }
+
+    template <class W>
+    void emit(W &out)
+    {
+      BasicEncoder<CompactProfile, W> enc(&out);
+      for (size_t i = 0; i < _ops.size(); ++i)
+      {
+        const Op &op = _ops[i];
+        switch (op.kind)
+        {
+          case OP_COPY:  out.write(op.data, op.len); break;
+          case OP_MAP:   enc.emit_map((uint32_t)op.len); break;
+          case OP_ARRAY: enc.emit_array((uint32_t)op.len); break;
+        }
+      }
+    }
+  };
+
+} /* namespace MessagePack */
+
+#endif
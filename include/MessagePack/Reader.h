@@ -8,8 +8,11 @@ namespace MessagePack
 
   /*
    * Abstract base class of all Reader implementations
+   *
+   * A read() that fails in recording mode (see ErrorState) must fill
+   * buffer with zeros.
    */
-  class Reader
+  class Reader : public ErrorState
   {
     public:
 
@@ -18,30 +21,64 @@ namespace MessagePack
 
     virtual ~Reader(){}
 
+    /*
+     * Returns a pointer to the bytes that are available in contiguous
+     * memory at the current position, without consuming them, and stores
+     * their number in avail. Returns nullptr (avail = 0) if the Reader
+     * does not keep its input in memory.
+     */
+    virtual const char *peek(size_t &avail)
+    {
+      avail = 0;
+      return nullptr;
+    }
+
+    /*
+     * Returns the number of bytes left to read, or SIZE_MAX if unknown.
+     */
+    virtual size_t remaining()
+    {
+      return SIZE_MAX;
+    }
+
+    /*
+     * Consumes sz bytes without returning them.
+     */
+    virtual void skip(size_t sz)
+    {
+      char tmp[256];
+      while (sz > 0)
+      {
+        size_t n = sz < sizeof(tmp) ? sz : sizeof(tmp);
+        read(tmp, n);
+        sz -= n;
+      }
+    }
+
     uint8_t read_byte()
     {
-      uint8_t v;
+      uint8_t v = 0;
       read(&v, 1);
       return v;
     }
 
     uint16_t read2()
     {
-      uint16_t v;
+      uint16_t v = 0;
       read(&v, 2);
       return be16toh(v);
     }
 
     uint32_t read4()
     {
-      uint32_t v;
+      uint32_t v = 0;
       read(&v, 4);
       return be32toh(v);
     }
 
     uint64_t read8()
     {
-      uint64_t v;
+      uint64_t v = 0;
       read(&v, 8);
       return be64toh(v);
     }
@@ -78,28 +115,297 @@ namespace MessagePack
 
     virtual ~MemoryReader() {}
 
+    /*
+     * Starts over on another buffer. A recorded error sticks (see
+     * ErrorState::clear_error()).
+     */
+    void reset(const char *str, size_t sz)
+    {
+      _data = str;
+      _size = sz;
+      _pos = 0;
+    }
+
     virtual void read(void *buffer, size_t sz)
     {
-      needs_bytes(sz);
+      if (!needs_bytes(sz))
+      {
+        memset(buffer, 0, sz);
+        return;
+      }
       memcpy(buffer, &_data[_pos], sz);
       _pos += sz;
     }
 
+    virtual const char *peek(size_t &avail)
+    {
+      avail = _size - _pos;
+      return &_data[_pos];
+    }
+
+    virtual void skip(size_t sz)
+    {
+      if (needs_bytes(sz)) _pos += sz;
+    }
+
     virtual bool at_end()
     {
       assert(_pos <= _size);
       return(_pos == _size);
     }
 
+    virtual size_t remaining()
+    {
+      return _size - _pos;
+    }
+
     private:
 
-    void needs_bytes(size_t n)
+    bool needs_bytes(size_t n)
     {
-      if (_pos + n > _size)
-        throw EofException("read over buffer boundaries");
+      if (n > _size - _pos)
+      {
+        fail(MSGPACK_E_EOF, "read over buffer boundaries");
+        _pos = _size;   // recording mode: nothing more to read
+        return false;
+      }
+      return true;
     }
   };
 
+  /*
+   * Reads from another Reader and keeps a copy of every byte read or
+   * skipped, e.g. to capture an encoded value while a Decoder skips it:
+   *
+   *   RecordingReader rec(&in);
+   *   Decoder(&rec).skip_value();
+   *   forward(rec.data(), rec.size());
+   *
+   * A failure of the other Reader fails the RecordingReader as well.
+   */
+  class RecordingReader : public Reader
+  {
+    private:
+
+    Reader *_in;
+    ResizableBuffer _buf;
+    size_t _size;
+
+    RecordingReader(const RecordingReader&);
+    RecordingReader& operator=(const RecordingReader&);
+
+    public:
+
+    RecordingReader(Reader *in) : _in(in), _size(0) {}
+
+    virtual ~RecordingReader() {}
+
+    void set_reader(Reader *in)
+    {
+      _in = in;
+    }
+
+    /*
+     * Drops the recorded bytes; the buffer is kept for the next ones.
+     */
+    void reset()
+    {
+      _size = 0;
+    }
+
+    const char *data() const
+    {
+      return (const char*)_buf.data();
+    }
+
+    size_t size() const
+    {
+      return _size;
+    }
+
+    virtual void read(void *buffer, size_t sz)
+    {
+      const char *p = record(sz);
+      if (p) memcpy(buffer, p, sz);
+      else memset(buffer, 0, sz);
+    }
+
+    virtual void skip(size_t sz)
+    {
+      record(sz);
+    }
+
+    virtual bool at_end()
+    {
+      return _in->at_end();
+    }
+
+    virtual size_t remaining()
+    {
+      return _in->remaining();
+    }
+
+    private:
+
+    const char *record(size_t sz)
+    {
+      if (sz == 0) return nullptr;
+      char *p = (char*)_buf.try_ptr_at(_size, sz);
+      if (!p)
+      {
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+        return nullptr;
+      }
+      _in->read(p, sz);
+      if (_in->failed())
+      {
+        fail(_in->error(), _in->error_message());
+        return nullptr;
+      }
+      _size += sz;
+      return p;
+    }
+  };
+
+#ifdef MSGPACK_USE_IOVEC
+  /*
+   * Reads from a chain of buffers (e.g. the chunks of a receive ring)
+   * without coalescing them. Reads within the current segment are a
+   * single memcpy; items straddling a segment boundary are assembled
+   * from the pieces. peek() exposes the rest of the current segment, so
+   * Decoder::read_raw_body_view() is zero-copy for raws that do not
+   * cross a boundary.
+   *
+   * The iovec array and the buffers must outlive the reader.
+   */
+  class SegmentedReader MSGPACK_FINAL : public Reader
+  {
+    private:
+
+    const struct iovec *_segs;
+    size_t _count;
+    size_t _seg;        // current segment
+    const char *_cur;   // current position within _segs[_seg]
+    const char *_end;   // end of _segs[_seg]
+    size_t _remaining;  // bytes left including the current segment
+
+    SegmentedReader(const SegmentedReader&);
+    SegmentedReader& operator=(const SegmentedReader&);
+
+    public:
+
+    SegmentedReader(const struct iovec *segs, size_t count)
+    {
+      _segs = segs;
+      _count = count;
+      _remaining = 0;
+      for (size_t i = 0; i < count; ++i) _remaining += segs[i].iov_len;
+      _seg = 0;
+      _cur = _end = nullptr;
+      if (count > 0) enter(0);
+      next_nonempty();
+    }
+
+    virtual ~SegmentedReader() {}
+
+    virtual void read(void *buffer, size_t sz)
+    {
+      if (sz <= (size_t)(_end - _cur))
+      {
+        memcpy(buffer, _cur, sz);
+        _cur += sz;
+        _remaining -= sz;
+        if (_cur == _end) next_nonempty();
+        return;
+      }
+      read_straddling((char*)buffer, sz);
+    }
+
+    virtual const char *peek(size_t &avail)
+    {
+      avail = _end - _cur;
+      return _cur;
+    }
+
+    virtual void skip(size_t sz)
+    {
+      if (sz > _remaining)
+      {
+        consume_all();
+        fail(MSGPACK_E_EOF, "read over buffer boundaries");
+        return;
+      }
+      _remaining -= sz;
+      while (sz > (size_t)(_end - _cur))
+      {
+        sz -= _end - _cur;
+        enter(_seg + 1);
+      }
+      _cur += sz;
+      if (_cur == _end) next_nonempty();
+    }
+
+    virtual bool at_end()
+    {
+      return _remaining == 0;
+    }
+
+    virtual size_t remaining()
+    {
+      return _remaining;
+    }
+
+    private:
+
+    void enter(size_t seg)
+    {
+      _seg = seg;
+      _cur = (const char*)_segs[seg].iov_base;
+      _end = _cur + _segs[seg].iov_len;
+    }
+
+    // moves past exhausted (and empty) segments
+    void next_nonempty()
+    {
+      while (_cur == _end && _seg + 1 < _count) enter(_seg + 1);
+    }
+
+    void consume_all()
+    {
+      _remaining = 0;
+      if (_count > 0) enter(_count - 1);
+      _cur = _end;
+    }
+
+    void read_straddling(char *buffer, size_t sz)
+    {
+      if (sz > _remaining)
+      {
+        consume_all();
+        memset(buffer, 0, sz);
+        fail(MSGPACK_E_EOF, "read over buffer boundaries");
+        return;
+      }
+      _remaining -= sz;
+      for (;;)
+      {
+        size_t n = _end - _cur;
+        if (sz <= n)
+        {
+          memcpy(buffer, _cur, sz);
+          _cur += sz;
+          break;
+        }
+        memcpy(buffer, _cur, n);
+        buffer += n;
+        sz -= n;
+        enter(_seg + 1);
+      }
+      if (_cur == _end) next_nonempty();
+    }
+  };
+#endif
+
   class FileReader : public Reader
   {
     private:
@@ -119,32 +425,49 @@ namespace MessagePack
       _close_file = false;
     }
 
-    FileReader(const char *filename)
+    /*
+     * Opens filename. Failures throw, unless throws is false (then they
+     * are recorded and the reader is empty).
+     */
+    FileReader(const char *filename, bool throws = true)
     {
+      _file = nullptr;
+      _size = 0;
+      _pos = 0;
+      _close_file = false;
+      set_throws(throws);
+
       FILE *file = fopen(filename, "r");
-      if (!file) throw FileException("Failed to open file");
+      if (!file)
+      {
+        fail(MSGPACK_E_FILE, "Failed to open file");
+        return;
+      }
 
       if (fseek(file, 0, SEEK_END) != 0)
       {
         fclose(file);
-        throw FileException("fseek failed");
+        fail(MSGPACK_E_FILE, "fseek failed");
+        return;
       }
 
       long sz = ftell(file);
       if (sz < 0)
       {
         fclose(file);
-        throw FileException("ftell failed");
+        fail(MSGPACK_E_FILE, "ftell failed");
+        return;
       }
 
       if (fseek(file, 0, SEEK_SET) != 0)
       {
         fclose(file);
-        throw FileException("fseek failed");
+        fail(MSGPACK_E_FILE, "fseek failed");
+        return;
       }
 
       _file = file;
-      _size = boost::numeric_cast<size_t>(sz);
+      _size = (size_t)sz;
       _pos = 0;
       _close_file = true;
     }
@@ -160,10 +483,29 @@ namespace MessagePack
 
     virtual void read(void *buffer, size_t sz)
     {
-      needs_bytes(sz);
+      if (!needs_bytes(sz))
+      {
+        memset(buffer, 0, sz);
+        return;
+      }
       if (fread(buffer, sz, 1, _file) != 1)
       {
-        throw FileException("fread failed");
+        memset(buffer, 0, sz);
+        _pos = _size;
+        fail(MSGPACK_E_FILE, "fread failed");
+        return;
+      }
+      _pos += sz;
+    }
+
+    virtual void skip(size_t sz)
+    {
+      if (!needs_bytes(sz)) return;
+      if (fseek(_file, (long)sz, SEEK_CUR) != 0)
+      {
+        _pos = _size;
+        fail(MSGPACK_E_FILE, "fseek failed");
+        return;
       }
       _pos += sz;
     }
@@ -174,12 +516,22 @@ namespace MessagePack
       return(_pos == _size);
     }
 
+    virtual size_t remaining()
+    {
+      return _size - _pos;
+    }
+
     private:
 
-    inline void needs_bytes(size_t n)
+    inline bool needs_bytes(size_t n)
     {
-      if (_pos + n > _size)
-        throw EofException("read over buffer boundaries");
+      if (n > _size - _pos)
+      {
+        fail(MSGPACK_E_EOF, "read over buffer boundaries");
+        _pos = _size;   // recording mode: nothing more to read
+        return false;
+      }
+      return true;
     }
   };
 
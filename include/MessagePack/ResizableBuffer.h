@@ -4,6 +4,15 @@
 namespace MessagePack
 {
 
+  /*
+   * Growable heap buffer.
+   *
+   * Large mode (set_mmap_threshold, Linux only): once the buffer grows
+   * beyond the threshold it moves to an anonymous mapping (one last copy)
+   * and from then on grows in place with mremap(), which moves page table
+   * entries instead of copying. With huge_pages, transparent huge pages
+   * are requested for the mapping (madvise MADV_HUGEPAGE).
+   */
   class ResizableBuffer
   {
     private:
@@ -11,6 +20,12 @@ namespace MessagePack
     void *_data;
     size_t _capacity;
     char _empty_buf; // is used as a special case when _capacity = 0 (see data()).
+    bool _mapped;
+    bool _huge_pages;
+    size_t _mmap_threshold; // 0: never map
+
+    ResizableBuffer(const ResizableBuffer&);
+    ResizableBuffer& operator=(const ResizableBuffer&);
 
     public:
 
@@ -19,18 +34,40 @@ namespace MessagePack
       _data = nullptr;
       _capacity = 0;
       _empty_buf = 0;
+      _mapped = false;
+      _huge_pages = false;
+      _mmap_threshold = 0;
     }
 
     ~ResizableBuffer()
     {
       if (_data)
       {
+#ifdef MSGPACK_USE_MREMAP
+        if (_mapped) munmap(_data, _capacity);
+        else
+#endif
         free(_data);
         _data = nullptr;
       }
       _capacity = 0;
     }
 
+    /*
+     * Enables large mode for capacities of at least threshold bytes (0
+     * disables it). Does nothing on platforms without mremap().
+     */
+    void set_mmap_threshold(size_t threshold, bool huge_pages = false)
+    {
+      _mmap_threshold = threshold;
+      _huge_pages = huge_pages;
+    }
+
+    bool mapped() const
+    {
+      return _mapped;
+    }
+
     size_t capacity() const
     {
       return _capacity;
@@ -49,23 +86,70 @@ namespace MessagePack
     }
 
     void *ptr_at(size_t offs, size_t len)
+    {
+      void *p = try_ptr_at(offs, len);
+      if (!p) raise_error(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+      return p;
+    }
+
+    /*
+     * Like ptr_at(), but returns nullptr if out of memory.
+     */
+    void *try_ptr_at(size_t offs, size_t len) MSGPACK_NOEXCEPT
     {
       assert(len > 0);
-      resize(offs + len);
+      if (!try_resize(offs + len)) return nullptr;
       assert(_data);
       return (void*)(((char*)_data)+offs);
     }
 
     void resize(size_t req)
     {
-      if (req < _capacity) return;
+      if (!try_resize(req)) raise_error(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+    }
 
-      void *d = nullptr;
+    /*
+     * Allocates exactly req bytes unless the capacity is already large
+     * enough (resize() rounds up to a power of two).
+     */
+    void reserve(size_t req)
+    {
+      if (!try_reserve(req)) raise_error(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+    }
+
+    bool try_reserve(size_t req) MSGPACK_NOEXCEPT
+    {
+      if (req <= _capacity) return true;
+      return grow(req);
+    }
+
+    /*
+     * Like resize(), but returns false if out of memory.
+     */
+    bool try_resize(size_t req) MSGPACK_NOEXCEPT
+    {
+      if (req <= _capacity) return true;
 
       size_t new_size = _capacity * 2;
       if (new_size < 16) new_size = 16;
       while (req > new_size) new_size *= 2;
 
+      return grow(new_size);
+    }
+
+    private:
+
+    bool grow(size_t new_size) MSGPACK_NOEXCEPT
+    {
+#ifdef MSGPACK_USE_MREMAP
+      if (_mmap_threshold > 0 && new_size >= _mmap_threshold)
+      {
+        return grow_mapped(new_size);
+      }
+#endif
+
+      void *d = nullptr;
+
       if (_data)
       {
         d = realloc(_data, new_size);
@@ -75,16 +159,47 @@ namespace MessagePack
         d = malloc(new_size);
       }
 
-      if (d)
+      if (!d) return false;
+
+      _data = d;
+      _capacity = new_size;
+      return true;
+    }
+
+#ifdef MSGPACK_USE_MREMAP
+    bool grow_mapped(size_t new_size) MSGPACK_NOEXCEPT
+    {
+      // whole huge pages if requested, whole pages otherwise
+      const size_t page = _huge_pages ? (size_t)2 << 20 : (size_t)sysconf(_SC_PAGESIZE);
+      new_size = (new_size + page - 1) / page * page;
+
+      void *d;
+      if (_mapped)
       {
-        _data = d;
-        _capacity = new_size;
+        d = mremap(_data, _capacity, new_size, MREMAP_MAYMOVE);
+        if (d == MAP_FAILED) return false;
       }
       else
       {
-        throw OutOfMemoryException("insufficient memory");
+        d = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (d == MAP_FAILED) return false;
+        if (_data)
+        {
+          memcpy(d, _data, _capacity);
+          free(_data);
+        }
+        _mapped = true;
       }
+
+#ifdef MADV_HUGEPAGE
+      if (_huge_pages) madvise(d, new_size, MADV_HUGEPAGE);
+#endif
+
+      _data = d;
+      _capacity = new_size;
+      return true;
     }
+#endif
   };
 
 } /* namespace MessagePack */
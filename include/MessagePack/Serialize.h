@@ -14,7 +14,12 @@
 #include <tuple>
 #include <unordered_map>
 #include <unordered_set>
+#include <type_traits>
+#include <algorithm>
+#include <memory>
 #include <boost/numeric/conversion/cast.hpp>
+#include <boost/container/flat_map.hpp>
+#include <boost/container/flat_set.hpp>
 #endif
 
 
@@ -26,32 +31,34 @@ namespace MessagePack
   // Encode
   //
 
-  inline Encoder& operator<<(Encoder& p, const uint8_t &v) { p.emit_uint(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const uint16_t &v) { p.emit_uint(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const uint32_t &v) { p.emit_uint(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const uint64_t &v) { p.emit_uint(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const int8_t &v) { p.emit_int(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const int16_t &v) { p.emit_int(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const int32_t &v) { p.emit_int(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const int64_t &v) { p.emit_int(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const float &v) { p.emit_float(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const double &v) { p.emit_double(v); return p; }
-  inline Encoder& operator<<(Encoder& p, const bool &v) { p.emit_bool(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const uint8_t &v) { p.emit_integer(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const uint16_t &v) { p.emit_integer(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const uint32_t &v) { p.emit_integer(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const uint64_t &v) { p.emit_integer(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const int8_t &v) { p.emit_integer(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const int16_t &v) { p.emit_integer(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const int32_t &v) { p.emit_integer(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const int64_t &v) { p.emit_integer(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const float &v) { p.emit_float(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const double &v) { p.emit_double(v); return p; }
+  template <class P, class W> inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const bool &v) { p.emit_bool(v); return p; }
 
-  inline Encoder& operator<<(Encoder& p, const string &v)
+  template <class P, class W>
+  inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const string &v)
   {
     p.emit_raw(v.c_str(), boost::numeric_cast<unsigned int>(v.size()));
     return p;
   }
 
-  inline Encoder& operator<<(Encoder& p, const char *v)
+  template <class P, class W>
+  inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const char *v)
   {
     p.emit_raw(v, boost::numeric_cast<unsigned int>(strlen(v)));
     return p;
   }
 
-  template <class T>
-  Encoder& operator<<(Encoder& p, const vector<T> &v)
+  template <class P, class W, class T>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const vector<T> &v)
   {
     typedef typename vector<T>::const_iterator CI;
     p.emit_array(boost::numeric_cast<unsigned int>(v.size()));
@@ -62,8 +69,8 @@ namespace MessagePack
     return p;
   }
 
-  template <class T>
-  Encoder& operator<<(Encoder& p, const set<T> &v)
+  template <class P, class W, class T>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const set<T> &v)
   {
     typedef typename set<T>::const_iterator CI;
     p.emit_array(v.size());
@@ -74,8 +81,8 @@ namespace MessagePack
     return p;
   }
 
-  template <class K, class V>
-  Encoder& operator<<(Encoder& p, const map<K, V> &v)
+  template <class P, class W, class K, class V>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const map<K, V> &v)
   {
     typedef typename map<K, V>::const_iterator CI;
     p.emit_map(boost::numeric_cast<unsigned int>(v.size()));
@@ -103,7 +110,8 @@ namespace MessagePack
 
   template <int N, int S, typename ...Types> 
   struct _InterleavedEncoder {
-    static void encode(Encoder &enc, const vector<tuple<Types...>> &array) {
+    template <class P, class W>
+    static void encode(BasicEncoder<P, W> &enc, const vector<tuple<Types...>> &array) {
       enc.emit_array(array.size());
       for (const auto &e : array) enc << get<N>(e);
       _InterleavedEncoder<N+1, S, Types...>::encode(enc, array);
@@ -112,11 +120,12 @@ namespace MessagePack
 
   template <int S, typename ...Types> 
   struct _InterleavedEncoder<S, S, Types...> {
-    static void encode(Encoder &, const vector<tuple<Types...>> &) { }
+    template <class P, class W>
+    static void encode(BasicEncoder<P, W> &, const vector<tuple<Types...>> &) { }
   };
 
-  template <typename ...Types>
-  inline void encode_interleaved(Encoder &enc, const vector<tuple<Types...>> &array) {
+  template <class P, class W, typename ...Types>
+  inline void encode_interleaved(BasicEncoder<P, W> &enc, const vector<tuple<Types...>> &array) {
     _InterleavedEncoder<0, sizeof...(Types), Types...>::encode(enc, array);
   }
 
@@ -126,38 +135,40 @@ namespace MessagePack
  
   template <int N, int S, typename ...Types>
   struct _TupleEncoder {
-    static void encode(Encoder &enc, const tuple<Types...> &tuple) {
+    template <class P, class W>
+    static void encode(BasicEncoder<P, W> &enc, const tuple<Types...> &tuple) {
       enc << get<N>(tuple);
-      _TupleEncoder<N+1, S, Types...>::encode(tuple);
+      _TupleEncoder<N+1, S, Types...>::encode(enc, tuple);
     }
   };
 
   template <int S, typename ...Types>
   struct _TupleEncoder<S, S, Types...> {
-    static void encode(Encoder& , const tuple<Types...> &) { }
+    template <class P, class W>
+    static void encode(BasicEncoder<P, W>& , const tuple<Types...> &) { }
   };
 
-  template <typename ...Types>
-  Encoder& operator<<(Encoder& enc, const tuple<Types...> &v)
+  template <class P, class W, typename ...Types>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& enc, const tuple<Types...> &v)
   {
     enc.emit_array(sizeof...(Types));
     _TupleEncoder<0, sizeof...(Types), Types...>::encode(enc, v);
     return enc;
   }
 
-  template <class T>
-  Encoder& operator<<(Encoder& p, const unordered_set<T> &v)
+  template <class P, class W, class T>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const unordered_set<T> &v)
   {
     p.emit_array(boost::numeric_cast<unsigned int>(v.size()));
     for (const auto &elem : v)
     {
-      p << v;
+      p << elem;
     }
     return p;
   }
 
-  template <class K, class V>
-  Encoder& operator<<(Encoder& p, const unordered_map<K, V> &v)
+  template <class P, class W, class K, class V>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const unordered_map<K, V> &v)
   {
     p.emit_map(boost::numeric_cast<unsigned int>(v.size()));
     for (const auto &elem : v)
@@ -233,6 +244,7 @@ namespace MessagePack
   inline Decoder& operator>>(Decoder &dec, string &v) 
   {
     uint32_t sz = dec.read_raw();
+    if (!dec.charge(sz)) return dec;
 #if 0
     // This is the safe way of doing it. But it needs two allocations!
     void *buf = malloc(sz);
@@ -250,27 +262,122 @@ namespace MessagePack
 
   inline Decoder& operator>>(Decoder &dec, char* &v) 
   {
-    uint32_t sz = dec.read_raw();
-    char *str = (char*)malloc(sz+1);
-    if (!str) throw OutOfMemoryException();
+    v = nullptr;
+    const size_t sz = dec.read_raw();
+    if (dec.failed()) return dec;
+    if (sz > dec.get_reader()->remaining())
+    {
+      dec.get_reader()->fail(MSGPACK_E_EOF, "read_raw: truncated input");
+      return dec;
+    }
+    if (!dec.charge(sz + 1)) return dec;
+
+    char *str = (char*)malloc(sz + 1);
+    if (!str)
+    {
+      dec.get_reader()->fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+      return dec;
+    }
+#ifdef MSGPACK_USE_EXCEPTIONS
+    try { dec.read_raw_body(str, sz); } catch (...) { free(str); throw; }
+#else
     dec.read_raw_body(str, sz);
+#endif
+    if (dec.failed())
+    {
+      free(str);
+      return dec;
+    }
     str[sz] = '\0';
     v = str;
     return dec;
   }
 
+  /*
+   * Containers are decoded without temporaries: elements are constructed
+   * in place (vector) or moved in (set, map), and sorted input is inserted
+   * at the end hint in constant time.
+   *
+   * In reuse mode (Decoder::set_reuse) a vector keeps the elements it
+   * already holds and decodes over them, so nested vectors and strings
+   * keep their capacity. Sets and maps are cleared first; otherwise they
+   * are merged into.
+   *
+   * With Decoder::set_limits, every container counts as one level of
+   * nesting and its elements are charged before anything is allocated.
+   *
+   * Size-less arrays and maps (BasicEncoder::begin_array) are accepted
+   * everywhere a container is expected; their elements are charged one
+   * by one.
+   */
+
   template <class T>
   inline Decoder& operator>>(Decoder &dec, vector<T> &v) 
   {
-    size_t sz = dec.read_array();
+    Decoder::Nesting nest(dec);
+    bool open;
+    size_t sz = dec.read_array_header(open);
+    if (!nest.ok()) return dec;
+
+    if (open)
+    {
+      if (!dec.reuse()) v.clear();
+      size_t i = 0;
+      for (; !dec.read_end() && dec.charge(sizeof(T)); ++i)
+      {
+        if (i == v.size()) v.emplace_back();
+        dec >> v[i];
+      }
+      v.resize(i);
+      return dec;
+    }
+
+    if (!dec.charge(sz * sizeof(T))) return dec;
+
+    if (dec.reuse())
+    {
+      v.resize(sz);
+      for (size_t i = 0; i < sz && !dec.failed(); ++i)
+      {
+        dec >> v[i];
+      }
+      return dec;
+    }
+
     v.clear();
     v.reserve(sz);
 
-    for (; sz > 0; --sz)
+    for (; sz > 0 && !dec.failed(); --sz)
     {
-      T element;
-      dec >> element;
-      v.push_back(element);
+      v.emplace_back();
+      dec >> v.back();
+    }
+    return dec;
+  }
+
+  inline Decoder& operator>>(Decoder &dec, vector<bool> &v) 
+  {
+    Decoder::Nesting nest(dec);
+    bool open;
+    size_t sz = dec.read_array_header(open);
+    if (!nest.ok()) return dec;
+
+    if (open)
+    {
+      v.clear();
+      while (!dec.read_end() && (v.size() % 8 != 0 || dec.charge(1)))
+      {
+        v.push_back(dec.read_bool());
+      }
+      return dec;
+    }
+
+    if (!dec.charge(sz / 8)) return dec;
+    v.resize(sz);
+
+    for (size_t i = 0; i < sz && !dec.failed(); ++i)
+    {
+      v[i] = dec.read_bool();
     }
     return dec;
   }
@@ -278,11 +385,18 @@ namespace MessagePack
   template <class T>
   inline Decoder& operator>>(Decoder &dec, set<T> &v) 
   {
-    for (auto sz = dec.read_array(); sz > 0; --sz)
+    if (dec.reuse()) v.clear();
+
+    Decoder::Nesting nest(dec);
+    bool open;
+    auto sz = dec.read_array_header(open);
+    if (!nest.ok() || !dec.charge(sz * sizeof(T))) return dec;
+
+    for (; (open ? !dec.read_end() && dec.charge(sizeof(T)) : sz > 0) && !dec.failed(); --sz)
     {
       T element;
       dec >> element;
-      v.insert(element);
+      v.insert(v.end(), std::move(element));
     }
     return dec;
   }
@@ -290,11 +404,19 @@ namespace MessagePack
   template <class K, class V>
   inline Decoder& operator>>(Decoder &dec, map<K, V> &v) 
   {
-    for (auto sz = dec.read_map(); sz > 0; --sz)
+    if (dec.reuse()) v.clear();
+
+    Decoder::Nesting nest(dec);
+    bool open;
+    auto sz = dec.read_map_header(open);
+    if (!nest.ok() || !dec.charge(sz * sizeof(pair<K, V>))) return dec;
+
+    for (; (open ? !dec.read_end() && dec.charge(sizeof(pair<K, V>)) : sz > 0) && !dec.failed(); --sz)
     {
       K key;
       dec >> key;
-      dec >> v[key];
+      auto it = v.emplace_hint(v.end(), piecewise_construct, forward_as_tuple(std::move(key)), forward_as_tuple());
+      dec >> it->second;
     }
     return dec;
   }
@@ -316,8 +438,10 @@ namespace MessagePack
   template <typename ...Types>
   Decoder& operator>>(Decoder& dec, tuple<Types...> &v)
   {
-    if (dec.read_array() != sizeof...(Types)) {
-      throw InvalidDecodeException("decode tuple");
+    Decoder::Nesting nest(dec);
+    if (dec.read_array() != sizeof...(Types) || !nest.ok()) {
+      dec.fail("decode tuple");
+      return dec;
     }
  
     _TupleDecoder<0, sizeof...(Types), Types...>::decode(dec, v);
@@ -327,11 +451,19 @@ namespace MessagePack
   template <class K>
   inline Decoder& operator>>(Decoder &dec, unordered_set<K> &v) 
   {
-    for (auto sz = dec.read_array(); sz > 0; --sz)
+    if (dec.reuse()) v.clear();
+
+    Decoder::Nesting nest(dec);
+    bool open;
+    auto sz = dec.read_array_header(open);
+    if (!nest.ok() || !dec.charge(sz * sizeof(K))) return dec;
+    v.reserve(v.size() + sz);
+
+    for (; (open ? !dec.read_end() && dec.charge(sizeof(K)) : sz > 0) && !dec.failed(); --sz)
     {
       K key;
       dec >> key;
-      v.insert(key);
+      v.insert(std::move(key));
     }
     return dec;
   }
@@ -339,15 +471,860 @@ namespace MessagePack
   template <class K, class V>
   inline Decoder& operator>>(Decoder &dec, unordered_map<K, V> &v) 
   {
-    for (auto sz = dec.read_map(); sz > 0; --sz)
+    if (dec.reuse()) v.clear();
+
+    Decoder::Nesting nest(dec);
+    bool open;
+    auto sz = dec.read_map_header(open);
+    if (!nest.ok() || !dec.charge(sz * sizeof(pair<K, V>))) return dec;
+    v.reserve(v.size() + sz);
+
+    for (; (open ? !dec.read_end() && dec.charge(sizeof(pair<K, V>)) : sz > 0) && !dec.failed(); --sz)
     {
       K key;
       dec >> key;
-      dec >> v[key];
+      dec >> v[std::move(key)];
+    }
+    return dec;
+  }
+
+  /*
+   * Flat associative containers
+   *
+   * boost::container::flat_map / flat_set, and sorted vectors of pairs
+   * wrapped with flat_map_of(v), are encoded as map (array for sets). On
+   * decoding, the entries are read into the contiguous sequence while
+   * checking that the keys arrive strictly ascending. If so (e.g. the data
+   * was written from a sorted container), the sequence is adopted as is;
+   * otherwise it is sorted once (for maps, the last of equal keys wins).
+   *
+   * Unlike map and set, flat containers are replaced, not merged into.
+   */
+
+  template <class Seq>
+  struct FlatMap
+  {
+    Seq &entries;
+    FlatMap(Seq &v) : entries(v) {}
+  };
+
+  template <class K, class V>
+  inline FlatMap<const vector<pair<K, V>>> flat_map_of(const vector<pair<K, V>> &v)
+  {
+    return FlatMap<const vector<pair<K, V>>>(v);
+  }
+
+  template <class K, class V>
+  inline FlatMap<vector<pair<K, V>>> flat_map_of(vector<pair<K, V>> &v)
+  {
+    return FlatMap<vector<pair<K, V>>>(v);
+  }
+
+  template <class P, class W, class Seq>
+  inline void _encode_flat_map(BasicEncoder<P, W> &p, const Seq &seq)
+  {
+    p.emit_map(boost::numeric_cast<unsigned int>(seq.size()));
+    for (const auto &e : seq)
+    {
+      p << e.first << e.second;
+    }
+  }
+
+  template <class P, class W, class Seq>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const FlatMap<Seq> &v)
+  {
+    _encode_flat_map(p, v.entries);
+    return p;
+  }
+
+  template <class P, class W, class K, class V, class C, class A>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const boost::container::flat_map<K, V, C, A> &v)
+  {
+    _encode_flat_map(p, v);
+    return p;
+  }
+
+  template <class P, class W, class T, class C, class A>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const boost::container::flat_set<T, C, A> &v)
+  {
+    p.emit_array(boost::numeric_cast<unsigned int>(v.size()));
+    for (const auto &e : v)
+    {
+      p << e;
+    }
+    return p;
+  }
+
+  /*
+   * Reads the entries of a map into seq and returns whether the keys were
+   * strictly ascending.
+   */
+  template <class Seq, class Compare>
+  inline bool _decode_flat_entries(Decoder &dec, Seq &seq, const Compare &comp)
+  {
+    typedef typename Seq::value_type E;
+    Decoder::Nesting nest(dec);
+    bool open;
+    size_t sz = dec.read_map_header(open);
+    if (!nest.ok() || !dec.charge(sz * sizeof(E)))
+    {
+      seq.clear();
+      return true;
+    }
+
+    if (open)
+    {
+      if (!dec.reuse()) seq.clear();
+    }
+    else if (dec.reuse())
+    {
+      seq.resize(sz);
+    }
+    else
+    {
+      seq.clear();
+      seq.reserve(sz);
+    }
+
+    bool sorted = true;
+    size_t i = 0;
+    for (; (open ? !dec.read_end() && dec.charge(sizeof(E)) : i < sz) && !dec.failed(); ++i)
+    {
+      if (i == seq.size()) seq.emplace_back();
+      dec >> seq[i].first;
+      dec >> seq[i].second;
+      if (i > 0 && sorted) sorted = comp(seq[i-1].first, seq[i].first);
+    }
+    if (open) seq.resize(i);
+
+    if (dec.failed())
+    {
+      seq.clear();
+      return true;
+    }
+    return sorted;
+  }
+
+  template <class Seq, class Compare>
+  inline void _sort_flat_map(Seq &seq, const Compare &comp)
+  {
+    typedef typename Seq::value_type E;
+    stable_sort(seq.begin(), seq.end(), [&comp](const E &a, const E &b) { return comp(a.first, b.first); });
+
+    // of equal keys (now adjacent, in input order) keep the last one
+    size_t out = 0;
+    for (size_t i = 0; i < seq.size(); ++i)
+    {
+      if (i + 1 < seq.size() && !comp(seq[i].first, seq[i+1].first)) continue;
+      if (out != i) seq[out] = std::move(seq[i]);
+      ++out;
+    }
+    seq.erase(seq.begin() + out, seq.end());
+  }
+
+  template <class K, class V>
+  inline Decoder& operator>>(Decoder &dec, const FlatMap<vector<pair<K, V>>> &v)
+  {
+    less<K> comp;
+    if (!_decode_flat_entries(dec, v.entries, comp)) _sort_flat_map(v.entries, comp);
+    return dec;
+  }
+
+  template <class K, class V, class C, class A>
+  inline Decoder& operator>>(Decoder &dec, boost::container::flat_map<K, V, C, A> &v)
+  {
+    // decode into the sequence of v itself to keep its capacity
+    typename boost::container::flat_map<K, V, C, A>::sequence_type seq(v.extract_sequence());
+    if (!_decode_flat_entries(dec, seq, v.key_comp())) _sort_flat_map(seq, v.key_comp());
+    v.adopt_sequence(boost::container::ordered_unique_range, std::move(seq));
+    return dec;
+  }
+
+  template <class T, class C, class A>
+  inline Decoder& operator>>(Decoder &dec, boost::container::flat_set<T, C, A> &v)
+  {
+    typename boost::container::flat_set<T, C, A>::sequence_type seq(v.extract_sequence());
+    const C comp = v.key_comp();
+    Decoder::Nesting nest(dec);
+    bool open;
+    size_t sz = dec.read_array_header(open);
+    if (!nest.ok() || !dec.charge(sz * sizeof(T))) sz = 0;
+
+    if (open)
+    {
+      if (!dec.reuse()) seq.clear();
+    }
+    else if (dec.reuse())
+    {
+      seq.resize(sz);
+    }
+    else
+    {
+      seq.clear();
+      seq.reserve(sz);
+    }
+
+    bool sorted = true;
+    size_t i = 0;
+    for (; (open ? !dec.read_end() && dec.charge(sizeof(T)) : i < sz) && !dec.failed(); ++i)
+    {
+      if (i == seq.size()) seq.emplace_back();
+      dec >> seq[i];
+      if (i > 0 && sorted) sorted = comp(seq[i-1], seq[i]);
+    }
+    if (open) seq.resize(i);
+
+    if (dec.failed())
+    {
+      seq.clear();
+    }
+    else if (!sorted)
+    {
+      sort(seq.begin(), seq.end(), comp);
+      seq.erase(unique(seq.begin(), seq.end(), [&comp](const T &a, const T &b) { return !comp(a, b); }), seq.end());
+    }
+    v.adopt_sequence(boost::container::ordered_unique_range, std::move(seq));
+    return dec;
+  }
+
+  /*
+   * Column decoding (used by decode_interleaved)
+   *
+   * Decodes n elements into out, out+stride, ... (stride in bytes). The
+   * generic version simply applies operator>> to every element.
+   */
+
+  template <class T>
+  inline T& _column_at(T *out, size_t stride, size_t i)
+  {
+    return *(T*)(((char*)out) + i*stride);
+  }
+
+  template <class T>
+  struct _ColumnDecoder {
+    static void decode(Decoder &dec, T *out, size_t stride, size_t n) {
+      for (size_t i = 0; i < n && !dec.failed(); ++i) dec >> _column_at(out, stride, i);
+    }
+  };
+
+  /*
+   * Arithmetic columns are decoded in bulk whenever the Reader exposes its
+   * input in memory (Reader::peek). Runs of elements that share the same
+   * type byte have a fixed width, so they are converted by a tight loop
+   * without per-element branches. The range check is accumulated over the
+   * run; if it fails, the run is decoded again through operator>> to raise
+   * the usual exception.
+   */
+
+  template <class S, int Size = sizeof(S)>
+  struct _BigEndian;
+
+  template <class S> struct _BigEndian<S, 1> {
+    static S load(const uint8_t *p) { return (S)p[0]; }
+  };
+
+  template <class S> struct _BigEndian<S, 2> {
+    static S load(const uint8_t *p) { uint16_t v; memcpy(&v, p, 2); v = be16toh(v); S s; memcpy(&s, &v, 2); return s; }
+  };
+
+  template <class S> struct _BigEndian<S, 4> {
+    static S load(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); v = be32toh(v); S s; memcpy(&s, &v, 4); return s; }
+  };
+
+  template <class S> struct _BigEndian<S, 8> {
+    static S load(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); v = be64toh(v); S s; memcpy(&s, &v, 8); return s; }
+  };
+
+  template <class T, class S>
+  inline bool _column_in_range(S s)
+  {
+    if (!numeric_limits<T>::is_integer) return true;
+    if (numeric_limits<S>::is_signed && (int64_t)s < 0)
+    {
+      return numeric_limits<T>::is_signed && (int64_t)s >= (int64_t)numeric_limits<T>::min();
+    }
+    return (uint64_t)s <= (uint64_t)numeric_limits<T>::max();
+  }
+
+  inline bool _is_fixnum(uint8_t c) { return c <= 0x7f || c >= 0xe0; }
+
+  /*
+   * Converts the run of elements of width w at p (at most m of them).
+   * Fixnums (w == 1) carry the value in the type byte itself.
+   */
+  template <class T, class S>
+  inline size_t _column_run(const uint8_t *p, size_t m, size_t w, T *out, size_t stride, bool &ok)
+  {
+    size_t k = 1;
+    if (w == 1)
+    {
+      while (k < m && _is_fixnum(p[k])) ++k;
+    }
+    else
+    {
+      while (k < m && p[k*w] == p[0]) ++k;
+    }
+
+    const size_t offs = (w == 1) ? 0 : 1;
+    bool in_range = true;
+    for (size_t j = 0; j < k; ++j)
+    {
+      S s = _BigEndian<S>::load(p + j*w + offs);
+      in_range &= _column_in_range<T>(s);
+      _column_at(out, stride, j) = (T)s;
+    }
+    ok = in_range;
+    return k;
+  }
+
+  template <class T>
+  struct _NumericColumnDecoder {
+    static void decode(Decoder &dec, T *out, size_t stride, size_t n) {
+      const bool is_int = numeric_limits<T>::is_integer;
+      Reader *r = dec.get_reader();
+      size_t i = 0;
+      while (i < n && !dec.failed())
+      {
+        size_t avail;
+        const uint8_t *p = (const uint8_t*)r->peek(avail);
+        size_t k = 0, w = 0;
+        bool ok = false;
+
+        if (avail > 0)
+        {
+          const uint8_t c = p[0];
+          if      (is_int && _is_fixnum(c)) w = 1;
+          else if (is_int && (c == 0xcc || c == 0xd0)) w = 2;
+          else if (is_int && (c == 0xcd || c == 0xd1)) w = 3;
+          else if ((is_int && (c == 0xce || c == 0xd2)) || (c == 0xca && sizeof(T) == 4 && !is_int)) w = 5;
+          else if ((is_int && (c == 0xcf || c == 0xd3)) || (c == 0xcb && sizeof(T) == 8 && !is_int)) w = 9;
+
+          size_t m = w ? avail / w : 0;
+          if (m > n - i) m = n - i;
+
+          if (m > 0)
+          {
+            T *o = &_column_at(out, stride, i);
+            switch (c)
+            {
+              case 0xcc: k = _column_run<T, uint8_t>(p, m, w, o, stride, ok); break;
+              case 0xcd: k = _column_run<T, uint16_t>(p, m, w, o, stride, ok); break;
+              case 0xce: k = _column_run<T, uint32_t>(p, m, w, o, stride, ok); break;
+              case 0xcf: k = _column_run<T, uint64_t>(p, m, w, o, stride, ok); break;
+              case 0xd0: k = _column_run<T, int8_t>(p, m, w, o, stride, ok); break;
+              case 0xd1: k = _column_run<T, int16_t>(p, m, w, o, stride, ok); break;
+              case 0xd2: k = _column_run<T, int32_t>(p, m, w, o, stride, ok); break;
+              case 0xd3: k = _column_run<T, int64_t>(p, m, w, o, stride, ok); break;
+              case 0xca: k = _column_run<T, float>(p, m, w, o, stride, ok); break;
+              case 0xcb: k = _column_run<T, double>(p, m, w, o, stride, ok); break;
+              default:   k = _column_run<T, int8_t>(p, m, w, o, stride, ok); break;
+            }
+          }
+        }
+
+        if (k > 0 && ok)
+        {
+          r->skip(k*w);
+        }
+        else
+        {
+          if (k == 0) k = 1;
+          for (size_t j = i; j < i + k; ++j) dec >> _column_at(out, stride, j);
+        }
+        i += k;
+      }
+    }
+  };
+
+  template <> struct _ColumnDecoder<uint8_t> : _NumericColumnDecoder<uint8_t> {};
+  template <> struct _ColumnDecoder<uint16_t> : _NumericColumnDecoder<uint16_t> {};
+  template <> struct _ColumnDecoder<uint32_t> : _NumericColumnDecoder<uint32_t> {};
+  template <> struct _ColumnDecoder<uint64_t> : _NumericColumnDecoder<uint64_t> {};
+  template <> struct _ColumnDecoder<int8_t> : _NumericColumnDecoder<int8_t> {};
+  template <> struct _ColumnDecoder<int16_t> : _NumericColumnDecoder<int16_t> {};
+  template <> struct _ColumnDecoder<int32_t> : _NumericColumnDecoder<int32_t> {};
+  template <> struct _ColumnDecoder<int64_t> : _NumericColumnDecoder<int64_t> {};
+  template <> struct _ColumnDecoder<float> : _NumericColumnDecoder<float> {};
+  template <> struct _ColumnDecoder<double> : _NumericColumnDecoder<double> {};
+
+  template <class T>
+  inline void _decode_column(Decoder &dec, vector<T> &column)
+  {
+    if (!column.empty())
+      _ColumnDecoder<T>::decode(dec, &column[0], sizeof(T), column.size());
+  }
+
+  inline void _decode_column(Decoder &dec, vector<bool> &column)
+  {
+    for (size_t i = 0; i < column.size() && !dec.failed(); ++i)
+    {
+      bool b;
+      dec >> b;
+      column[i] = b;
+    }
+  }
+
+  /*
+   * decode_interleaved:
+   *
+   * Counterpart of encode_interleaved. Decodes
+   *
+   *   [1, 2, 3], ["a", "b", "c"]
+   *
+   * either into an array of tuples
+   *
+   *   [ (1,"a"), (2,"b"), (3,"c") ]
+   *
+   * or into a tuple of columns ([1, 2, 3], ["a", "b", "c"]), e.g. by
+   * passing std::tie(ints, strings).
+   *
+   * The length of the first column is the number of rows. The target is
+   * sized once up front and every further column must have that length.
+   */
+
+  template <int N, int S, typename ...Types>
+  struct _InterleavedDecoder {
+    static void decode(Decoder &dec, vector<tuple<Types...>> &array) {
+      typedef typename tuple_element<N, tuple<Types...>>::type T;
+      if (N > 0) dec.read_array((uint32_t)array.size());
+      if (!array.empty())
+        _ColumnDecoder<T>::decode(dec, &get<N>(array[0]), sizeof(tuple<Types...>), array.size());
+      _InterleavedDecoder<N+1, S, Types...>::decode(dec, array);
+    }
+  };
+
+  template <int S, typename ...Types>
+  struct _InterleavedDecoder<S, S, Types...> {
+    static void decode(Decoder &, vector<tuple<Types...>> &) { }
+  };
+
+  template <typename ...Types>
+  inline void decode_interleaved(Decoder &dec, vector<tuple<Types...>> &array) {
+    size_t n = dec.read_array();
+    if (!dec.charge(n * sizeof(tuple<Types...>))) return;
+    array.resize(n);
+    _InterleavedDecoder<0, sizeof...(Types), Types...>::decode(dec, array);
+  }
+
+  template <int N, int S, class Columns>
+  struct _ColumnsDecoder {
+    static void resize(Columns &columns, size_t n) {
+      get<N>(columns).resize(n);
+      _ColumnsDecoder<N+1, S, Columns>::resize(columns, n);
+    }
+    static void decode(Decoder &dec, Columns &columns, size_t n) {
+      if (N > 0) dec.read_array((uint32_t)n);
+      _decode_column(dec, get<N>(columns));
+      _ColumnsDecoder<N+1, S, Columns>::decode(dec, columns, n);
+    }
+  };
+
+  template <int S, class Columns>
+  struct _ColumnsDecoder<S, S, Columns> {
+    static void resize(Columns &, size_t) { }
+    static void decode(Decoder &, Columns &, size_t) { }
+  };
+
+  // bytes of one row of a tuple of columns
+  template <class Columns>
+  struct _ColumnsSize;
+
+  template <typename ...Types>
+  struct _ColumnsSize<tuple<vector<Types>...>> {
+    static const size_t value = sizeof(tuple<Types...>);
+  };
+
+  template <typename ...Types>
+  struct _ColumnsSize<tuple<vector<Types>&...>> {
+    static const size_t value = sizeof(tuple<Types...>);
+  };
+
+  template <class Columns>
+  inline void _decode_columns(Decoder &dec, Columns &columns) {
+    const int S = tuple_size<Columns>::value;
+    size_t n = dec.read_array();
+    if (!dec.charge(n * _ColumnsSize<Columns>::value)) return;
+    _ColumnsDecoder<0, S, Columns>::resize(columns, n);
+    _ColumnsDecoder<0, S, Columns>::decode(dec, columns, n);
+  }
+
+  template <typename ...Types>
+  inline void decode_interleaved(Decoder &dec, tuple<vector<Types>...> &columns) {
+    _decode_columns(dec, columns);
+  }
+
+  template <typename ...Types>
+  inline void decode_interleaved(Decoder &dec, tuple<vector<Types>&...> columns) {
+    _decode_columns(dec, columns);
+  }
+
+  /*
+   * Delta encoded integer sequences
+   *
+   *   enc << delta_encoded(timestamps);
+   *   dec >> delta_encoded(timestamps);
+   *
+   * Writes a vector of integers as an ext item (type EXT_DELTA_INTEGERS).
+   * Each element is stored as the zigzag encoded difference to its
+   * predecessor, bit-packed in blocks of DELTA_BLOCK_SIZE values that
+   * share one bit width. Body layout:
+   *
+   *   count (4 bytes, big endian)
+   *   for each block: width (1 byte), ceil(k * width / 8) bytes of bits
+   *
+   * Monotonic sequences (timestamps, sorted IDs) need only a few bits per
+   * element. Decoding also accepts a plain array.
+   */
+
+  #ifndef MSGPACK_EXT_DELTA_INTEGERS
+  #define MSGPACK_EXT_DELTA_INTEGERS 0x44
+  #endif
+
+  static const int8_t EXT_DELTA_INTEGERS = MSGPACK_EXT_DELTA_INTEGERS;
+  static const size_t DELTA_BLOCK_SIZE = 128;
+
+  template <class V>
+  struct DeltaEncoded
+  {
+    V &values;
+    DeltaEncoded(V &v) : values(v) {}
+  };
+
+  template <class T>
+  inline DeltaEncoded<const vector<T>> delta_encoded(const vector<T> &v)
+  {
+    return DeltaEncoded<const vector<T>>(v);
+  }
+
+  template <class T>
+  inline DeltaEncoded<vector<T>> delta_encoded(vector<T> &v)
+  {
+    return DeltaEncoded<vector<T>>(v);
+  }
+
+  inline uint64_t _zigzag(uint64_t delta)
+  {
+    return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+  }
+
+  inline uint64_t _unzigzag(uint64_t z)
+  {
+    return (z >> 1) ^ (0 - (z & 1));
+  }
+
+  inline unsigned _bit_width(uint64_t v)
+  {
+    unsigned w = 0;
+    while (v) { ++w; v >>= 1; }
+    return w;
+  }
+
+  template <class T>
+  inline unsigned _delta_block_width(const T *x, size_t k, uint64_t prev)
+  {
+    uint64_t acc = 0;
+    for (size_t j = 0; j < k; ++j)
+    {
+      acc |= _zigzag((uint64_t)x[j] - prev);
+      prev = (uint64_t)x[j];
+    }
+    return _bit_width(acc);
+  }
+
+  template <class P, class W, class T>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const DeltaEncoded<const vector<T>> &de)
+  {
+    static_assert(numeric_limits<T>::is_integer, "delta_encoded requires an integer type");
+
+    const vector<T> &v = de.values;
+    const size_t n = v.size();
+    const T *x = n ? &v[0] : nullptr;
+
+    // first pass: bit width of each block, to compute the body length
+    size_t len = 4;
+    uint64_t prev = 0;
+    for (size_t i = 0; i < n; i += DELTA_BLOCK_SIZE)
+    {
+      size_t k = min(DELTA_BLOCK_SIZE, n - i);
+      len += 1 + (k * _delta_block_width(x + i, k, prev) + 7) / 8;
+      prev = (uint64_t)x[i + k - 1];
+    }
+
+    p.emit_ext(EXT_DELTA_INTEGERS, boost::numeric_cast<uint32_t>(len));
+    p.get_writer()->write4(boost::numeric_cast<uint32_t>(n));
+
+    uint8_t block[1 + DELTA_BLOCK_SIZE * 8];
+    prev = 0;
+    for (size_t i = 0; i < n; i += DELTA_BLOCK_SIZE)
+    {
+      size_t k = min(DELTA_BLOCK_SIZE, n - i);
+      unsigned w = _delta_block_width(x + i, k, prev);
+      size_t bytes = (k * w + 7) / 8;
+
+      block[0] = (uint8_t)w;
+      memset(block + 1, 0, bytes);
+
+      size_t bitpos = 0;
+      for (size_t j = 0; j < k; ++j, bitpos += w)
+      {
+        uint64_t z = _zigzag((uint64_t)x[i + j] - prev);
+        prev = (uint64_t)x[i + j];
+        for (unsigned b = 0; b < w; )
+        {
+          size_t pos = bitpos + b;
+          unsigned shift = pos & 7;
+          unsigned take = min(8 - shift, w - b);
+          block[1 + pos / 8] |= (uint8_t)(((z >> b) & ((1u << take) - 1)) << shift);
+          b += take;
+        }
+      }
+      p.get_writer()->write(block, 1 + bytes);
+    }
+    return p;
+  }
+
+  template <class P, class W, class T>
+  BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const DeltaEncoded<vector<T>> &de)
+  {
+    return p << DeltaEncoded<const vector<T>>(de.values);
+  }
+
+  /*
+   * Unpacks k values of w bits from a block. The block is copied into a
+   * zero padded buffer, so every value is extracted by a fixed sequence of
+   * loads and shifts without bounds checks.
+   */
+  inline void _unpack_delta_block(const uint8_t *bits, size_t k, unsigned w, uint64_t *out)
+  {
+    uint8_t buf[DELTA_BLOCK_SIZE * 8 + 16];
+    size_t bytes = (k * w + 7) / 8;
+    memcpy(buf, bits, bytes);
+    memset(buf + bytes, 0, sizeof(buf) - bytes);
+
+    const uint64_t mask = (w == 64) ? ~(uint64_t)0 : (((uint64_t)1 << w) - 1);
+    for (size_t j = 0; j < k; ++j)
+    {
+      size_t bitpos = j * w;
+      uint64_t lo, hi;
+      memcpy(&lo, buf + bitpos / 8, 8);
+      memcpy(&hi, buf + bitpos / 8 + 8, 8);
+      lo = le64toh(lo);
+      hi = le64toh(hi);
+      unsigned shift = bitpos & 7;
+      uint64_t v = (lo >> shift) | (shift ? (hi << (64 - shift)) : 0);
+      out[j] = v & mask;
+    }
+  }
+
+  template <class T>
+  inline Decoder& operator>>(Decoder &dec, const DeltaEncoded<vector<T>> &de)
+  {
+    static_assert(numeric_limits<T>::is_integer, "delta_encoded requires an integer type");
+
+    vector<T> &v = de.values;
+    DataValue d;
+
+    DataType t = dec.read_next(d);
+    if (t == MSGPACK_T_ARRAY)
+    {
+      if (!dec.charge(d.len * sizeof(T))) return dec;
+      v.resize(d.len);
+      _decode_column(dec, v);
+      return dec;
+    }
+    if (t != MSGPACK_T_EXT || d.ext.type != EXT_DELTA_INTEGERS || d.ext.len < 4)
+    {
+      dec.fail("delta_encoded: no delta sequence given");
+      return dec;
+    }
+
+    Reader *r = dec.get_reader();
+    size_t remaining = d.ext.len - 4;
+    size_t n = r->read4();
+    if (n > remaining * DELTA_BLOCK_SIZE)
+    {
+      dec.fail("delta_encoded: invalid count");
+      return dec;
+    }
+
+    if (!dec.charge(n * sizeof(T))) return dec;
+    v.resize(n);
+
+    uint8_t block[DELTA_BLOCK_SIZE * 8];
+    uint64_t z[DELTA_BLOCK_SIZE];
+    uint64_t prev = 0;
+
+    for (size_t i = 0; i < n; i += DELTA_BLOCK_SIZE)
+    {
+      size_t k = min(DELTA_BLOCK_SIZE, n - i);
+      if (remaining < 1 || dec.failed())
+      {
+        dec.fail("delta_encoded: truncated");
+        return dec;
+      }
+      unsigned w = r->read_byte();
+      size_t bytes = (k * w + 7) / 8;
+      if (w > 64 || 1 + bytes > remaining)
+      {
+        dec.fail("delta_encoded: invalid block");
+        return dec;
+      }
+      remaining -= 1 + bytes;
+
+      dec.read_raw_body(block, bytes);
+      _unpack_delta_block(block, k, w, z);
+
+      bool in_range = true;
+      for (size_t j = 0; j < k; ++j)
+      {
+        prev += _unzigzag(z[j]);
+        T x = (T)prev;
+        in_range &= ((uint64_t)x == prev);
+        v[i + j] = x;
+      }
+      if (!in_range)
+      {
+        dec.fail("delta_encoded: out of range");
+        return dec;
+      }
     }
+
+    if (remaining != 0) dec.fail("delta_encoded: trailing bytes");
     return dec;
   }
 
+  /*
+   * Two-pass encoding and decoding with a single allocation.
+   *
+   * measure(v) runs v through the operators above without writing and
+   * returns the exact encoded size:
+   *
+   *   BufferedMemoryWriter w(0);
+   *   w.reserve(measure(v));
+   *   Encoder enc(&w);
+   *   enc << v;
+   *
+   * measure_message() scans the first message in data without decoding
+   * it and totals its raws and container elements, e.g. to size an arena
+   * for all of its strings up front.
+   */
+
+  template <class P = CompactProfile, class T>
+  inline size_t measure(const T &v)
+  {
+    CountingWriter w;
+    BasicEncoder<P, CountingWriter> enc(&w);
+    enc << v;
+    return w.size();
+  }
+
+  inline Error measure_message(const char *data, size_t len, DecodeStats &stats)
+  {
+    MemoryReader r(data, len);
+    r.set_throws(false);
+    Decoder dec(&r);
+    dec.scan_value(stats);
+    return dec.error();
+  }
+
+  /*
+   * A value encoded once and spliced into any number of messages:
+   *
+   *   EncodedValue config = encode_value(site_config);   // once
+   *   enc << header << config;                           // one write() per use
+   *
+   * The bytes are immutable and shared, so copying an EncodedValue is
+   * cheap and copies may be used from several threads. The constructor
+   * from raw bytes trusts them to be exactly one encoded value (e.g. the
+   * output of another encoder). An empty EncodedValue encodes as nil.
+   */
+  class EncodedValue
+  {
+    private:
+
+    shared_ptr<const string> _bytes;
+
+    public:
+
+    EncodedValue() {}
+
+    EncodedValue(const char *data, size_t len) :
+      _bytes(make_shared<const string>(data, len)) {}
+
+    explicit EncodedValue(string &&bytes) :
+      _bytes(make_shared<const string>(std::move(bytes))) {}
+
+    const char *data() const
+    {
+      return _bytes ? _bytes->data() : nullptr;
+    }
+
+    size_t size() const
+    {
+      return _bytes ? _bytes->size() : 0;
+    }
+
+    bool empty() const
+    {
+      return size() == 0;
+    }
+  };
+
+  template <class P, class W>
+  inline BasicEncoder<P, W>& operator<<(BasicEncoder<P, W>& p, const EncodedValue &v)
+  {
+    if (v.empty()) p.emit_nil();
+    else p.get_writer()->write(v.data(), v.size());
+    return p;
+  }
+
+  /*
+   * Encodes v into an EncodedValue (with the exact size, see measure()).
+   * Errors are reported as for any other encoding; on a recorded error the
+   * result is empty.
+   */
+  template <class P = CompactProfile, class T>
+  inline EncodedValue encode_value(const T &v)
+  {
+    string bytes(measure<P>(v), '\0');
+    FixedBufferWriter w(&bytes[0], bytes.size());
+    BasicEncoder<P, FixedBufferWriter> enc(&w);
+    enc << v;
+    if (w.failed()) return EncodedValue();
+    return EncodedValue(std::move(bytes));
+  }
+
+  /*
+   * Exception-free encoding and decoding through the operators above.
+   * They return MSGPACK_OK or the first error recorded on the Writer or
+   * Reader (see ErrorState); nothing is thrown for malformed input, end
+   * of input, write errors or a full buffer.
+   */
+
+  template <class P, class W, class T>
+  inline Error try_encode(BasicEncoder<P, W> &enc, const T &v)
+  {
+    NoThrowScope s(*enc.get_writer());
+    enc << v;
+    return enc.get_writer()->error();
+  }
+
+  template <class T>
+  inline Error try_decode(Decoder &dec, T &v)
+  {
+    NoThrowScope s(*dec.get_reader());
+    dec >> v;
+    return dec.error();
+  }
+
+  template <class T>
+  inline Error try_decode(Decoder &dec, const T &v)
+  {
+    NoThrowScope s(*dec.get_reader());
+    dec >> v;
+    return dec.error();
+  }
+
   #endif
 
 } /* namespace MessagePack */
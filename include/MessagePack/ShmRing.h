@@ -0,0 +1,426 @@
+#ifndef __MESSAGEPACK_SHM_RING__HEADER__
+#define __MESSAGEPACK_SHM_RING__HEADER__
+
+#ifndef __linux__
+  #error "ShmRing.h requires Linux"
+#endif
+
+#include <sys/stat.h>        /* fstat() */
+#include <sys/mman.h>        /* mmap(), shm_open() */
+#include <fcntl.h>           /* O_CREAT */
+#include <unistd.h>          /* ftruncate(), sysconf() */
+#include <sys/syscall.h>     /* SYS_futex */
+#include <linux/futex.h>     /* FUTEX_WAIT, FUTEX_WAKE */
+#include <errno.h>
+#include <atomic>
+#include <new>
+
+/*
+ * Single-producer/single-consumer ring in shared memory (Linux, C++11),
+ * to pass records between two processes without copying them through a
+ * socket.
+ *
+ *   // producer
+ *   int fd = ShmRing::create(nullptr, 1 << 20);  // memfd, or shm_open(name)
+ *   ShmRing ring(fd);                            // pass fd on (SCM_RIGHTS)
+ *   ShmRingWriter w(ring);
+ *   ShmRingEncoder enc(&w);
+ *   enc << record;
+ *   w.commit();
+ *
+ *   // consumer
+ *   ShmRing ring(fd);
+ *   ShmRingReader r(ring);
+ *   Decoder dec(&r);
+ *   while (!r.at_end()) { dec >> record; r.release(); }
+ *
+ * The data area is mapped twice in a row, so a record crossing the end of
+ * the ring is still contiguous in memory: it is written with plain stores
+ * and read in place (peek(), Decoder::read_raw_body_view) whatever its
+ * position. A record becomes visible with commit(); its space is reused
+ * only after the consumer's release(), so views stay valid until then.
+ *
+ * Both sides block on a futex when the ring is full or empty. Records
+ * may not be larger than the capacity.
+ */
+
+namespace MessagePack
+{
+
+  struct _ShmRingHeader
+  {
+    uint64_t capacity;
+    std::atomic<uint32_t> closed;
+
+    alignas(64) std::atomic<uint64_t> tail;       // written by the producer
+    std::atomic<uint32_t> tail_seq;               // futex: bumped on commit
+    std::atomic<uint32_t> reader_waiting;
+
+    alignas(64) std::atomic<uint64_t> head;       // written by the consumer
+    std::atomic<uint32_t> head_seq;               // futex: bumped on release
+    std::atomic<uint32_t> writer_waiting;
+  };
+
+  class ShmRing
+  {
+    private:
+
+    char *_base;      // header page, data, data again
+    size_t _header_size;
+    size_t _capacity;
+    bool _ok;
+
+    ShmRing(const ShmRing&);
+    ShmRing& operator=(const ShmRing&);
+
+    public:
+
+    /*
+     * Creates the shared memory object of a ring of the given capacity
+     * (rounded up to a power of two, at least one page). With name, it is
+     * a POSIX shared memory object (shm_open), otherwise a memfd. Returns
+     * the file descriptor or -1.
+     */
+    static int create(const char *name, size_t capacity)
+    {
+      const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+      size_t cap = page;
+      while (cap < capacity) cap *= 2;
+
+      int fd = name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)
+                    : memfd_create("msgpack-ring", MFD_CLOEXEC);
+      if (fd < 0) return -1;
+      if (ftruncate(fd, (off_t)(page + cap)) != 0)
+      {
+        ::close(fd);
+        return -1;
+      }
+
+      void *p = mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED)
+      {
+        ::close(fd);
+        return -1;
+      }
+      _ShmRingHeader *h = new (p) _ShmRingHeader();
+      h->capacity = cap;
+      munmap(p, page);
+      return fd;
+    }
+
+    /*
+     * Maps the ring of fd (from create()). The fd may be closed afterwards.
+     */
+    ShmRing(int fd) : _base(nullptr), _header_size((size_t)sysconf(_SC_PAGESIZE)), _capacity(0), _ok(false)
+    {
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size <= _header_size) return;
+      _capacity = (size_t)st.st_size - _header_size;
+      if ((_capacity & (_capacity - 1)) != 0 || _capacity % _header_size != 0) return;
+
+      // reserve the address range, then map data twice at its end
+      void *p = mmap(nullptr, _header_size + 2 * _capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) return;
+      _base = (char*)p;
+      if (mmap(_base, _header_size + _capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+          mmap(_base + _header_size + _capacity, _capacity, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED, fd, (off_t)_header_size) == MAP_FAILED)
+      {
+        return;
+      }
+      _ok = (header()->capacity == _capacity);
+    }
+
+    ~ShmRing()
+    {
+      if (_base) munmap(_base, _header_size + 2 * _capacity);
+    }
+
+    bool ok() const
+    {
+      return _ok;
+    }
+
+    size_t capacity() const
+    {
+      return _capacity;
+    }
+
+    _ShmRingHeader *header() const
+    {
+      return (_ShmRingHeader*)_base;
+    }
+
+    /*
+     * Address of ring position pos; valid for up to capacity() bytes.
+     */
+    char *at(uint64_t pos) const
+    {
+      return _base + _header_size + (size_t)(pos & (_capacity - 1));
+    }
+
+    static void wait(std::atomic<uint32_t> &word, uint32_t value)
+    {
+      syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAIT, value, nullptr, nullptr, 0);
+    }
+
+    static void wake(std::atomic<uint32_t> &word)
+    {
+      syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+  };
+
+  class ShmRingWriter MSGPACK_FINAL : public Writer
+  {
+    private:
+
+    ShmRing &_ring;
+    _ShmRingHeader *_h;
+    uint64_t _pos;      // end of the record being written
+    uint64_t _limit;    // head + capacity as last seen
+    bool _record_failed; // the record being written is to be discarded
+
+    ShmRingWriter(const ShmRingWriter&);
+    ShmRingWriter& operator=(const ShmRingWriter&);
+
+    public:
+
+    ShmRingWriter(ShmRing &ring) : _ring(ring), _h(ring.header()), _record_failed(false)
+    {
+      _pos = _h->tail.load(std::memory_order_relaxed);
+      _limit = _h->head.load(std::memory_order_acquire) + ring.capacity();
+    }
+
+    virtual ~ShmRingWriter() {}
+
+    /*
+     * Publishes the record written since the last commit(). A record
+     * whose writing failed is discarded instead (see rollback()).
+     */
+    void commit()
+    {
+      if (_record_failed)
+      {
+        rollback();
+        return;
+      }
+      _h->tail.store(_pos, std::memory_order_seq_cst);
+      _h->tail_seq.fetch_add(1, std::memory_order_seq_cst);
+      if (_h->reader_waiting.exchange(0, std::memory_order_seq_cst))
+      {
+        ShmRing::wake(_h->tail_seq);
+      }
+    }
+
+    /*
+     * Discards the record written since the last commit().
+     */
+    void rollback()
+    {
+      _pos = _h->tail.load(std::memory_order_relaxed);
+      _record_failed = false;
+    }
+
+    /*
+     * Tells the consumer that no more records follow (at_end()).
+     */
+    void close()
+    {
+      _h->closed.store(1, std::memory_order_seq_cst);
+      _h->tail_seq.fetch_add(1, std::memory_order_seq_cst);
+      ShmRing::wake(_h->tail_seq);
+    }
+
+    virtual void write_byte(uint8_t byte)
+    {
+      if (_pos < _limit || room(1))
+      {
+        *_ring.at(_pos++) = (char)byte;
+      }
+    }
+
+    virtual void write2(uint16_t v)
+    {
+      v = htobe16(v);
+      write(&v, 2);
+    }
+
+    virtual void write4(uint32_t v)
+    {
+      v = htobe32(v);
+      write(&v, 4);
+    }
+
+    virtual void write8(uint64_t v)
+    {
+      v = htobe64(v);
+      write(&v, 8);
+    }
+
+    virtual void write_float(float v)
+    {
+      uint32_t u;
+      memcpy(&u, &v, 4);
+      write4(u);
+    }
+
+    virtual void write_double(double v)
+    {
+      uint64_t u;
+      memcpy(&u, &v, 8);
+      write8(u);
+    }
+
+    virtual void write(const void *buf, size_t len)
+    {
+      if (len <= _limit - _pos || room(len))
+      {
+        memcpy(_ring.at(_pos), buf, len);
+        _pos += len;
+      }
+    }
+
+    /*
+     * Only bytes of the record being written can be patched.
+     */
+    virtual size_t tell()
+    {
+      return (size_t)_pos;
+    }
+
+    virtual void patch(size_t pos, const void *buf, size_t len)
+    {
+      memcpy(_ring.at(pos), buf, len);
+    }
+
+    private:
+
+    // waits until len more bytes fit
+    bool room(size_t len)
+    {
+      const uint64_t start = _h->tail.load(std::memory_order_relaxed);
+      if (_pos + len - start > _ring.capacity())
+      {
+        _record_failed = true;
+        fail(MSGPACK_E_BUFFER_FULL, "record larger than the ring");
+        return false;
+      }
+
+      for (;;)
+      {
+        uint32_t seq = _h->head_seq.load(std::memory_order_seq_cst);
+        _limit = _h->head.load(std::memory_order_acquire) + _ring.capacity();
+        if (len <= _limit - _pos) return true;
+
+        _h->writer_waiting.store(1, std::memory_order_seq_cst);
+        _limit = _h->head.load(std::memory_order_acquire) + _ring.capacity();
+        if (len <= _limit - _pos) return true;
+        ShmRing::wait(_h->head_seq, seq);
+      }
+    }
+  };
+
+  class ShmRingReader MSGPACK_FINAL : public Reader
+  {
+    private:
+
+    ShmRing &_ring;
+    _ShmRingHeader *_h;
+    uint64_t _pos;      // read position
+    uint64_t _limit;    // tail as last seen
+
+    ShmRingReader(const ShmRingReader&);
+    ShmRingReader& operator=(const ShmRingReader&);
+
+    public:
+
+    ShmRingReader(ShmRing &ring) : _ring(ring), _h(ring.header())
+    {
+      _pos = _h->head.load(std::memory_order_relaxed);
+      _limit = _h->tail.load(std::memory_order_acquire);
+    }
+
+    virtual ~ShmRingReader() {}
+
+    /*
+     * Gives the space of everything read so far back to the producer.
+     * Pointers obtained by peek() become invalid.
+     */
+    void release()
+    {
+      _h->head.store(_pos, std::memory_order_seq_cst);
+      _h->head_seq.fetch_add(1, std::memory_order_seq_cst);
+      if (_h->writer_waiting.exchange(0, std::memory_order_seq_cst))
+      {
+        ShmRing::wake(_h->head_seq);
+      }
+    }
+
+    /*
+     * Number of committed bytes that can be read without waiting.
+     */
+    size_t available()
+    {
+      _limit = _h->tail.load(std::memory_order_acquire);
+      return (size_t)(_limit - _pos);
+    }
+
+    virtual void read(void *buffer, size_t sz)
+    {
+      if (sz <= _limit - _pos || await(sz))
+      {
+        memcpy(buffer, _ring.at(_pos), sz);
+        _pos += sz;
+        return;
+      }
+      memset(buffer, 0, sz);
+    }
+
+    virtual const char *peek(size_t &avail)
+    {
+      avail = available();
+      return _ring.at(_pos);
+    }
+
+    virtual void skip(size_t sz)
+    {
+      if (sz <= _limit - _pos || await(sz)) _pos += sz;
+    }
+
+    /*
+     * Waits for the next record; true once the producer has closed the
+     * ring and everything is read.
+     */
+    virtual bool at_end()
+    {
+      return _pos == _limit && !await(1, false);
+    }
+
+    private:
+
+    // waits until sz bytes are committed, false if the ring is closed
+    bool await(size_t sz, bool need = true)
+    {
+      for (;;)
+      {
+        uint32_t seq = _h->tail_seq.load(std::memory_order_seq_cst);
+        if (sz <= available()) return true;
+        if (_h->closed.load(std::memory_order_seq_cst))
+        {
+          if (sz <= available()) return true;
+          if (need) fail(MSGPACK_E_EOF, "read over buffer boundaries");
+          return false;
+        }
+
+        _h->reader_waiting.store(1, std::memory_order_seq_cst);
+        if (sz <= available()) return true;
+        ShmRing::wait(_h->tail_seq, seq);
+      }
+    }
+  };
+
+  typedef BasicEncoder<CompactProfile, ShmRingWriter> ShmRingEncoder;
+
+} /* namespace MessagePack */
+
+#endif
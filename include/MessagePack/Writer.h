@@ -6,8 +6,11 @@ namespace MessagePack
 
   /*
    * Abstract base class of all WriteBuffer implementations
+   *
+   * A write() that fails in recording mode (see ErrorState) drops the
+   * data.
    */
-  class Writer
+  class Writer : public ErrorState
   {
     public:
 
@@ -47,6 +50,22 @@ namespace MessagePack
     }
 
     virtual void write(const void *buf, size_t len) = 0;
+
+    /*
+     * Backpatching (see BasicEncoder::begin_array). tell() returns the
+     * number of bytes written so far, or SIZE_MAX if the Writer cannot
+     * change bytes once written (the default). patch() overwrites len
+     * bytes written at pos.
+     */
+    virtual size_t tell()
+    {
+      return SIZE_MAX;
+    }
+
+    virtual void patch(size_t pos, const void *buf, size_t len)
+    {
+      (void)pos; (void)buf; (void)len;
+    }
   };
 
   class FileWriter : public Writer
@@ -70,10 +89,55 @@ namespace MessagePack
     virtual void write(const void *buf, size_t len)
     {
       if (fwrite(buf, 1, len, this->file) != len)
-        throw FileException("write error");
+        fail(MSGPACK_E_FILE, "write error");
     }
   };
 
+  /*
+   * Discards the data and only counts the bytes written.
+   */
+  class CountingWriter MSGPACK_FINAL : public Writer
+  {
+    private:
+
+    size_t _count;
+
+    public:
+
+    CountingWriter() : _count(0) {}
+
+    virtual ~CountingWriter() {}
+
+    size_t size() const
+    {
+      return _count;
+    }
+
+    void reset()
+    {
+      _count = 0;
+    }
+
+    virtual void write_byte(uint8_t)   { _count += 1; }
+    virtual void write2(uint16_t)      { _count += 2; }
+    virtual void write4(uint32_t)      { _count += 4; }
+    virtual void write8(uint64_t)      { _count += 8; }
+    virtual void write_float(float)    { _count += 4; }
+    virtual void write_double(double)  { _count += 8; }
+
+    virtual void write(const void *, size_t len)
+    {
+      _count += len;
+    }
+
+    virtual size_t tell()
+    {
+      return _count;
+    }
+
+    virtual void patch(size_t, const void *, size_t) {}
+  };
+
   class BufferedMemoryWriter : public Writer
   {
     private:
@@ -85,7 +149,8 @@ namespace MessagePack
 
     BufferedMemoryWriter(size_t initial_size)
     {
-      _buf.resize(initial_size);
+      if (!_buf.try_resize(initial_size))
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
       _write_pos = 0;
     }
 
@@ -106,17 +171,236 @@ namespace MessagePack
       _write_pos = 0;
     }
 
+    /*
+     * See ResizableBuffer::set_mmap_threshold().
+     */
+    void set_mmap_threshold(size_t threshold, bool huge_pages = false)
+    {
+      _buf.set_mmap_threshold(threshold, huge_pages);
+    }
+
+    /*
+     * Makes room for n more bytes with a single allocation of the exact
+     * size (see measure() in Serialize.h).
+     */
+    void reserve(size_t n)
+    {
+      if (!_buf.try_reserve(_write_pos + n))
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+    }
+
     virtual void write_byte(uint8_t byte)
     {
-      *((uint8_t*)_buf.ptr_at(_write_pos, 1)) = byte;
+      uint8_t *p = (uint8_t*)_buf.try_ptr_at(_write_pos, 1);
+      if (!p)
+      {
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+        return;
+      }
+      *p = byte;
       ++_write_pos;
     }
 
     virtual void write(const void *buf, size_t len)
     {
-      memcpy(_buf.ptr_at(_write_pos, len), buf, len);
+      if (len == 0) return;
+      void *p = _buf.try_ptr_at(_write_pos, len);
+      if (!p)
+      {
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+        return;
+      }
+      memcpy(p, buf, len);
       _write_pos += len;
     }
+
+    virtual size_t tell()
+    {
+      return _write_pos;
+    }
+
+    virtual void patch(size_t pos, const void *buf, size_t len)
+    {
+      memcpy((char*)_buf.data() + pos, buf, len);
+    }
+  };
+
+  /*
+   * Writes into a caller-provided buffer and never allocates, unless the
+   * buffer overflows with the spill policy:
+   *
+   *   MSGPACK_OVERFLOW_FAIL   a write that does not fit is dropped and
+   *                           fails with MSGPACK_E_BUFFER_FULL (thrown or
+   *                           recorded, see ErrorState).
+   *   MSGPACK_OVERFLOW_SPILL  the bytes beyond the buffer go to a heap
+   *                           segment (overflow_data()).
+   *
+   * The class is final, so an encoder on it (FixedBufferEncoder) calls
+   * the writes below directly and inlines them.
+   */
+  enum OverflowPolicy
+  {
+    MSGPACK_OVERFLOW_FAIL,
+    MSGPACK_OVERFLOW_SPILL
+  };
+
+  class FixedBufferWriter MSGPACK_FINAL : public Writer
+  {
+    private:
+
+    char *_buf;
+    size_t _capacity;
+    size_t _pos;
+    OverflowPolicy _policy;
+    ResizableBuffer _overflow;
+    size_t _overflow_size;
+
+    FixedBufferWriter(const FixedBufferWriter&);
+    FixedBufferWriter& operator=(const FixedBufferWriter&);
+
+    public:
+
+    FixedBufferWriter(char *buf, size_t capacity, OverflowPolicy policy = MSGPACK_OVERFLOW_FAIL) :
+      _buf(buf), _capacity(capacity), _pos(0), _policy(policy), _overflow_size(0) {}
+
+    virtual ~FixedBufferWriter() {}
+
+    /*
+     * Total number of bytes written, including the overflow segment.
+     */
+    size_t size() const
+    {
+      return _pos + _overflow_size;
+    }
+
+    /*
+     * The caller's buffer. It holds the first min(size(), capacity())
+     * bytes.
+     */
+    const char *data() const
+    {
+      return _buf;
+    }
+
+    size_t capacity() const
+    {
+      return _capacity;
+    }
+
+    bool overflowed() const
+    {
+      return _overflow_size > 0;
+    }
+
+    const char *overflow_data() const
+    {
+      return (const char*)_overflow.data();
+    }
+
+    size_t overflow_size() const
+    {
+      return _overflow_size;
+    }
+
+    /*
+     * Starts over at the beginning of the buffer. The overflow segment
+     * keeps its memory.
+     */
+    void reset()
+    {
+      _pos = 0;
+      _overflow_size = 0;
+    }
+
+    virtual void write_byte(uint8_t byte)
+    {
+      if (_pos < _capacity && _overflow_size == 0)
+      {
+        _buf[_pos++] = (char)byte;
+        return;
+      }
+      overflow(&byte, 1);
+    }
+
+    virtual void write2(uint16_t v)
+    {
+      v = htobe16(v);
+      write(&v, 2);
+    }
+
+    virtual void write4(uint32_t v)
+    {
+      v = htobe32(v);
+      write(&v, 4);
+    }
+
+    virtual void write8(uint64_t v)
+    {
+      v = htobe64(v);
+      write(&v, 8);
+    }
+
+    virtual void write_float(float v)
+    {
+      uint32_t u;
+      memcpy(&u, &v, 4);
+      write4(u);
+    }
+
+    virtual void write_double(double v)
+    {
+      uint64_t u;
+      memcpy(&u, &v, 8);
+      write8(u);
+    }
+
+    virtual void write(const void *buf, size_t len)
+    {
+      if (len <= _capacity - _pos && _overflow_size == 0)
+      {
+        memcpy(_buf + _pos, buf, len);
+        _pos += len;
+        return;
+      }
+      overflow(buf, len);
+    }
+
+    virtual size_t tell()
+    {
+      return size();
+    }
+
+    virtual void patch(size_t pos, const void *buf, size_t len)
+    {
+      const char *p = (const char*)buf;
+      for (; len > 0 && pos < _capacity; --len) _buf[pos++] = *p++;
+      if (len > 0) memcpy((char*)_overflow.data() + (pos - _capacity), p, len);
+    }
+
+    private:
+
+    void overflow(const void *buf, size_t len)
+    {
+      if (_policy != MSGPACK_OVERFLOW_SPILL)
+      {
+        fail(MSGPACK_E_BUFFER_FULL, "buffer full");
+        return;
+      }
+      if (len == 0) return;
+
+      // fill up the buffer, the rest goes to the heap
+      size_t n = (_overflow_size == 0) ? _capacity - _pos : 0;
+      char *p = (char*)_overflow.try_ptr_at(_overflow_size, len - n);
+      if (!p)
+      {
+        fail(MSGPACK_E_OUT_OF_MEMORY, "insufficient memory");
+        return;
+      }
+      memcpy(_buf + _pos, buf, n);
+      _pos += n;
+      memcpy(p, (const char*)buf + n, len - n);
+      _overflow_size += len - n;
+    }
   };
 
 } /* namespace MessagePack */
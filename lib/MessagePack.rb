@@ -11,11 +11,36 @@ module MessagePack
   end
   module_function :dump_to_file
 
-  def each(str, &block)
-    raise unless _each(str, &block)
+  #
+  # Options of load, load_from_file and each, for untrusted input:
+  #
+  #   :max_depth     nesting of arrays and hashes (default 512)
+  #   :max_elements  elements of a single array or hash
+  #   :max_bytes     memory allocated for an object (strings, arrays, hashes)
+  #
+  # Exceeding a limit raises a RuntimeError.
+  #
+  def load(str, opts={})
+    _load(str, _limits(opts))
+  end
+  module_function :load
+
+  def load_from_file(filename, opts={})
+    _load_from_file(filename, _limits(opts))
+  end
+  module_function :load_from_file
+
+  def each(str, opts={}, &block)
+    raise unless _each(str, _limits(opts), &block)
   end
   module_function :each
 
+  def _limits(opts)
+    return nil if opts.empty?
+    [opts[:max_depth], opts[:max_elements], opts[:max_bytes]]
+  end
+  module_function :_limits
+
   def to_a(str)
     ary = []
     each(str) {|obj| ary << obj}
@@ -0,0 +1,40 @@
+#ifndef __MESSAGEPACK_TEST_CHECK__HEADER__
+#define __MESSAGEPACK_TEST_CHECK__HEADER__
+
+#include <stdio.h>
+
+/*
+ * Minimal assertions for the C++ tests (see Makefile, "make check").
+ * A failed CHECK reports its location and the test goes on; main()
+ * returns check_result(), which is non-zero after any failure.
+ */
+
+static int check_failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      ++check_failures; \
+    } \
+  } while (0)
+
+/*
+ * Checks that stmt throws an exception of type E (or derived).
+ */
+#define CHECK_THROWS(stmt, E) \
+  do { \
+    bool _check_thrown = false; \
+    try { stmt; } catch (E &) { _check_thrown = true; } \
+    if (!_check_thrown) { \
+      fprintf(stderr, "%s:%d: %s did not throw %s\n", __FILE__, __LINE__, #stmt, #E); \
+      ++check_failures; \
+    } \
+  } while (0)
+
+static inline int check_result()
+{
+  return check_failures == 0 ? 0 : 1;
+}
+
+#endif
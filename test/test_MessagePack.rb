@@ -28,4 +28,38 @@ class TestMessagePack < Test::Unit::TestCase
     }
     File.delete(filename)
   end
+
+  def test_invalid_input
+    assert_raise(ArgumentError) { MessagePack.load([0xc1].pack("C*")) }
+    assert_raise(ArgumentError) { MessagePack.load([0xd4, 0x01, 0x00].pack("C*")) }
+    assert_raise(ArgumentError) { MessagePack.load([0xc5].pack("C*")) }
+    assert_raise(RuntimeError) { MessagePack.load([0xdd, 0xff, 0xff, 0xff, 0xff].pack("C*")) }
+  end
+
+  def test_limits
+    str = MessagePack.dump([[[1]]])
+    assert_equal [[[1]]], MessagePack.load(str, :max_depth => 3)
+    assert_raise(RuntimeError) { MessagePack.load(str, :max_depth => 2) }
+    assert_raise(RuntimeError) { MessagePack.load(MessagePack.dump([1, 2, 3]), :max_elements => 2) }
+    assert_raise(RuntimeError) { MessagePack.load(MessagePack.dump("x" * 100), :max_bytes => 10) }
+
+    # size-less arrays nested deeper than the default :max_depth
+    deep = ([0xc4] * 100_000 + [0xc5] * 100_000).pack("C*")
+    assert_raise(RuntimeError) { MessagePack.load(deep) }
+    assert_raise(RuntimeError) {
+      Thread.new { Thread.current.report_on_exception = false; MessagePack.load(deep) }.join
+    }
+  end
+
+  def test_each_block_exits
+    str = MessagePack.dump(1) + MessagePack.dump(2) + MessagePack.dump(3)
+    assert_equal [1, 2, 3], MessagePack.to_a(str)
+
+    seen = []
+    MessagePack.each(str) {|obj| seen << obj; break if obj == 2 }
+    assert_equal [1, 2], seen
+
+    assert_raise(ZeroDivisionError) { MessagePack.each(str) {|obj| obj / 0 } }
+    assert_equal 2, catch(:found) { MessagePack.each(str) {|obj| throw :found, obj if obj == 2 } }
+  end
 end
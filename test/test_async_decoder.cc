@@ -0,0 +1,278 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/AsyncDecoder.h"
+#include "check.h"
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace MessagePack;
+
+/*
+ * A byte stream delivering at most chunk bytes per read. Every read
+ * suspends; the test resumes the waiting coroutine by hand.
+ */
+struct Chan
+{
+  std::string data;
+  size_t pos = 0;
+  size_t chunk = 1;
+  size_t max_len = 0;
+  std::coroutine_handle<> waiter;
+
+  struct Awaiter
+  {
+    Chan &c;
+    char *buf;
+    size_t len;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h) { c.waiter = h; }
+    size_t await_resume()
+    {
+      size_t n = std::min(std::min(c.chunk, len), c.data.size() - c.pos);
+      memcpy(buf, c.data.data() + c.pos, n);
+      c.pos += n;
+      return n;
+    }
+  };
+
+  Awaiter read_some(char *buf, size_t len)
+  {
+    max_len = std::max(max_len, len);
+    return Awaiter{*this, buf, len};
+  }
+
+  void resume()
+  {
+    std::coroutine_handle<> h = waiter;
+    waiter = nullptr;
+    h.resume();
+  }
+};
+
+struct Detached
+{
+  struct promise_type
+  {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+typedef std::map<std::string, std::vector<std::tuple<int, std::string> > > V;
+
+struct Result
+{
+  size_t count = 0;
+  bool same = true;
+  bool finished = false;
+  Error error = MSGPACK_OK;
+};
+
+static Detached decode_all(Chan &c, const std::vector<V> &want, size_t read_size, Result &res)
+{
+  AsyncDecoder<Chan> dec(c, read_size, 1 << 20);
+  dec.set_throws(false);
+  V v;
+  while (co_await (dec >> v))
+  {
+    res.same = res.same && res.count < want.size() && v == want[res.count];
+    ++res.count;
+    v.clear();
+  }
+  res.error = dec.error();
+  res.finished = true;
+}
+
+static Result run(const std::string &data, size_t chunk, size_t read_size, const std::vector<V> &want)
+{
+  Chan c;
+  c.data = data;
+  c.chunk = chunk;
+  Result res;
+  decode_all(c, want, read_size, res);
+  while (!res.finished) c.resume();
+  return res;
+}
+
+static void test_decode()
+{
+  std::vector<V> vals;
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  for (int i = 0; i < 200; ++i)
+  {
+    V v;
+    for (int j = 0; j < i % 7; ++j)
+    {
+      std::vector<std::tuple<int, std::string> > &x = v["k" + std::to_string(j)];
+      for (int k = 0; k < i; ++k) x.push_back(std::make_tuple(k, std::string(k * 50 % 300, 'z')));
+    }
+    vals.push_back(v);
+    e << v;
+  }
+  std::string all((const char*)w.data(), w.size());
+
+  const size_t chunks[] = {1, 3, 1000, 1 << 20};
+  const size_t read_sizes[] = {1, 7, 4096};
+  for (size_t i = 0; i < 4; ++i)
+  {
+    for (size_t j = 0; j < 3; ++j)
+    {
+      Result res = run(all, chunks[i], read_sizes[j], vals);
+      CHECK(res.same && res.count == 200 && res.error == MSGPACK_OK);
+    }
+  }
+
+  Result truncated = run(all.substr(0, all.size() - 1), 100, 64, vals);
+  CHECK(truncated.same && truncated.count == 199 && truncated.error == MSGPACK_E_EOF);
+}
+
+static void test_bad_input()
+{
+  std::vector<V> none;
+
+  // larger than the message limit
+  V v;
+  v["big"].push_back(std::make_tuple(1, std::string(2 << 20, 'a')));
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  e << v;
+  Result big = run(std::string((const char*)w.data(), w.size()), 1 << 16, 64, none);
+  CHECK(big.count == 0 && big.error == MSGPACK_E_LIMIT);
+
+  Result invalid = run(std::string("\x92\x01\xc1", 3), 1, 64, none);
+  CHECK(invalid.count == 0 && invalid.error == MSGPACK_E_INVALID_DECODE);
+
+  // deeply nested size-less arrays
+  Result deep = run(std::string(1 << 19, '\xc4'), 1 << 16, 4096, none);
+  CHECK(deep.count == 0 && deep.error != MSGPACK_OK);
+}
+
+static Detached decode_throwing(Chan &c, Result &res)
+{
+  AsyncDecoder<Chan> dec(c, 4);
+  V v;
+  try
+  {
+    while (co_await (dec >> v)) ++res.count;
+  }
+  catch (Exception &e)
+  {
+    res.error = e.error();
+  }
+  res.finished = true;
+}
+
+static void test_exception()
+{
+  // thrown on the fiber, caught by the awaiting coroutine
+  Chan c;
+  c.data.assign("\x81\xa1k\x91\x92\x01\xc1", 7);
+  c.chunk = 3;
+  Result res;
+  decode_throwing(c, res);
+  while (!res.finished) c.resume();
+  CHECK(res.count == 0 && res.error == MSGPACK_E_INVALID_DECODE);
+}
+
+static Detached decode_strings(Chan &c, size_t &seen, Result &res)
+{
+  AsyncDecoder<Chan> dec(c, 16);
+  dec.set_throws(false);
+  if (co_await dec.next())
+  {
+    co_await dec.run([&seen](Decoder &d) {
+      uint32_t n = d.read_array();
+      std::string s;
+      for (uint32_t i = 0; i < n && !d.failed(); ++i)
+      {
+        d >> s;
+        if (s == std::string(100, 'a' + i % 26)) ++seen;
+      }
+    });
+  }
+  res.error = dec.error();
+  res.finished = true;
+}
+
+static void test_progress()
+{
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  e.emit_array(1000);
+  for (int i = 0; i < 1000; ++i) e << std::string(100, 'a' + i % 26);
+
+  // one value of 100 KB, decoded through 16 bytes while it arrives
+  Chan c;
+  c.data.assign((const char*)w.data(), w.size());
+  c.chunk = 64;
+  size_t seen = 0;
+  Result res;
+  decode_strings(c, seen, res);
+  while (c.pos < c.data.size() / 2) c.resume();
+  CHECK(!res.finished && seen > 400 && seen < 600);
+  while (!res.finished) c.resume();
+  CHECK(seen == 1000 && res.error == MSGPACK_OK && c.max_len == 16);
+}
+
+/*
+ * Owns its frame, to destroy it while it waits.
+ */
+struct Owned
+{
+  struct promise_type
+  {
+    Owned get_return_object() { return Owned{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  std::coroutine_handle<promise_type> h;
+};
+
+static Owned decode_one(Chan &c, size_t &count)
+{
+  AsyncDecoder<Chan> dec(c, 32);
+  V v;
+  while (co_await (dec >> v)) ++count;
+}
+
+static void test_destroy()
+{
+  V v;
+  std::vector<std::tuple<int, std::string> > &x = v["key"];
+  for (int k = 0; k < 100; ++k) x.push_back(std::make_tuple(k, std::string(200, 'y')));
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  e << v;
+
+  // destroyed in the middle of the value: what is decoded so far is freed
+  Chan c;
+  c.data.assign((const char*)w.data(), w.size());
+  c.chunk = 100;
+  size_t count = 0;
+  Owned o = decode_one(c, count);
+  while (c.pos < c.data.size() / 2) c.resume();
+  o.h.destroy();
+  CHECK(count == 0);
+}
+
+int main()
+{
+  test_decode();
+  test_bad_input();
+  test_exception();
+  test_progress();
+  test_destroy();
+  return check_result();
+}
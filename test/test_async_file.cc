@@ -0,0 +1,103 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/AsyncFile.h"
+#include "check.h"
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace MessagePack;
+
+static const char *FILENAME = "test_async_file.msgpack";
+
+template <class E>
+static void encode(E &e, const std::vector<std::string> &v)
+{
+  for (int k = 0; k < 3; ++k) e << v << (int64_t)k << 0.25 << 0.5f;
+}
+
+/*
+ * Both backends, with buffers smaller than a value and larger than the
+ * whole file. The file is compared bytewise with an in-memory encoding.
+ */
+static void test_roundtrip(AsyncIOMode mode)
+{
+  std::vector<std::string> v;
+  for (int i = 0; i < 5000; ++i) v.push_back(std::string(i % 70, 'a' + i % 26));
+  BufferedMemoryWriter ref(16);
+  Encoder re(&ref);
+  encode(re, v);
+
+  const size_t sizes[] = {13, 4096, 1 << 20};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+  {
+    size_t bs = sizes[i];
+    {
+      AsyncFileWriter w(FILENAME, bs, 3, mode);
+      Encoder e(&w);
+      encode(e, v);
+      CHECK(w.close());
+    }
+    {
+      FileReader r(FILENAME);
+      CHECK(r.remaining() == ref.size());
+      std::vector<char> buf(ref.size());
+      r.read(&buf[0], buf.size());
+      CHECK(memcmp(&buf[0], ref.data(), buf.size()) == 0);
+    }
+
+    AsyncFileReader r(FILENAME, bs, 2 + bs % 3, mode);
+    Decoder d(&r);
+    int k = 0;
+    bool same = true;
+    while (!r.at_end())
+    {
+      std::vector<std::string> x;
+      int64_t kk;
+      double f;
+      float g;
+      d >> x >> kk >> f >> g;
+      same = same && x == v && kk == k && f == 0.25 && g == 0.5f;
+      ++k;
+    }
+    CHECK(same && k == 3);
+  }
+}
+
+static void test_errors()
+{
+  {
+    // destroyed with reads in flight
+    AsyncFileReader r(FILENAME, 4096, 4);
+    Decoder d(&r);
+    d.skip_value();
+  }
+  {
+    AsyncFileReader r(FILENAME, 4096, 4, MSGPACK_AIO_AUTO, false);
+    Decoder d(&r);
+    for (int i = 0; i < 12; ++i) d.skip_value();
+    CHECK(!r.failed());
+    d.skip_value();
+    CHECK(r.error() == MSGPACK_E_EOF);
+  }
+  {
+    AsyncFileReader r("/nonexistent/file", 4096, 4, MSGPACK_AIO_AUTO, false);
+    CHECK(r.error() == MSGPACK_E_FILE && r.at_end());
+  }
+  {
+    AsyncFileWriter w("/nonexistent/dir/x", 4096, 4, MSGPACK_AIO_AUTO, false);
+    Encoder e(&w);
+    e << 1;
+    CHECK(!w.close());
+  }
+}
+
+int main()
+{
+  test_roundtrip(MSGPACK_AIO_AUTO);
+  test_roundtrip(MSGPACK_AIO_THREADS);
+  test_errors();
+  unlink(FILENAME);
+  return check_result();
+}
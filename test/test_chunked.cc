@@ -0,0 +1,78 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/ChunkedEncoder.h"
+#include "check.h"
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+using namespace MessagePack;
+
+typedef std::map<std::string, std::vector<std::vector<int> > > M;
+
+/*
+ * For every step size the pieces add up to exactly what Encoder
+ * produces in one go.
+ */
+static void test_steps()
+{
+  M m;
+  for (int i = 0; i < 50; ++i)
+  {
+    std::vector<std::vector<int> > &v = m["key" + std::to_string(i)];
+    for (int j = 0; j < i; ++j) v.push_back(std::vector<int>(j * 7, i));
+  }
+  std::vector<std::string> strs;
+  for (int i = 0; i < 300; ++i) strs.push_back(std::string(i * 13, 'a' + i % 26));
+  std::unordered_map<int, std::tuple<int, std::string> > um;
+  for (int i = 0; i < 100; ++i) um[i] = std::make_tuple(i, std::string(i, 'x'));
+  std::set<int> st;
+  st.insert(1); st.insert(2); st.insert(3);
+  std::vector<int> empty;
+
+  BufferedMemoryWriter ref(16);
+  Encoder e(&ref);
+  e << m << strs << um << st << empty << 42;
+  std::string want((const char*)ref.data(), ref.size());
+
+  const size_t sizes[] = {1, 2, 3, 7, 64, 100, 4096, 1 << 20};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+  {
+    size_t n = sizes[i];
+    ChunkedEncoder c;
+    c.encode(m);
+    c.encode(strs);
+    c.encode(um);
+    c.encode(st);
+    c.encode(empty);
+    c.encode(42);
+
+    std::string got;
+    std::vector<char> buf(n);
+    bool bounded = true;
+    while (!c.done())
+    {
+      size_t k = c.step(&buf[0], n);
+      // only the last step may be short
+      bounded = bounded && k <= n && (k == n || c.done());
+      got.append(&buf[0], k);
+    }
+    CHECK(bounded);
+    CHECK(got == want);
+  }
+
+  MemoryReader r(want.data(), want.size());
+  Decoder d(&r);
+  M m2;
+  d >> m2;
+  CHECK(m2 == m);
+}
+
+int main()
+{
+  test_steps();
+  return check_result();
+}
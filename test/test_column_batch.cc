@@ -0,0 +1,76 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/ColumnBatch.h"
+#include "check.h"
+#include <string>
+
+using namespace MessagePack;
+
+/*
+ * Maps with fields in varying order, unknown (nested) fields, missing
+ * and nil values, followed by array records matched by position.
+ */
+static void test_batches()
+{
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  for (int i = 0; i < 10; ++i)
+  {
+    enc.emit_map(i % 3 == 0 ? 3 : 4);
+    enc << "ts" << (int64_t)(1000 + i);
+    enc << "junk"; enc.emit_array(2); enc << "x"; enc.emit_map(1); enc << 1 << 2;
+    enc << "host" << std::string("h") + std::to_string(i);
+    if (i % 3)
+    {
+      enc << "v";
+      if (i % 2) enc.emit_nil(); else enc << 1.5 * i;
+    }
+  }
+  for (int i = 0; i < 3; ++i)
+  {
+    enc.emit_array(4);
+    enc << (int64_t)(2000 + i) << "arr" << 2.0 << true;
+  }
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  ColumnBatchDecoder b;
+  Column<int64_t> &ts = b.add_column<int64_t>("ts");
+  Column<std::string> &host = b.add_column<std::string>("host");
+  Column<double> &v = b.add_column<double>("v");
+
+  size_t total = 0;
+  size_t n;
+  while ((n = b.decode(dec, 4)) > 0)
+  {
+    CHECK(n <= 4);
+    CHECK(b.rows() == n && ts.rows() == n);
+    for (size_t i = 0; i < n; ++i, ++total)
+    {
+      if (total < 10)
+      {
+        int k = (int)total;
+        CHECK(ts[i] == 1000 + k);
+        CHECK(host[i] == std::string("h") + std::to_string(k));
+        if (k % 3 == 0 || k % 2)
+          CHECK(v.is_null(i));
+        else
+          CHECK(!v.is_null(i) && v[i] == 1.5 * k);
+      }
+      else
+      {
+        CHECK(ts[i] == 2000 + (int64_t)(total - 10));
+        CHECK(host[i] == "arr");
+        CHECK(!v.is_null(i) && v[i] == 2.0);
+      }
+    }
+  }
+  CHECK(total == 13);
+  CHECK(r.at_end());
+}
+
+int main()
+{
+  test_batches();
+  return check_result();
+}
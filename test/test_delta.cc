@@ -0,0 +1,89 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "check.h"
+#include <stdlib.h>
+#include <vector>
+
+using namespace MessagePack;
+
+template <class T>
+static bool roundtrip(const std::vector<T> &v, size_t *sz = NULL)
+{
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << delta_encoded(v) << 7;
+  if (sz) *sz = w.size();
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  std::vector<T> out;
+  int seven;
+  dec >> delta_encoded(out) >> seven;
+  return out == v && seven == 7 && r.at_end();
+}
+
+static void test_roundtrip()
+{
+  srand(1);
+  std::vector<uint64_t> ts;
+  uint64_t t = 1600000000000ull;
+  for (int i = 0; i < 10000; ++i) { t += rand() % 1000; ts.push_back(t); }
+  size_t sz;
+  CHECK(roundtrip(ts, &sz));
+  // a timestamp takes 9 bytes as a plain uint64
+  CHECK(sz < ts.size() * 3);
+
+  std::vector<int64_t> rnd;
+  for (int i = 0; i < 1000; ++i) rnd.push_back(((int64_t)rand() << 33) ^ ((int64_t)rand() << 2) ^ rand());
+  CHECK(roundtrip(rnd));
+
+  std::vector<int32_t> s;
+  s.push_back(-5); s.push_back(7); s.push_back(-2147483647-1); s.push_back(2147483647); s.push_back(0);
+  CHECK(roundtrip(s));
+  CHECK(roundtrip(std::vector<uint8_t>()));
+  CHECK(roundtrip(std::vector<uint16_t>(1000, 5)));
+}
+
+/*
+ * A plain array decodes as well; skip_value() steps over the extension.
+ */
+static void test_plain_array_and_skip()
+{
+  std::vector<int32_t> s;
+  s.push_back(-5); s.push_back(7); s.push_back(100000);
+
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << s << delta_encoded(s);
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  std::vector<int32_t> out;
+  dec >> delta_encoded(out);
+  CHECK(out == s);
+  dec.skip_value();
+  CHECK(r.at_end());
+}
+
+static void test_out_of_range()
+{
+  std::vector<int64_t> v;
+  v.push_back(1); v.push_back(1000000);
+
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << delta_encoded(v);
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  std::vector<int16_t> out;
+  CHECK_THROWS(dec >> delta_encoded(out), InvalidDecodeException);
+}
+
+int main()
+{
+  test_roundtrip();
+  test_plain_array_and_skip();
+  test_out_of_range();
+  return check_result();
+}
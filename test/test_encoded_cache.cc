@@ -0,0 +1,128 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/EncodedCache.h"
+#include "MessagePack/ChunkedEncoder.h"
+#include "check.h"
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MessagePack;
+
+typedef std::map<std::string, std::vector<int> > Data;
+
+static Data make_data()
+{
+  Data d;
+  for (int i = 0; i < 50; ++i) d["k" + std::to_string(i)] = std::vector<int>(i, i);
+  return d;
+}
+
+/*
+ * Pre-encoded values are spliced in as is.
+ */
+static void test_splice()
+{
+  Data data = make_data();
+  EncodedValue ev = encode_value(data);
+  CHECK(ev.size() == measure(data));
+
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << ev << EncodedValue() << ev;
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  Data a, b;
+  dec >> a;
+  dec.read_nil();
+  dec >> b;
+  CHECK(a == data && b == data && r.at_end());
+
+  std::vector<EncodedValue> list(3, ev);
+  ChunkedEncoder ce;
+  ce.encode(list);
+  std::string out;
+  char buf[17];
+  while (!ce.done())
+  {
+    size_t n = ce.step(buf, sizeof(buf));
+    out.append(buf, n);
+  }
+  MemoryReader r2(out.data(), out.size());
+  Decoder d2(&r2);
+  std::vector<Data> back;
+  d2 >> back;
+  CHECK(back.size() == 3 && back[2] == data && r2.at_end());
+}
+
+/*
+ * Entries are reused while the version is unchanged.
+ */
+static void test_versions()
+{
+  Data data = make_data();
+  EncodedCache cache(1 << 20);
+  EncodedValue c1 = cache.get(data, 1);
+  EncodedValue c2 = cache.get(data, 1);
+  CHECK(c1.data() == c2.data());
+  CHECK(cache.hits() == 1 && cache.misses() == 1);
+
+  data["new"] = std::vector<int>(1, 1);
+  EncodedValue c3 = cache.get(data, 2);
+  CHECK(c3.data() != c1.data());
+  CHECK(cache.size() == 1 && cache.bytes() == c3.size());
+  // handed out values stay valid
+  CHECK(c1.size() == measure(make_data()));
+
+  cache.erase(&data);
+  CHECK(cache.size() == 0 && cache.bytes() == 0);
+}
+
+static void test_eviction()
+{
+  Data data = make_data();
+  size_t sz = encode_value(data).size();
+
+  BasicEncodedCache<int> small(sz * 2 + 10);
+  for (int i = 0; i < 10; ++i) small.get(i, 0, data);
+  CHECK(small.size() == 2 && small.bytes() <= sz * 2 + 10);
+
+  EncodedValue big = small.get(99, 0, std::string(5000, 'x'));
+  CHECK(big.size() == 5003);
+  CHECK(small.size() == 1 && small.bytes() == 5003);
+
+  // larger than the whole cache: encoded but not kept
+  BasicEncodedCache<int> tiny(100);
+  CHECK(tiny.get(1, 0, data).size() == sz);
+  CHECK(tiny.size() == 0);
+}
+
+static void test_threads()
+{
+  Data data = make_data();
+  size_t sz = encode_value(data).size();
+  EncodedCache shared;
+  std::vector<std::thread> threads;
+  bool ok[4];
+  for (int t = 0; t < 4; ++t)
+  {
+    ok[t] = true;
+    threads.push_back(std::thread([&shared, &data, &ok, sz, t]() {
+      for (int i = 0; i < 1000; ++i) ok[t] = ok[t] && shared.get(data, 1).size() == sz;
+    }));
+  }
+  for (int t = 0; t < 4; ++t) threads[t].join();
+  CHECK(ok[0] && ok[1] && ok[2] && ok[3]);
+  CHECK(shared.size() == 1);
+}
+
+int main()
+{
+  test_splice();
+  test_versions();
+  test_eviction();
+  test_threads();
+  return check_result();
+}
@@ -0,0 +1,162 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/Fields.h"
+#include "check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Also built with -fno-exceptions (test_error_codes_noexc).
+ */
+#ifndef MSGPACK_USE_EXCEPTIONS
+namespace boost
+{
+  void throw_exception(std::exception const &) { abort(); }
+  void throw_exception(std::exception const &, boost::source_location const &) { abort(); }
+}
+#endif
+
+using namespace MessagePack;
+
+struct S
+{
+  int a;
+  std::string b;
+  MSGPACK_FIELDS(a, b)
+};
+
+/*
+ * Every truncation of valid input reports MSGPACK_E_EOF.
+ */
+static void test_truncated()
+{
+  std::vector<std::string> v;
+  v.push_back("a"); v.push_back("bb"); v.push_back("ccc");
+  std::map<std::string, int> m;
+  m["x"] = 1;
+  S s0;
+  s0.a = 3;
+  s0.b = "q";
+
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  CHECK(try_encode(enc, v) == MSGPACK_OK);
+  CHECK(try_encode(enc, m) == MSGPACK_OK);
+  CHECK(try_encode(enc, s0) == MSGPACK_OK);
+
+  for (size_t cut = 0; cut <= w.size(); ++cut)
+  {
+    MemoryReader r((const char*)w.data(), cut);
+    Decoder dec(&r);
+    std::vector<std::string> v2;
+    std::map<std::string, int> m2;
+    S s;
+    Error e = try_decode(dec, v2);
+    if (e == MSGPACK_OK) e = try_decode(dec, m2);
+    if (e == MSGPACK_OK) e = try_decode(dec, s);
+    CHECK(e == (cut == w.size() ? MSGPACK_OK : MSGPACK_E_EOF));
+    if (cut == w.size()) CHECK(v2 == v && m2 == m && s.a == 3 && s.b == "q");
+  }
+}
+
+static void test_wrong_type()
+{
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << "str";
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  std::vector<int> wrong;
+  CHECK(try_decode(dec, wrong) == MSGPACK_E_INVALID_DECODE);
+  CHECK(strlen(dec.get_reader()->error_message()) > 0);
+
+  MemoryReader r2("\xcd\x01", 2);
+  Decoder d2(&r2);
+  uint64_t u;
+  CHECK(d2.try_read_uint(u) == MSGPACK_E_EOF);
+
+  FileReader fr("/nonexistent/file", false);
+  CHECK(fr.error() == MSGPACK_E_FILE);
+}
+
+/*
+ * A char* string is bounded by the input before anything is allocated
+ * and left NULL on failure.
+ */
+static void test_c_string()
+{
+  {
+    MemoryReader r("\xdb\xff\xff\xff\xff", 5);
+    Decoder d(&r);
+    char *s = (char*)1;
+    CHECK(try_decode(d, s) == MSGPACK_E_EOF && s == NULL);
+  }
+  {
+    MemoryReader r("\xa5hel", 4);
+    Decoder d(&r);
+    char *s = (char*)1;
+    CHECK(try_decode(d, s) == MSGPACK_E_EOF && s == NULL);
+  }
+  {
+    MemoryReader r("\xa3" "abc", 4);
+    Decoder d(&r);
+    char *s = NULL;
+    CHECK(try_decode(d, s) == MSGPACK_OK && s != NULL && strcmp(s, "abc") == 0);
+    free(s);
+  }
+}
+
+/*
+ * In recording mode a failed read leaves the reader at the end.
+ */
+static void test_recording_position()
+{
+  MemoryReader r("\xa5hel", 4);
+  r.set_throws(false);
+  char b[9];
+  r.read(b, 9);
+  CHECK(r.failed() && r.error() == MSGPACK_E_EOF);
+  CHECK(r.at_end());
+  r.clear_error();
+  CHECK(!r.failed());
+}
+
+#ifdef MSGPACK_USE_EXCEPTIONS
+/*
+ * The throwing mode raises the matching exception; a caught EOF leaves
+ * the reader where it was.
+ */
+static void test_exceptions()
+{
+  MemoryReader r("\xcd\x01", 2);
+  Decoder d(&r);
+  CHECK_THROWS(d.read_uint(), EofException);
+
+  MemoryReader r2("\xa5hel", 4);
+  Decoder d2(&r2);
+  char *s = NULL;
+  CHECK_THROWS(d2 >> s, EofException);
+  CHECK(s == NULL);
+
+  MemoryReader r3("\xa5hel", 4);
+  char b[9];
+  CHECK_THROWS(r3.read(b, 9), EofException);
+  CHECK(r3.remaining() == 4);
+}
+#endif
+
+int main()
+{
+  test_truncated();
+  test_wrong_type();
+  test_c_string();
+  test_recording_position();
+#ifdef MSGPACK_USE_EXCEPTIONS
+  test_exceptions();
+#endif
+  return check_result();
+}
@@ -0,0 +1,137 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/Fields.h"
+#include "check.h"
+#include <string>
+#include <vector>
+
+using namespace MessagePack;
+
+struct Inner
+{
+  int32_t a;
+  std::vector<std::string> tags;
+  MSGPACK_FIELDS_ARRAY(a, tags)
+};
+
+struct Req
+{
+  uint64_t id;
+  std::string name;
+  double score;
+  Inner inner;
+  int n;
+  MSGPACK_FIELDS(id, name, score, inner, n)
+};
+
+// Fewer fields in a different order
+struct ReqV2
+{
+  std::string name;
+  int n;
+  int extra;
+  MSGPACK_FIELDS(n, name, extra)
+};
+
+static Req make_req()
+{
+  Req r;
+  r.id = 77;
+  r.name = "bob";
+  r.score = 1.5;
+  r.inner.a = -3;
+  r.inner.tags.push_back("x");
+  r.inner.tags.push_back("y");
+  r.n = 9;
+  return r;
+}
+
+static bool same(const Req &a, const Req &b)
+{
+  return a.id == b.id && a.name == b.name && a.score == b.score &&
+    a.inner.a == b.inner.a && a.inner.tags == b.inner.tags && a.n == b.n;
+}
+
+template <class E>
+static void test_roundtrip()
+{
+  Req r = make_req();
+  std::vector<Req> rs(3, r);
+
+  BufferedMemoryWriter w(16);
+  E enc(&w);
+  enc << r << as_array(r) << rs;
+
+  MemoryReader rd((const char*)w.data(), w.size());
+  Decoder dec(&rd);
+  Req r1, r2;
+  std::vector<Req> rs2;
+  dec >> r1 >> as_array(r2) >> rs2;
+  CHECK(same(r, r1));
+  CHECK(same(r, r2));
+  CHECK(rs2.size() == 3 && same(r, rs2[2]));
+  CHECK(rd.at_end());
+}
+
+/*
+ * Unknown keys are skipped and missing fields keep their value.
+ */
+static void test_schema_evolution()
+{
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << make_req();
+  enc.emit_array(3); enc << 5; enc.emit_array(1); enc << "t"; enc << "surplus";
+
+  MemoryReader rd((const char*)w.data(), w.size());
+  Decoder dec(&rd);
+  ReqV2 v2;
+  v2.extra = 42;
+  dec >> v2;
+  CHECK(v2.name == "bob" && v2.n == 9 && v2.extra == 42);
+
+  Inner in;
+  dec >> in;
+  CHECK(in.a == 5 && in.tags.size() == 1 && in.tags[0] == "t");
+  CHECK(rd.at_end());
+}
+
+/*
+ * Decoding stops at the end of truncated input, whatever count the
+ * header declares (a loop over 2^32 entries would not finish here).
+ */
+static void test_truncated_header()
+{
+  {
+    MemoryReader rd("\xdf\xff\xff\xff\xff\xa1n\x01", 8);
+    Decoder dec(&rd);
+    ReqV2 v2;
+    v2.n = 0;
+    CHECK(try_decode(dec, v2) == MSGPACK_E_EOF);
+    CHECK(v2.n == 1);
+  }
+  {
+    MemoryReader rd("\xdd\xff\xff\xff\xff\x05", 6);
+    Decoder dec(&rd);
+    Inner in;
+    in.a = 0;
+    CHECK(try_decode(dec, in) == MSGPACK_E_EOF);
+    CHECK(in.a == 5);
+  }
+  {
+    // surplus elements of a truncated array
+    MemoryReader rd("\xdd\xff\xff\xff\xff\x05\x90", 7);
+    Decoder dec(&rd);
+    Inner in;
+    CHECK(try_decode(dec, in) == MSGPACK_E_EOF);
+  }
+}
+
+int main()
+{
+  test_roundtrip<Encoder>();
+  test_roundtrip<FixedWidthEncoder>();
+  test_schema_evolution();
+  test_truncated_header();
+  return check_result();
+}
@@ -0,0 +1,270 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/Filter.h"
+#include "check.h"
+#include <stdio.h>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace MessagePack;
+
+struct Rec
+{
+  std::string level;
+  int64_t lat;
+  std::string path;
+  double score;
+  bool has_req;
+  std::string blob;
+};
+
+static void put(Encoder &enc, const Rec &r, bool open)
+{
+  size_t m = 0;
+  uint32_t n = r.has_req ? 5 : 4;
+  if (open) m = enc.begin_map(); else enc.emit_map(n);
+  enc << "level" << r.level << "latency_ms" << r.lat << "score" << r.score;
+  if (r.has_req)
+  {
+    enc << "req";
+    enc.emit_map(2);
+    enc << "path" << r.path << "n" << std::vector<int>(3, 1);
+  }
+  enc << "blob" << r.blob;
+  if (open) enc.end_map(m, n);
+}
+
+static bool wanted(const Rec &r)
+{
+  return r.level == "error" && r.lat >= 100 && r.lat <= 5000 && r.has_req &&
+    r.path.compare(0, 5, "/api/") == 0 && r.score >= 0.5;
+}
+
+struct Input
+{
+  std::vector<Rec> recs;
+  BufferedMemoryWriter data;
+  std::vector<size_t> offsets;   // of every record, plus the end
+  std::vector<size_t> matches;   // indices of the wanted records
+  std::string expect;            // the wanted records
+
+  Input() : data(64)
+  {
+    std::mt19937 g(7);
+    const char *levels[] = {"info", "warn", "error", "debug"};
+    const char *paths[] = {"/api/x", "/static/y", "/api", "/api/zzzz"};
+    for (int i = 0; i < 40000; ++i)
+    {
+      Rec r;
+      r.level = levels[g() % 4];
+      r.lat = (int64_t)(g() % 8000) - 100;
+      r.path = paths[g() % 4];
+      r.score = (g() % 100) / 100.0;
+      r.has_req = g() % 5 != 0;
+      r.blob = std::string(g() % 300, 'a' + g() % 26);
+      recs.push_back(r);
+    }
+
+    Encoder enc(&data);
+    for (size_t i = 0; i < recs.size(); ++i)
+    {
+      offsets.push_back(data.size());
+      put(enc, recs[i], i % 7 == 0);
+      if (wanted(recs[i])) matches.push_back(i);
+    }
+    offsets.push_back(data.size());
+    for (size_t j = 0; j < matches.size(); ++j)
+    {
+      size_t i = matches[j];
+      expect.append((const char*)data.data() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+  }
+};
+
+static void add_conditions(Filter &f)
+{
+  f.equals("level", "error");
+  f.range("latency_ms", 100, 5000);
+  f.prefix("req.path", "/api/");
+  f.range("score", 0.5, 1e9);
+}
+
+static std::string str(const BufferedMemoryWriter &w)
+{
+  return std::string((const char*)w.data(), w.size());
+}
+
+/*
+ * Same output for any number of threads and any Reader.
+ */
+static void test_readers(const Input &in)
+{
+  Filter f;
+  add_conditions(f);
+  CHECK(!in.matches.empty());
+
+  const unsigned threads[] = {1, 2, 3, 8, 13};
+  for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i)
+  {
+    BufferedMemoryWriter out(64);
+    MemoryReader r((const char*)in.data.data(), in.data.size());
+    CHECK(f.filter(r, out, threads[i]) == in.matches.size());
+    CHECK(str(out) == in.expect);
+    CHECK(r.at_end());
+  }
+  {
+    std::vector<struct iovec> segs;
+    const char *p = (const char*)in.data.data();
+    size_t left = in.data.size();
+    while (left)
+    {
+      size_t n = left < 1000 ? left : 1000;
+      struct iovec v;
+      v.iov_base = (void*)p;
+      v.iov_len = n;
+      segs.push_back(v);
+      p += n;
+      left -= n;
+    }
+    SegmentedReader r(&segs[0], segs.size());
+    BufferedMemoryWriter out(64);
+    CHECK(f.filter(r, out, 4) == in.matches.size());
+    CHECK(str(out) == in.expect);
+  }
+  {
+    FILE *fp = tmpfile();
+    fwrite(in.data.data(), 1, in.data.size(), fp);
+    rewind(fp);
+    FileReader r(fp, in.data.size());
+    BufferedMemoryWriter out(64);
+    CHECK(f.filter(r, out) == in.matches.size());
+    CHECK(str(out) == in.expect);
+    fclose(fp);
+  }
+}
+
+static void test_conditions(const Input &in)
+{
+  Filter f;
+  f.equals("latency_ms", (int64_t)in.recs[5].lat);
+  size_t count = 0;
+  for (size_t i = 0; i < in.recs.size(); ++i) count += in.recs[i].lat == in.recs[5].lat;
+  CountingWriter out;
+  MemoryReader r((const char*)in.data.data(), in.data.size());
+  CHECK(f.filter(r, out, 8) == count);
+
+  // a literal that never occurs
+  Filter none;
+  none.equals("level", "fatal");
+  MemoryReader r2((const char*)in.data.data(), in.data.size());
+  CHECK(none.filter(r2, out, 4) == 0);
+  CHECK(r2.at_end() && !r2.failed());
+}
+
+/*
+ * Invalid data is reported at the same record for any number of threads.
+ */
+static void test_invalid(const Input &in)
+{
+  std::string bad = str(in.data);
+  size_t at = in.offsets[30000];
+  bad[at] = (char)0xc1;
+  size_t before = 0;
+  for (size_t j = 0; j < in.matches.size(); ++j) before += in.matches[j] < 30000;
+
+  const unsigned threads[] = {1, 5};
+  for (size_t i = 0; i < 2; ++i)
+  {
+    BufferedMemoryWriter out(64);
+    MemoryReader r(bad.data(), bad.size());
+    r.set_throws(false);
+    Filter f;
+    add_conditions(f);
+    CHECK(f.filter(r, out, threads[i]) == before);
+    CHECK(r.error() == MSGPACK_E_INVALID_DECODE);
+    CHECK(r.remaining() == bad.size() - at);
+  }
+
+  // a record cut short; it still holds the literal, so it is read
+  Filter f;
+  add_conditions(f);
+  CountingWriter out;
+  MemoryReader r((const char*)in.data.data(), in.offsets[101] - 1);
+  r.set_throws(false);
+  f.filter(r, out, 1);
+  CHECK(r.error() == MSGPACK_E_EOF);
+}
+
+/*
+ * Strings full of size-less headers look like deep nesting to a thread
+ * guessing a record start; deep nesting of real records is an error.
+ * Neither may exhaust the stack.
+ */
+static void test_deep_nesting()
+{
+  BufferedMemoryWriter w(1024);
+  Encoder e(&w);
+  for (int i = 0; i < 2; ++i)
+  {
+    e.emit_map(2);
+    e << "a" << "b" << "s" << std::string(3 << 20, '\xc4');
+  }
+  for (int i = 0; i < 3; ++i)
+  {
+    e.emit_map(2);
+    e << "a" << "c" << "s" << std::string(1 << 20, '\xc6');
+  }
+
+  const unsigned threads[] = {1, 2, 4, 8};
+  for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i)
+  {
+    Filter f;
+    f.equals("a", "b");
+    MemoryReader r((const char*)w.data(), w.size());
+    CountingWriter out;
+    CHECK(f.filter(r, out, threads[i]) == 2);
+    CHECK(!r.failed());
+  }
+
+  std::string deep("\x82\xa1" "a\xa1" "b\xa1s");
+  deep.append(2 << 20, '\xc4');
+  for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i)
+  {
+    Filter f;
+    f.equals("a", "b");
+    MemoryReader r(deep.data(), deep.size());
+    r.set_throws(false);
+    CountingWriter out;
+    CHECK(f.filter(r, out, threads[i]) == 0);
+    CHECK(r.failed());
+  }
+}
+
+static void test_too_many_conditions()
+{
+  BufferedMemoryWriter w(64);
+  Encoder e(&w);
+  e.emit_map(1);
+  e << "a" << 1;
+
+  Filter f;
+  for (int i = 0; i < 65; ++i) f.range("a", i, 100);
+  MemoryReader r((const char*)w.data(), w.size());
+  r.set_throws(false);
+  CountingWriter out;
+  CHECK(f.filter(r, out) == 0);
+  CHECK(r.error() == MSGPACK_E_LIMIT);
+  CHECK(!f.match((const char*)w.data(), w.size()));
+}
+
+int main()
+{
+  Input in;
+  test_readers(in);
+  test_conditions(in);
+  test_invalid(in);
+  test_deep_nesting();
+  test_too_many_conditions();
+  return check_result();
+}
@@ -0,0 +1,130 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/Fields.h"
+#include "check.h"
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace MessagePack;
+
+struct Order
+{
+  uint64_t id;
+  int32_t qty;
+  double px;
+  float fx;
+  std::string sym;
+  MSGPACK_FIELDS(id, qty, px, fx, sym)
+};
+
+static Order make_order()
+{
+  Order o;
+  o.id = 42;
+  o.qty = -7;
+  o.px = 101.25;
+  o.fx = 0.5f;
+  o.sym = "ACME";
+  return o;
+}
+
+static void test_encode()
+{
+  Order o = make_order();
+  char buf[256];
+  FixedBufferWriter w(buf, sizeof(buf));
+  FixedBufferEncoder e(&w);
+  e << o;
+  CHECK(w.size() == measure(o));
+  CHECK(!w.overflowed());
+
+  // same bytes as through the virtual Writer interface
+  BufferedMemoryWriter bw(16);
+  Encoder be(&bw);
+  be << o;
+  CHECK(bw.size() == w.size() && memcmp(bw.data(), buf, w.size()) == 0);
+
+  MemoryReader r(buf, w.size());
+  Decoder d(&r);
+  Order q;
+  d >> q;
+  CHECK(q.id == 42 && q.qty == -7 && q.px == 101.25 && q.fx == 0.5f && q.sym == "ACME");
+
+  FixedBufferWriter fw(buf, sizeof(buf));
+  BasicEncoder<FixedWidthProfile, FixedBufferWriter> fe(&fw);
+  fe << o;
+  CHECK(fw.size() == measure<FixedWidthProfile>(o));
+}
+
+static void test_full()
+{
+  Order o = make_order();
+  char small[8];
+  {
+    FixedBufferWriter fw(small, sizeof(small));
+    FixedBufferEncoder fe(&fw);
+    CHECK_THROWS(fe << o, BufferFullException);
+  }
+  {
+    FixedBufferWriter fw(small, sizeof(small));
+    FixedBufferEncoder fe(&fw);
+    CHECK(try_encode(fe, o) == MSGPACK_E_BUFFER_FULL);
+    CHECK(fw.size() <= sizeof(small));
+  }
+}
+
+/*
+ * With MSGPACK_OVERFLOW_SPILL the rest goes to a heap buffer.
+ */
+static void test_spill()
+{
+  Order o = make_order();
+  BufferedMemoryWriter bw(16);
+  Encoder be(&bw);
+  be << o;
+
+  char small[8];
+  FixedBufferWriter fw(small, sizeof(small), MSGPACK_OVERFLOW_SPILL);
+  FixedBufferEncoder fe(&fw);
+  fe << o;
+  CHECK(fw.overflowed());
+  CHECK(fw.size() == bw.size());
+  std::string all(small, sizeof(small));
+  all.append(fw.overflow_data(), fw.overflow_size());
+  CHECK(all.size() == bw.size() && memcmp(all.data(), bw.data(), bw.size()) == 0);
+}
+
+static void test_serializers()
+{
+  std::vector<int64_t> v;
+  v.push_back(1); v.push_back(2); v.push_back(3); v.push_back(100);
+  std::map<std::string, int> m;
+  m["a"] = 1;
+
+  char buf[256];
+  FixedBufferWriter fw(buf, sizeof(buf));
+  FixedBufferEncoder fe(&fw);
+  fe << delta_encoded(v) << std::make_tuple(1, std::string("x")) << m;
+
+  MemoryReader r(buf, fw.size());
+  Decoder d(&r);
+  std::vector<int64_t> x;
+  std::tuple<int, std::string> t;
+  std::map<std::string, int> m2;
+  d >> delta_encoded(x) >> t >> m2;
+  CHECK(x == v);
+  CHECK(std::get<1>(t) == "x");
+  CHECK(m2 == m);
+  CHECK(r.at_end());
+}
+
+int main()
+{
+  test_encode();
+  test_full();
+  test_spill();
+  test_serializers();
+  return check_result();
+}
@@ -0,0 +1,72 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "check.h"
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace MessagePack;
+
+template <class E>
+static void test_roundtrip()
+{
+  BufferedMemoryWriter w(16);
+  E enc(&w);
+
+  std::vector<int32_t> v;
+  v.push_back(1); v.push_back(-5); v.push_back(300); v.push_back(-70000);
+  std::map<std::string, uint32_t> m;
+  m["a"] = 1; m["bb"] = 70000;
+
+  enc << v << m << "lit" << (uint8_t)200 << (int8_t)-100 << 1.5;
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  std::vector<int32_t> v2;
+  std::map<std::string, uint32_t> m2;
+  std::string s;
+  uint8_t u8;
+  int8_t i8;
+  double d;
+  dec >> v2 >> m2 >> s >> u8 >> i8 >> d;
+
+  CHECK(v == v2);
+  CHECK(m == m2);
+  CHECK(s == "lit");
+  CHECK(u8 == 200);
+  CHECK(i8 == -100);
+  CHECK(d == 1.5);
+  CHECK(r.at_end());
+}
+
+/*
+ * The fixed-width form depends on the C++ type only, never on the value.
+ */
+static void test_fixed_layout()
+{
+  BufferedMemoryWriter w(16);
+  FixedWidthEncoder enc(&w);
+  enc << (int32_t)1 << (uint16_t)2 << (int64_t)-1;
+
+  const unsigned char expect[] = {
+    0xd2, 0, 0, 0, 1,
+    0xcd, 0, 2,
+    0xd3, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+  };
+  CHECK(w.size() == sizeof(expect));
+  CHECK(memcmp(w.data(), expect, sizeof(expect)) == 0);
+
+  BufferedMemoryWriter c(16);
+  Encoder compact(&c);
+  compact << (int32_t)1 << (uint16_t)2 << (int64_t)-1;
+  CHECK(c.size() < w.size());
+}
+
+int main()
+{
+  test_roundtrip<Encoder>();
+  test_roundtrip<FixedWidthEncoder>();
+  test_fixed_layout();
+  return check_result();
+}
@@ -0,0 +1,75 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "check.h"
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace MessagePack;
+
+static void test_flat_containers()
+{
+  boost::container::flat_map<std::string, int> fm;
+  fm["b"] = 2; fm["a"] = 1; fm["c"] = 3;
+  std::unordered_map<int, int> um;
+  for (int i = 0; i < 50; ++i) um[i * 7 % 50] = i;
+  boost::container::flat_set<int> fs;
+  fs.insert(5); fs.insert(1); fs.insert(3);
+
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << fm << um << fs;
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  boost::container::flat_map<std::string, int> fm2;
+  boost::container::flat_map<int, int> fm3;
+  boost::container::flat_set<int> fs2;
+  dec >> fm2 >> fm3 >> fs2;
+
+  CHECK(fm2 == fm);
+  // unsorted input is sorted once
+  CHECK(fm3.size() == 50);
+  bool same = true;
+  for (std::unordered_map<int, int>::const_iterator it = um.begin(); it != um.end(); ++it)
+    same = same && fm3.find(it->first) != fm3.end() && fm3.find(it->first)->second == it->second;
+  CHECK(same);
+  CHECK(fs2 == fs);
+  CHECK(r.at_end());
+}
+
+/*
+ * A vector of pairs wrapped with flat_map_of; of equal keys the last
+ * one wins.
+ */
+static void test_flat_map_of()
+{
+  std::vector<std::pair<int, std::string> > vp;
+  vp.push_back(std::make_pair(3, std::string("c")));
+  vp.push_back(std::make_pair(1, std::string("a")));
+  vp.push_back(std::make_pair(3, std::string("d")));
+  std::map<int, std::string> m;
+  m[2] = "x"; m[1] = "y";
+
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << flat_map_of(vp) << m;
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  std::vector<std::pair<int, std::string> > vp2, vp3;
+  dec >> flat_map_of(vp2) >> flat_map_of(vp3);
+
+  CHECK(vp2.size() == 2 && vp2[0].second == "a" && vp2[1].second == "d");
+  CHECK(vp3.size() == 2 && vp3[0].first == 1 && vp3[1].second == "x");
+  CHECK(r.at_end());
+}
+
+int main()
+{
+  test_flat_containers();
+  test_flat_map_of();
+  return check_result();
+}
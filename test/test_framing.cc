@@ -0,0 +1,122 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/Framing.h"
+#include "check.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <tuple>
+
+using namespace MessagePack;
+
+/*
+ * Small frames coalesced into batches, with a frame larger than the
+ * batch now and then, written by another thread.
+ */
+static void transfer(int wfd, int rfd, bool nonblock)
+{
+  if (nonblock)
+  {
+    fcntl(wfd, F_SETFL, O_NONBLOCK);
+    fcntl(rfd, F_SETFL, O_NONBLOCK);
+  }
+  const int N = 20000;
+  const std::string big(100000, 'B');
+
+  std::thread writer([&]() {
+    FrameWriter out(wfd, 16 << 10);
+    BasicEncoder<CompactProfile, FrameWriter> enc(&out);
+    for (int i = 0; i < N; ++i)
+    {
+      if (i % 1000 == 7)
+      {
+        out.write_frame(big.data(), big.size());
+        continue;
+      }
+      out.begin_frame();
+      enc << std::make_tuple(i, std::string(i % 50, 'x'), i * 0.5f);
+      out.end_frame();
+    }
+    out.flush();
+    close(wfd);
+  });
+
+  FrameReader in(rfd, 4096, 1 << 20);
+  const char *data;
+  size_t len;
+  int i = 0;
+  bool ok = true;
+  while (in.next(data, len))
+  {
+    if (i % 1000 == 7)
+    {
+      ok = ok && len == big.size() && memcmp(data, big.data(), len) == 0;
+    }
+    else
+    {
+      MemoryReader r(data, len);
+      Decoder dec(&r);
+      std::tuple<int, std::string, float> v;
+      dec >> v;
+      ok = ok && std::get<0>(v) == i && std::get<1>(v).size() == (size_t)(i % 50) &&
+        std::get<2>(v) == i * 0.5f && r.at_end();
+    }
+    ++i;
+  }
+  CHECK(ok);
+  CHECK(!in.failed());
+  CHECK(i == N);
+
+  writer.join();
+  close(rfd);
+}
+
+static void test_transports()
+{
+  int sv[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  transfer(sv[0], sv[1], false);
+
+  int p[2];
+  CHECK(pipe(p) == 0);
+  transfer(p[1], p[0], false);
+
+  CHECK(pipe(p) == 0);
+  transfer(p[1], p[0], true);
+}
+
+static Error read_bad(const char *bytes, size_t n, size_t max_frame)
+{
+  int p[2];
+  if (pipe(p) != 0) return MSGPACK_E_FILE;
+  ssize_t w = write(p[1], bytes, n);
+  close(p[1]);
+  FrameReader in(p[0], 64, max_frame);
+  in.set_throws(false);
+  const char *data;
+  size_t len;
+  bool got = in.next(data, len);
+  Error e = in.error();
+  close(p[0]);
+  return w == (ssize_t)n && !got ? e : MSGPACK_OK;
+}
+
+static void test_bad_frames()
+{
+  // truncated frame
+  CHECK(read_bad("\0\0\0\x05\x01\x02", 6, 1 << 20) == MSGPACK_E_EOF);
+  // truncated length prefix
+  CHECK(read_bad("\0\0", 2, 1 << 20) == MSGPACK_E_EOF);
+  // larger than max_frame
+  CHECK(read_bad("\x10\0\0\0", 4, 1000) == MSGPACK_E_LIMIT);
+}
+
+int main()
+{
+  test_transports();
+  test_bad_frames();
+  return check_result();
+}
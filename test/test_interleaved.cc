@@ -0,0 +1,83 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "check.h"
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace MessagePack;
+
+typedef std::tuple<int32_t, std::string, double, uint8_t, bool> Row;
+
+template <class E>
+static void test_roundtrip()
+{
+  std::vector<Row> rows;
+  for (int i = 0; i < 1000; ++i)
+    rows.push_back(Row(i * (i % 3 == 0 ? -70 : 1), std::to_string(i), i * 0.5, (uint8_t)(i * 7), i % 2 == 0));
+
+  BufferedMemoryWriter w(16);
+  E enc(&w);
+  encode_interleaved(enc, rows);
+  encode_interleaved(enc, rows);
+  encode_interleaved(enc, rows);
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+
+  // into rows
+  std::vector<Row> rows2;
+  decode_interleaved(dec, rows2);
+  CHECK(rows == rows2);
+
+  // into separate columns
+  std::vector<int32_t> a;
+  std::vector<std::string> b;
+  std::vector<double> c;
+  std::vector<uint8_t> d;
+  std::vector<bool> e;
+  decode_interleaved(dec, std::tie(a, b, c, d, e));
+
+  // into a tuple of columns of wider types
+  std::tuple<std::vector<int64_t>, std::vector<std::string>, std::vector<double>,
+             std::vector<uint16_t>, std::vector<bool> > cols;
+  decode_interleaved(dec, cols);
+
+  CHECK(a.size() == rows.size() && std::get<0>(cols).size() == rows.size());
+  bool same = true;
+  for (size_t i = 0; i < rows.size() && i < a.size(); ++i)
+  {
+    same = same && a[i] == std::get<0>(rows[i]) && b[i] == std::get<1>(rows[i]) &&
+      c[i] == std::get<2>(rows[i]) && d[i] == std::get<3>(rows[i]) &&
+      e[i] == std::get<4>(rows[i]) && std::get<0>(cols)[i] == a[i] &&
+      std::get<3>(cols)[i] == d[i];
+  }
+  CHECK(same);
+  CHECK(r.at_end());
+}
+
+template <class E>
+static void test_out_of_range()
+{
+  std::vector<std::tuple<int32_t> > big;
+  big.push_back(std::make_tuple(1));
+  big.push_back(std::make_tuple(100000));
+
+  BufferedMemoryWriter w(16);
+  E enc(&w);
+  encode_interleaved(enc, big);
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  std::vector<std::tuple<int16_t> > small;
+  CHECK_THROWS(decode_interleaved(dec, small), InvalidDecodeException);
+}
+
+int main()
+{
+  test_roundtrip<Encoder>();
+  test_roundtrip<FixedWidthEncoder>();
+  test_out_of_range<Encoder>();
+  test_out_of_range<FixedWidthEncoder>();
+  return check_result();
+}
@@ -0,0 +1,133 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/Fields.h"
+#include "check.h"
+#include <string>
+#include <vector>
+
+using namespace MessagePack;
+
+struct P
+{
+  int32_t a;
+  std::vector<int> b;
+  MSGPACK_FIELDS(a, b)
+};
+
+typedef std::vector<std::vector<std::vector<int> > > Deep;
+
+/*
+ * Declared lengths beyond the input fail before anything is allocated.
+ */
+static void test_length_bombs()
+{
+  const char array_bomb[] = "\xdd\xff\xff\xff\xff";
+  const char str_bomb[] = "\xdb\x7f\xff\xff\xff";
+  {
+    MemoryReader r(array_bomb, 5);
+    Decoder d(&r);
+    d.set_limits(DecodeLimits());
+    std::vector<int> v;
+    CHECK_THROWS(d >> v, EofException);
+  }
+  {
+    MemoryReader r(array_bomb, 5);
+    Decoder d(&r);
+    d.set_limits(DecodeLimits());
+    std::vector<int> v;
+    CHECK(try_decode(d, v) == MSGPACK_E_EOF);
+    CHECK(v.empty());
+  }
+  {
+    MemoryReader r(str_bomb, 5);
+    Decoder d(&r);
+    d.set_limits(DecodeLimits());
+    std::string s;
+    CHECK(try_decode(d, s) == MSGPACK_E_EOF);
+  }
+}
+
+static void test_depth_and_elements()
+{
+  Deep deep(1, std::vector<std::vector<int> >(1, std::vector<int>(2, 1)));
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  e << deep;
+
+  {
+    MemoryReader r((const char*)w.data(), w.size());
+    Decoder d(&r);
+    DecodeLimits l;
+    l.max_depth = 2;
+    d.set_limits(l);
+    Deep x;
+    CHECK_THROWS(d >> x, LimitException);
+  }
+  {
+    MemoryReader r((const char*)w.data(), w.size());
+    Decoder d(&r);
+    DecodeLimits l;
+    l.max_depth = 3;
+    d.set_limits(l);
+    Deep x;
+    d >> x;
+    CHECK(x == deep);
+    CHECK(d.depth() == 0);
+  }
+  {
+    MemoryReader r((const char*)w.data(), w.size());
+    Decoder d(&r);
+    DecodeLimits l;
+    l.max_elements = 1;
+    d.set_limits(l);
+    Deep x;
+    CHECK(try_decode(d, x) == MSGPACK_E_LIMIT);
+  }
+}
+
+static void test_bytes()
+{
+  P p;
+  p.a = 1;
+  for (int i = 0; i < 4; ++i) p.b.push_back(i);
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  e << p;
+
+  {
+    MemoryReader r((const char*)w.data(), w.size());
+    Decoder d(&r);
+    DecodeLimits l;
+    l.max_bytes = 8;
+    d.set_limits(l);
+    P q;
+    CHECK(try_decode(d, q) == MSGPACK_E_LIMIT);
+  }
+  {
+    MemoryReader r((const char*)w.data(), w.size());
+    Decoder d(&r);
+    DecodeLimits l;
+    l.max_bytes = 16;
+    d.set_limits(l);
+    P q;
+    d >> q;
+    CHECK(q.b == p.b);
+  }
+  {
+    MemoryReader r((const char*)w.data(), w.size());
+    Decoder d(&r);
+    DecodeLimits l;
+    l.max_depth = 0;
+    d.set_limits(l);
+    P q;
+    CHECK(try_decode(d, q) == MSGPACK_E_LIMIT);
+  }
+}
+
+int main()
+{
+  test_length_bombs();
+  test_depth_and_elements();
+  test_bytes();
+  return check_result();
+}
@@ -0,0 +1,163 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/LogSink.h"
+#include "check.h"
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace MessagePack;
+
+typedef std::tuple<int, int, std::string, double> Rec;
+
+/*
+ * Records of many producers arrive whole and in order per producer;
+ * with MSGPACK_LOG_DROP some are dropped (and counted) instead.
+ */
+static void test_producers(LogBackpressure policy)
+{
+  const int T = 8, N = 20000;
+  BufferedMemoryWriter out(16);
+  size_t dropped;
+  {
+    LogSink sink(&out, policy == MSGPACK_LOG_BLOCK ? 1 << 16 : 1 << 14, policy, 1);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < T; ++t)
+    {
+      threads.push_back(std::thread([&sink, t]() {
+        LogProducer log(sink, 1024);
+        LogEncoder enc(&log);
+        for (int i = 0; i < N; ++i)
+        {
+          enc << Rec(t, i, std::string(i % 100, 'x'), i * 0.5);
+          log.commit();
+        }
+        // an unfinished record is never handed over
+        enc << std::string("partial");
+      }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+    sink.close();
+    CHECK(sink.error() == MSGPACK_OK);
+    dropped = sink.dropped_records();
+  }
+
+  MemoryReader r((const char*)out.data(), out.size());
+  Decoder d(&r);
+  std::vector<int> next(T, 0);
+  size_t n = 0;
+  bool ok = true;
+  while (!r.at_end())
+  {
+    Rec x;
+    d >> x;
+    int t = std::get<0>(x), i = std::get<1>(x);
+    ok = ok && i >= next[t] && (policy == MSGPACK_LOG_DROP || i == next[t]);
+    ok = ok && std::get<2>(x).size() == (size_t)(i % 100) && std::get<3>(x) == i * 0.5;
+    next[t] = i + 1;
+    ++n;
+  }
+  CHECK(ok);
+  CHECK(n + dropped == (size_t)T * N);
+  if (policy == MSGPACK_LOG_BLOCK) CHECK(dropped == 0);
+}
+
+/*
+ * flush() in the middle of a record larger than the batch.
+ */
+static void test_flush_partial()
+{
+  BufferedMemoryWriter out(16);
+  {
+    LogSink sink(&out);
+    LogProducer log(sink, 64);
+    LogEncoder enc(&log);
+    enc << 1;
+    log.commit();
+    enc << std::string(1000, 'p');
+    log.flush();
+    log.commit();
+    sink.close();
+  }
+  MemoryReader r((const char*)out.data(), out.size());
+  Decoder d(&r);
+  int one;
+  std::string s;
+  d >> one >> s;
+  CHECK(one == 1 && s == std::string(1000, 'p') && r.at_end());
+}
+
+/*
+ * A record larger than max_pending is refused; the next ones go through.
+ */
+static void test_oversize(LogBackpressure policy)
+{
+  BufferedMemoryWriter out(16);
+  {
+    LogSink sink(&out, 4096, policy);
+    LogProducer log(sink, 1 << 20);
+    log.set_throws(false);
+    LogEncoder enc(&log);
+    enc << 1;
+    log.commit();
+    enc << std::string(10000, 'x');
+    log.commit();
+    CHECK(log.error() == MSGPACK_E_LIMIT);
+    enc << 2;
+    log.commit();
+    for (int i = 0; i < 100; ++i)
+    {
+      enc << std::string(1000, 'y');
+      log.commit();
+    }
+    log.flush();
+    sink.close();
+  }
+  MemoryReader r((const char*)out.data(), out.size());
+  Decoder d(&r);
+  int a, b;
+  d >> a >> b;
+  CHECK(a == 1 && b == 2);
+  size_t n = 0;
+  bool ok = true;
+  while (!r.at_end())
+  {
+    std::string s;
+    d >> s;
+    ok = ok && s.size() == 1000;
+    ++n;
+  }
+  CHECK(ok);
+  if (policy == MSGPACK_LOG_BLOCK) CHECK(n == 100);
+}
+
+static void test_oversize_throws()
+{
+  BufferedMemoryWriter out(16);
+  {
+    LogSink sink(&out, 4096);
+    LogProducer log(sink);
+    LogEncoder enc(&log);
+    CHECK_THROWS(enc << std::string(10000, 'x'), LimitException);
+    log.commit();
+    enc << 3;
+    log.commit();
+  }
+  MemoryReader r((const char*)out.data(), out.size());
+  Decoder d(&r);
+  int c;
+  d >> c;
+  CHECK(c == 3 && r.at_end());
+}
+
+int main()
+{
+  test_producers(MSGPACK_LOG_BLOCK);
+  test_producers(MSGPACK_LOG_DROP);
+  test_flush_partial();
+  test_oversize(MSGPACK_LOG_BLOCK);
+  test_oversize(MSGPACK_LOG_DROP);
+  test_oversize_throws();
+  return check_result();
+}
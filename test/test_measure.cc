@@ -0,0 +1,67 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "check.h"
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace MessagePack;
+
+static void test_measure()
+{
+  std::map<std::string, std::vector<int64_t> > v;
+  int64_t ints[] = {1, -5, 300, 70000, -(1LL << 40)};
+  v["a"] = std::vector<int64_t>(ints, ints + 5);
+  v["bbbb"];
+  std::tuple<double, float, bool, std::string> t(1.5, 2.5f, true, std::string(40, 'x'));
+
+  size_t n = measure(v);
+  BufferedMemoryWriter w(0);
+  w.reserve(n);
+  const void *p0 = w.data();
+  Encoder e(&w);
+  e << v;
+  CHECK(w.size() == n);
+  // encoded without growing the buffer
+  CHECK(w.data() == p0);
+
+  BufferedMemoryWriter w2(16);
+  Encoder e2(&w2);
+  e2 << t;
+  CHECK(w2.size() == measure(t));
+
+  BufferedMemoryWriter w3(16);
+  FixedWidthEncoder e3(&w3);
+  e3 << v;
+  CHECK(w3.size() == measure<FixedWidthProfile>(v));
+}
+
+static void test_measure_message()
+{
+  std::map<std::string, std::vector<int64_t> > v;
+  int64_t ints[] = {1, -5, 300, 70000, -(1LL << 40)};
+  v["a"] = std::vector<int64_t>(ints, ints + 5);
+  v["bbbb"];
+
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  e << v;
+
+  DecodeStats s;
+  CHECK(measure_message((const char*)w.data(), w.size(), s) == MSGPACK_OK);
+  CHECK(s.maps == 1 && s.arrays == 2);
+  CHECK(s.elements == 2 + 5);
+  CHECK(s.raws == 2 && s.raw_bytes == 5);
+  CHECK(s.items == 1 + 2 + 2 + 5);
+
+  DecodeStats s2;
+  CHECK(measure_message((const char*)w.data(), w.size() - 1, s2) == MSGPACK_E_EOF);
+}
+
+int main()
+{
+  test_measure();
+  test_measure_message();
+  return check_result();
+}
@@ -0,0 +1,56 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "check.h"
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace MessagePack;
+
+static void test_encode_mapped(bool huge)
+{
+  BufferedMemoryWriter w(16);
+  w.set_mmap_threshold(1 << 20, huge);
+  Encoder e(&w);
+  std::vector<std::string> v;
+  for (int i = 0; i < 200000; ++i) v.push_back(std::string(i % 50, 'a' + i % 26));
+  e << v;
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder d(&r);
+  std::vector<std::string> x;
+  d >> x;
+  CHECK(x == v);
+}
+
+/*
+ * Contents survive the switch to a mapping and its growth.
+ */
+static void test_resize()
+{
+  ResizableBuffer b;
+  b.set_mmap_threshold(4096);
+  b.resize(100);
+  CHECK(!b.mapped());
+  memset(b.ptr_at(0, 100), 7, 100);
+
+  b.resize(10000);
+  CHECK(b.mapped());
+  CHECK(((char*)b.data())[99] == 7);
+
+  b.resize(1 << 24);
+  CHECK(((char*)b.data())[99] == 7);
+  ((char*)b.ptr_at((1 << 24) - 1, 1))[0] = 1;
+
+  b.reserve((1 << 24) + 5);
+  CHECK(b.capacity() % 4096 == 0);
+  CHECK(((char*)b.data())[(1 << 24) - 1] == 1);
+}
+
+int main()
+{
+  test_encode_mapped(false);
+  test_encode_mapped(true);
+  test_resize();
+  return check_result();
+}
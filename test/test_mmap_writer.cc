@@ -0,0 +1,89 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/MmapWriter.h"
+#include "MessagePack/Serialize.h"
+#include "check.h"
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+using namespace MessagePack;
+
+static const char *FILENAME = "test_mmap_writer.msgpack";
+
+/*
+ * The file is truncated to the written size on close.
+ */
+static void test_roundtrip()
+{
+  std::vector<std::string> v;
+  for (int i = 0; i < 100000; ++i) v.push_back(std::string(i % 40, 'a' + i % 26));
+
+  size_t n;
+  {
+    MmapWriter w(FILENAME, 4096);
+    FixedWidthEncoder e(&w);
+    e << v << 1.5 << 2.5f;
+    n = w.size();
+    CHECK(w.close());
+  }
+  struct stat st;
+  CHECK(stat(FILENAME, &st) == 0 && (size_t)st.st_size == n);
+
+  FileReader r(FILENAME);
+  Decoder d(&r);
+  std::vector<std::string> x;
+  double f;
+  float g;
+  d >> x >> f >> g;
+  CHECK(x == v && f == 1.5 && g == 2.5f && r.at_end());
+
+  {
+    MmapWriter w(FILENAME);
+  }
+  CHECK(stat(FILENAME, &st) == 0 && st.st_size == 0);
+  unlink(FILENAME);
+}
+
+static void test_open_failure()
+{
+  MmapWriter w("/nonexistent/dir/x", 4096, false);
+  Encoder e(&w);
+  e << 1;
+  CHECK(w.failed() && w.error() == MSGPACK_E_FILE);
+}
+
+/*
+ * Running out of space fails the write instead of faulting on the
+ * mapping; the destructor does not throw. Limits the file size of the
+ * process, so it runs last.
+ */
+static void test_no_space()
+{
+  signal(SIGXFSZ, SIG_IGN);
+  struct rlimit rl;
+  rl.rlim_cur = rl.rlim_max = 1 << 20;
+  CHECK(setrlimit(RLIMIT_FSIZE, &rl) == 0);
+
+  std::string chunk(100000, 'x');
+  {
+    MmapWriter w(FILENAME, 256 << 10, false);
+    for (int i = 0; i < 30; ++i) w.write(chunk.data(), chunk.size());
+    CHECK(w.error() == MSGPACK_E_FILE);
+    CHECK(w.size() <= (1 << 20));
+  }
+  {
+    MmapWriter w(FILENAME, 256 << 10);
+    CHECK_THROWS(for (int i = 0; i < 30; ++i) w.write(chunk.data(), chunk.size()), FileException);
+  }
+  unlink(FILENAME);
+}
+
+int main()
+{
+  test_roundtrip();
+  test_open_failure();
+  test_no_space();
+  return check_result();
+}
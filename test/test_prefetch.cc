@@ -0,0 +1,128 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/PrefetchReader.h"
+#include "check.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MessagePack;
+
+static const char *FILENAME = "test_prefetch.msgpack";
+
+static std::vector<std::string> make_strings()
+{
+  std::vector<std::string> v;
+  for (int i = 0; i < 50000; ++i) v.push_back(std::string(i % 70, 'a' + i % 26));
+  return v;
+}
+
+static void write_file(const std::vector<std::string> &v)
+{
+  FILE *f = fopen(FILENAME, "w");
+  FileWriter w(f);
+  Encoder e(&w);
+  for (int k = 0; k < 5; ++k) e << v << (int64_t)k;
+  fclose(f);
+}
+
+/*
+ * Values cross block boundaries for every block size.
+ */
+static void test_block_sizes(const std::vector<std::string> &v)
+{
+  const size_t sizes[] = {1, 7, 100, 4096, 1 << 20};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+  {
+    PrefetchFileReader r(FILENAME, sizes[i], 2 + sizes[i] % 3);
+    Decoder d(&r);
+    CHECK(r.remaining() > 0);
+    int k = 0;
+    while (!r.at_end())
+    {
+      std::vector<std::string> x;
+      int64_t kk;
+      d >> x >> kk;
+      CHECK(x == v && kk == k);
+      ++k;
+    }
+    CHECK(k == 5 && r.remaining() == 0);
+  }
+}
+
+static void test_errors()
+{
+  {
+    // destroyed while the reader thread is still loading
+    PrefetchFileReader r(FILENAME, 4096, 3);
+    Decoder d(&r);
+    d.skip_value();
+  }
+  {
+    PrefetchFileReader r("/nonexistent/file", 4096, 3, false);
+    CHECK(r.error() == MSGPACK_E_FILE && r.at_end());
+  }
+  {
+    PrefetchFileReader r(FILENAME, 4096, 3);
+    r.set_throws(false);
+    Decoder d(&r);
+    for (int i = 0; i < 10; ++i) d.skip_value();
+    CHECK(!r.failed());
+    d.skip_value();
+    CHECK(r.error() == MSGPACK_E_EOF);
+  }
+}
+
+/*
+ * A pipe filled by another thread in small pieces.
+ */
+static void test_pipe()
+{
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+
+  std::thread writer([fds]() {
+    BufferedMemoryWriter w(16);
+    Encoder e(&w);
+    for (int i = 0; i < 1000; ++i) e << i << std::string(i % 300, 'p');
+    const char *p = (const char*)w.data();
+    for (size_t off = 0; off < w.size(); off += 333)
+    {
+      size_t n = w.size() - off < 333 ? w.size() - off : 333;
+      if (write(fds[1], p + off, n) != (ssize_t)n) break;
+    }
+    close(fds[1]);
+  });
+
+  {
+    PrefetchFileReader r(fds[0], 512, 2);
+    Decoder d(&r);
+    CHECK(r.remaining() == SIZE_MAX);
+    int i = 0;
+    bool same = true;
+    while (!r.at_end())
+    {
+      int n;
+      std::string s;
+      d >> n >> s;
+      same = same && n == i && s == std::string(i % 300, 'p');
+      ++i;
+    }
+    CHECK(same && i == 1000);
+  }
+  writer.join();
+  close(fds[0]);
+}
+
+int main()
+{
+  std::vector<std::string> v = make_strings();
+  write_file(v);
+  test_block_sizes(v);
+  test_errors();
+  test_pipe();
+  unlink(FILENAME);
+  return check_result();
+}
@@ -0,0 +1,195 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/Projection.h"
+#include "check.h"
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace MessagePack;
+
+typedef std::map<std::string, int> Item;
+
+/*
+ * { id, user: {name, age, x}, items: [{sku, qty}, {sku, qty}, 42], blob, 7 }
+ */
+static void record(Encoder &enc, int i, bool open)
+{
+  size_t m = 0;
+  if (open) m = enc.begin_map(); else enc.emit_map(5);
+  enc << "id" << i;
+  enc << "user";
+  enc.emit_map(3);
+  enc << "name" << ("u" + std::to_string(i)) << "age" << i * 2 << "x" << std::vector<int>(3, i);
+  enc << "items";
+  enc.emit_array(3);
+  for (int j = 0; j < 2; ++j)
+  {
+    Item it;
+    it["sku"] = j;
+    it["qty"] = i;
+    enc << it;
+  }
+  enc << 42;
+  enc << "blob" << std::string(200, 'b');
+  enc << 7 << "seven";
+  if (open) enc.end_map(m, 5);
+}
+
+/*
+ * The projection of record(i) on id, user.name and items.sku.
+ */
+static bool projected(Decoder &dec, int i)
+{
+  bool open;
+  bool ok = dec.read_map_header(open) == 3 && !open;
+  std::string k;
+  int id;
+  dec >> k >> id;
+  ok = ok && k == "id" && id == i;
+  std::map<std::string, std::string> u;
+  dec >> k >> u;
+  ok = ok && k == "user" && u.size() == 1 && u["name"] == "u" + std::to_string(i);
+  dec >> k;
+  ok = ok && k == "items" && dec.read_array() == 3;
+  for (int j = 0; j < 2; ++j)
+  {
+    Item it;
+    dec >> it;
+    ok = ok && it.size() == 1 && it["sku"] == j;
+  }
+  int x;
+  dec >> x;
+  return ok && x == 42;
+}
+
+static void add_paths(Projection &proj)
+{
+  proj.add("id");
+  proj.add("user.name");
+  proj.add("items.sku");
+  proj.add("missing.deep");
+}
+
+static void check_output(const BufferedMemoryWriter &out, int n)
+{
+  MemoryReader r((const char*)out.data(), out.size());
+  Decoder d(&r);
+  bool ok = true;
+  for (int i = 0; i < n; ++i) ok = ok && projected(d, i);
+  CHECK(ok);
+  CHECK(r.at_end());
+}
+
+static void test_readers(const BufferedMemoryWriter &in)
+{
+  Projection proj;
+  add_paths(proj);
+  {
+    BufferedMemoryWriter out(64);
+    MemoryReader r((const char*)in.data(), in.size());
+    CHECK(proj.project_all(r, out) == 100);
+    check_output(out, 100);
+    CHECK(out.size() < in.size() / 2);
+  }
+  {
+    // records straddle segments
+    std::vector<struct iovec> segs;
+    const char *p = (const char*)in.data();
+    size_t left = in.size();
+    while (left)
+    {
+      size_t n = left < 97 ? left : 97;
+      struct iovec v;
+      v.iov_base = (void*)p;
+      v.iov_len = n;
+      segs.push_back(v);
+      p += n;
+      left -= n;
+    }
+    SegmentedReader r(&segs[0], segs.size());
+    BufferedMemoryWriter out(64);
+    CHECK(proj.project_all(r, out) == 100);
+    check_output(out, 100);
+  }
+  {
+    FILE *f = tmpfile();
+    fwrite(in.data(), 1, in.size(), f);
+    rewind(f);
+    FileReader r(f, in.size());
+    BufferedMemoryWriter out(64);
+    CHECK(proj.project_all(r, out) == 100);
+    check_output(out, 100);
+    fclose(f);
+  }
+}
+
+/*
+ * A path that is a prefix of another keeps the whole value.
+ */
+static void test_ancestor(const BufferedMemoryWriter &in)
+{
+  Projection proj;
+  proj.add("user.name");
+  proj.add("user");
+  proj.add("user.age");
+  BufferedMemoryWriter out(64);
+  MemoryReader r((const char*)in.data(), in.size());
+  CHECK(proj.project(r, out));
+
+  MemoryReader r2((const char*)out.data(), out.size());
+  Decoder d(&r2);
+  std::string k;
+  CHECK(d.read_map() == 1);
+  d >> k;
+  CHECK(k == "user");
+  CHECK(d.read_map() == 3);
+}
+
+static void test_bad_input(const BufferedMemoryWriter &in)
+{
+  Projection proj;
+  add_paths(proj);
+  BufferedMemoryWriter out(64);
+
+  MemoryReader r((const char*)in.data(), in.size() - 1);
+  r.set_throws(false);
+  CHECK(proj.project_all(r, out) == 99);
+  CHECK(r.error() == MSGPACK_E_EOF);
+
+  const char bad[] = "\x82\xa2id\x01\xc1";
+  MemoryReader rb(bad, sizeof(bad) - 1);
+  rb.set_throws(false);
+  CHECK(!proj.project(rb, out) && rb.error() == MSGPACK_E_INVALID_DECODE);
+  MemoryReader rt(bad, sizeof(bad) - 1);
+  CHECK_THROWS(proj.project(rt, out), InvalidDecodeException);
+
+  const char huge[] = "\xdd\xff\xff\xff\xff\x01";
+  MemoryReader rh(huge, sizeof(huge) - 1);
+  rh.set_throws(false);
+  CHECK(!proj.project(rh, out) && rh.error() == MSGPACK_E_EOF);
+
+  // deeply nested size-less arrays in a kept and in a dropped field
+  const char *keys[] = {"\x81\xa2id", "\x81\xa4" "blob"};
+  for (int i = 0; i < 2; ++i)
+  {
+    std::string deep(keys[i]);
+    deep.append(2 << 20, '\xc4');
+    MemoryReader rd(deep.data(), deep.size());
+    rd.set_throws(false);
+    CHECK(!proj.project(rd, out) && rd.error() == MSGPACK_E_EOF);
+  }
+}
+
+int main()
+{
+  BufferedMemoryWriter in(64);
+  Encoder enc(&in);
+  for (int i = 0; i < 100; ++i) record(enc, i, i % 3 == 0);
+
+  test_readers(in);
+  test_ancestor(in);
+  test_bad_input(in);
+  return check_result();
+}
@@ -0,0 +1,91 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "check.h"
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace MessagePack;
+
+/*
+ * In reuse mode a vector decodes over the elements it holds, so nested
+ * strings keep their buffers.
+ */
+static void test_vector_reuse()
+{
+  std::vector<std::string> a;
+  a.push_back(std::string(100, 'a'));
+  a.push_back("b");
+  std::vector<std::string> b;
+  b.push_back("c"); b.push_back("d"); b.push_back("e");
+
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << a << b << a;
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+  dec.set_reuse(true);
+
+  std::vector<std::string> t;
+  dec >> t;
+  CHECK(t == a);
+  const char *p0 = t[0].data();
+  size_t cap = t[0].capacity();
+
+  dec >> t;
+  CHECK(t == b);
+  CHECK(t[0].data() == p0);
+  CHECK(t[0].capacity() == cap);
+
+  dec >> t;
+  CHECK(t == a);
+  CHECK(t[0].data() == p0);
+}
+
+/*
+ * Maps are cleared first in reuse mode and merged into otherwise.
+ */
+static void test_map_reuse_and_merge()
+{
+  std::map<int, std::vector<int> > m;
+  m[1].push_back(1); m[1].push_back(2);
+  m[2].push_back(3);
+  std::unordered_map<std::string, int> um;
+  um["x"] = 1; um["y"] = 2;
+  std::vector<bool> vb;
+  vb.push_back(true); vb.push_back(false); vb.push_back(true);
+
+  BufferedMemoryWriter w(16);
+  Encoder enc(&w);
+  enc << m << m << um << vb;
+
+  MemoryReader r((const char*)w.data(), w.size());
+  Decoder dec(&r);
+
+  std::map<int, std::vector<int> > m2;
+  m2[9].push_back(9);
+  dec.set_reuse(true);
+  dec >> m2;
+  CHECK(m2 == m);
+
+  dec.set_reuse(false);
+  m2[5].push_back(5);
+  dec >> m2;
+  CHECK(m2.size() == 3 && m2[1] == m[1]);
+
+  std::unordered_map<std::string, int> um2;
+  std::vector<bool> vb2;
+  dec >> um2 >> vb2;
+  CHECK(um2 == um);
+  CHECK(vb2 == vb);
+  CHECK(r.at_end());
+}
+
+int main()
+{
+  test_vector_reuse();
+  test_map_reuse_and_merge();
+  return check_result();
+}
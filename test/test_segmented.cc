@@ -0,0 +1,99 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "check.h"
+#include <stdlib.h>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace MessagePack;
+
+typedef std::map<std::string, std::vector<double> > M;
+typedef std::tuple<int64_t, std::string, std::vector<uint64_t> > T;
+
+/*
+ * Values split at random points across segments, including empty ones.
+ */
+static void test_random_splits()
+{
+  M m;
+  for (int i = 0; i < 50; ++i) m[std::string(i, 'k')] = std::vector<double>(i, i * 0.5);
+  std::vector<uint64_t> u;
+  u.push_back(1); u.push_back(1u << 31); u.push_back(1ull << 40);
+  T t(-123456789012LL, std::string(300, 'z'), u);
+
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  e << m << t << std::string("hello");
+  const char *data = (const char*)w.data();
+
+  for (int seed = 1; seed < 200; ++seed)
+  {
+    srand(seed);
+    std::vector<iovec> segs;
+    size_t off = 0;
+    while (off < w.size())
+    {
+      size_t n = rand() % (seed < 100 ? 8 : 600);
+      if (off + n > w.size()) n = w.size() - off;
+      iovec v;
+      v.iov_base = (void*)(data + off);
+      v.iov_len = n;
+      segs.push_back(v);
+      off += n;
+    }
+
+    SegmentedReader r(&segs[0], segs.size());
+    Decoder d(&r);
+    CHECK(r.remaining() == w.size());
+    M m2;
+    T t2;
+    d >> m2 >> t2;
+    CHECK(m2 == m && t2 == t);
+
+    // a view only when the string lies within one segment
+    uint32_t len = d.read_raw();
+    const char *p = d.read_raw_body_view(len);
+    std::string s;
+    if (p) s.assign(p, len);
+    else { s.resize(len); d.read_raw_body(&s[0], len); }
+    CHECK(s == "hello" && r.at_end());
+
+    SegmentedReader r2(&segs[0], segs.size());
+    Decoder d2(&r2);
+    d2.skip_value();
+    d2.skip_value();
+    d2.skip_value();
+    CHECK(r2.at_end());
+  }
+}
+
+static void test_end()
+{
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  e << 1 << "two";
+
+  iovec one;
+  one.iov_base = (void*)w.data();
+  one.iov_len = w.size();
+  SegmentedReader r(&one, 1);
+  r.set_throws(false);
+  Decoder d(&r);
+  d.skip_value();
+  d.skip_value();
+  CHECK(!r.failed());
+  d.skip_value();
+  CHECK(r.error() == MSGPACK_E_EOF);
+
+  SegmentedReader empty(NULL, 0);
+  CHECK(empty.at_end());
+}
+
+int main()
+{
+  test_random_splits();
+  test_end();
+  return check_result();
+}
@@ -0,0 +1,103 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/ShmRing.h"
+#include "check.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <tuple>
+
+using namespace MessagePack;
+
+/*
+ * A child process writes through a ring much smaller than the data;
+ * strings are read as views into the shared memory.
+ */
+static void test_processes()
+{
+  int fd = ShmRing::create(NULL, 8192);
+  CHECK(fd >= 0);
+  const int N = 100000;
+
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    ShmRing ring(fd);
+    CHECK(ring.ok());
+    ShmRingWriter w(ring);
+    ShmRingEncoder enc(&w);
+    for (int i = 0; i < N; ++i)
+    {
+      enc << std::make_tuple(i, std::string(i % 300, 'a' + i % 26), i * 0.5f);
+      w.commit();
+    }
+    // larger than the ring
+    w.set_throws(false);
+    enc << std::string(10000, 'x');
+    CHECK(w.error() == MSGPACK_E_BUFFER_FULL);
+    w.rollback();
+    w.close();
+    _exit(check_result());
+  }
+
+  ShmRing ring(fd);
+  CHECK(ring.ok() && ring.capacity() == 8192);
+  ShmRingReader r(ring);
+  Decoder d(&r);
+  int i = 0;
+  bool ok = true;
+  while (!r.at_end())
+  {
+    ok = ok && d.read_array() == 3 && d.read_signed<int>() == i;
+    uint32_t len = d.read_raw();
+    const char *p = d.read_raw_body_view(len);
+    ok = ok && (p || len == 0) && len == (uint32_t)(i % 300);
+    for (uint32_t j = 0; ok && j < len; ++j) ok = p[j] == 'a' + i % 26;
+    float f;
+    d >> f;
+    ok = ok && f == i * 0.5f;
+    r.release();
+    ++i;
+  }
+  CHECK(ok && i == N);
+
+  int status;
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  close(fd);
+}
+
+/*
+ * A record that failed half way is rolled back on commit().
+ */
+static void test_failed_record()
+{
+  int fd = ShmRing::create(NULL, 4096);
+  ShmRing ring(fd);
+  ShmRingWriter w(ring);
+  w.set_throws(false);
+  ShmRingEncoder enc(&w);
+  enc << std::make_tuple(1, std::string(10000, 'x'), 2);
+  CHECK(w.error() == MSGPACK_E_BUFFER_FULL);
+  w.commit();
+  w.clear_error();
+  enc << 7;
+  w.commit();
+  w.close();
+
+  ShmRingReader r(ring);
+  Decoder d(&r);
+  int v;
+  d >> v;
+  CHECK(v == 7);
+  r.release();
+  CHECK(r.at_end());
+  close(fd);
+}
+
+int main()
+{
+  test_processes();
+  test_failed_record();
+  return check_result();
+}
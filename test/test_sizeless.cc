@@ -0,0 +1,341 @@
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/Serialize.h"
+#include "MessagePack/Fields.h"
+#include "check.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace MessagePack;
+
+typedef std::map<std::string, std::vector<std::vector<int> > > M;
+
+static const char *FILENAME = "test_sizeless.msgpack";
+
+/*
+ * Emits a map and an array without knowing their sizes up front.
+ */
+template <class E>
+static void produce(E &enc, int rows)
+{
+  size_t m = enc.begin_map();
+  uint32_t nm = 0;
+  for (int k = 0; k < 3; ++k, ++nm)
+  {
+    enc << ("k" + std::to_string(k));
+    size_t a = enc.begin_array();
+    uint32_t n = 0;
+    for (int i = 0; i < rows; ++i, ++n)
+    {
+      if (i % 2)
+      {
+        size_t b = enc.begin_array();
+        for (int j = 0; j < i; ++j) enc << j;
+        enc.end_array(b, i);
+      }
+      else
+      {
+        enc << std::vector<int>(i, k);
+      }
+    }
+    enc.end_array(a, n);
+  }
+  enc.end_map(m, nm);
+
+  size_t s = enc.begin_array();
+  enc << 7 << 8 << 9;
+  enc.end_array(s, 3);
+}
+
+static M expected(int rows)
+{
+  M m;
+  for (int k = 0; k < 3; ++k)
+  {
+    std::vector<std::vector<int> > &x = m["k" + std::to_string(k)];
+    for (int i = 0; i < rows; ++i)
+    {
+      if (i % 2)
+      {
+        std::vector<int> v;
+        for (int j = 0; j < i; ++j) v.push_back(j);
+        x.push_back(v);
+      }
+      else
+      {
+        x.push_back(std::vector<int>(i, k));
+      }
+    }
+  }
+  return m;
+}
+
+static bool decode_produced(Decoder &d, int rows)
+{
+  M m;
+  std::set<int> s;
+  d >> m >> s;
+  std::set<int> want;
+  want.insert(7); want.insert(8); want.insert(9);
+  return m == expected(rows) && s == want;
+}
+
+/*
+ * Seekable writers backpatch the headers; the size is the same as
+ * counted by CountingWriter.
+ */
+static void test_backpatched()
+{
+  const int rows = 40;
+  BufferedMemoryWriter w(16);
+  Encoder e(&w);
+  produce(e, rows);
+  const char *p = (const char*)w.data();
+  CHECK((uint8_t)p[0] == 0xdf);
+
+  MemoryReader r(p, w.size());
+  Decoder d(&r);
+  CHECK(decode_produced(d, rows));
+  CHECK(r.at_end());
+
+  CountingWriter cw;
+  BasicEncoder<CompactProfile, CountingWriter> ce(&cw);
+  produce(ce, rows);
+  CHECK(cw.size() == w.size());
+
+  MemoryReader r2(p, w.size());
+  Decoder d2(&r2);
+  DecodeStats st;
+  d2.scan_value(st);
+  CHECK(st.maps == 1 && st.arrays == 3 + 3 * rows);
+}
+
+/*
+ * Headers straddling the end of a FixedBufferWriter and its spill.
+ */
+static void test_fixed_buffer_spill()
+{
+  const size_t caps[] = {0, 1, 2, 3, 4, 5, 100};
+  for (size_t i = 0; i < sizeof(caps) / sizeof(caps[0]); ++i)
+  {
+    char buf[128];
+    FixedBufferWriter w(buf, caps[i], MSGPACK_OVERFLOW_SPILL);
+    FixedBufferEncoder e(&w);
+    produce(e, 5);
+    std::string all(buf, std::min(caps[i], w.size()));
+    all.append(w.overflow_data(), w.overflow_size());
+    MemoryReader r(all.data(), all.size());
+    Decoder d(&r);
+    CHECK(decode_produced(d, 5));
+  }
+}
+
+/*
+ * Non-seekable writers emit begin/end markers.
+ */
+static void test_markers()
+{
+  const int rows = 40;
+  {
+    FILE *f = fopen(FILENAME, "wb");
+    FileWriter w(f);
+    Encoder e(&w);
+    produce(e, rows);
+    e << 99;
+    fclose(f);
+  }
+  {
+    FileReader r(FILENAME);
+    Decoder d(&r);
+    CHECK(decode_produced(d, rows));
+    CHECK(d.read_signed<int>() == 99);
+    CHECK(r.at_end());
+  }
+
+  std::string all;
+  {
+    FILE *f = fopen(FILENAME, "rb");
+    char b[4096];
+    size_t n;
+    while ((n = fread(b, 1, sizeof(b), f)) > 0) all.append(b, n);
+    fclose(f);
+  }
+  unlink(FILENAME);
+  CHECK((uint8_t)all[0] == 0xc6);
+
+  MemoryReader r(all.data(), all.size());
+  Decoder d(&r);
+  CHECK(decode_produced(d, rows));
+  CHECK(d.read_signed<int>() == 99);
+
+  MemoryReader r2(all.data(), all.size());
+  Decoder d2(&r2);
+  DecodeStats st;
+  d2.scan_value(st);
+  CHECK(st.maps == 1 && st.arrays == 3 + 3 * rows);
+  CHECK(st.elements == 3 + 3 * rows + (size_t)3 * (rows * (rows - 1) / 2));
+  d2.skip_value();
+  CHECK(d2.read_signed<int>() == 99);
+
+  // reuse mode, unordered containers
+  MemoryReader r3(all.data(), all.size());
+  Decoder d3(&r3);
+  d3.set_reuse(true);
+  M m(expected(rows + 5));
+  std::unordered_set<int> us;
+  d3 >> m >> us;
+  CHECK(m == expected(rows));
+  CHECK(us.size() == 3);
+
+  // elements are charged one by one
+  MemoryReader r4(all.data(), all.size());
+  r4.set_throws(false);
+  Decoder d4(&r4);
+  DecodeLimits lim;
+  lim.max_bytes = 1000;
+  d4.set_limits(lim);
+  M m4;
+  d4 >> m4;
+  CHECK(r4.error() == MSGPACK_E_LIMIT);
+
+  // stray end marker
+  MemoryReader r5("\xc5", 1);
+  r5.set_throws(false);
+  Decoder d5(&r5);
+  d5.skip_value();
+  CHECK(r5.failed());
+}
+
+/*
+ * Skipping and scanning do not recurse, whatever the nesting.
+ */
+static void test_deep_nesting()
+{
+  std::string open(2 << 20, '\xc4');
+  MemoryReader r(open.data(), open.size());
+  Decoder d(&r);
+  CHECK(d.try_skip_value() == MSGPACK_E_EOF);
+
+  std::string b(100000, '\xc4');
+  b += std::string(100000, '\xc5');
+  MemoryReader r2(b.data(), b.size());
+  Decoder d2(&r2);
+  DecodeStats st;
+  {
+    NoThrowScope scope(r2);
+    d2.scan_value(st);
+  }
+  CHECK(!r2.failed() && r2.at_end());
+  CHECK(st.arrays == 100000 && st.elements == 99999);
+
+  MemoryReader r3(b.data(), b.size());
+  Decoder d3(&r3);
+  DecodeLimits lim;
+  lim.max_depth = 10;
+  d3.set_limits(lim);
+  CHECK(d3.try_skip_value() == MSGPACK_E_LIMIT);
+
+  // [ {a: [1, 2]}, begin_map x: 1, y: begin_array 1 end end end ], 7
+  const char m[] = "\xc4\x81\xa1\x61\x92\x01\x02\xc6\xa1x\x01\xa1y\xc4\x01\xc5\xc5\xc5\x07";
+  MemoryReader r4(m, sizeof(m) - 1);
+  Decoder d4(&r4);
+  DecodeStats s4;
+  d4.scan_value(s4);
+  CHECK(r4.remaining() == 1);
+  CHECK(s4.maps == 2 && s4.arrays == 3 && s4.elements == 2 + 1 + 2 + 2 + 1);
+}
+
+struct P
+{
+  int x;
+  std::string name;
+  MSGPACK_FIELDS(x, name)
+};
+
+struct Q
+{
+  int a;
+  int b;
+  MSGPACK_FIELDS_ARRAY(a, b)
+};
+
+static Q decode_q(const char *bytes, size_t n)
+{
+  MemoryReader r(bytes, n);
+  Decoder d(&r);
+  Q q;
+  q.a = q.b = 0;
+  d >> q;
+  CHECK(d.read_uint() == 9);
+  return q;
+}
+
+/*
+ * Size-less input for MSGPACK_FIELDS and flat containers.
+ */
+static void test_fields_and_flat()
+{
+  // begin_map x: 5, zz: 1, name: "n" end, 9
+  const char m[] = "\xc6\xa1x\x05\xa2zz\x01\xa4name\xa1n\xc5\x09";
+  {
+    MemoryReader r(m, sizeof(m) - 1);
+    Decoder d(&r);
+    P p;
+    d >> p;
+    CHECK(p.x == 5 && p.name == "n");
+    CHECK(d.read_uint() == 9);
+  }
+
+  // shorter, exact, longer
+  Q q1 = decode_q("\xc4\x01\xc5\x09", 4);
+  CHECK(q1.a == 1 && q1.b == 0);
+  Q q2 = decode_q("\xc4\x01\x02\xc5\x09", 5);
+  CHECK(q2.a == 1 && q2.b == 2);
+  Q q3 = decode_q("\xc4\x01\x02\x03\x91\x04\xc5\x09", 8);
+  CHECK(q3.a == 1 && q3.b == 2);
+
+  // unsorted
+  const char fm[] = "\xc6\x03\x01\x01\x02\x03\x04\xc5\x09";
+  {
+    MemoryReader r(fm, sizeof(fm) - 1);
+    Decoder d(&r);
+    std::vector<std::pair<int, int> > v;
+    d >> flat_map_of(v);
+    CHECK(v.size() == 2 && v[0].first == 1 && v[0].second == 2 && v[1].first == 3 && v[1].second == 4);
+    CHECK(d.read_uint() == 9);
+  }
+  {
+    MemoryReader r(fm, sizeof(fm) - 1);
+    Decoder d(&r);
+    d.set_reuse(true);
+    std::vector<std::pair<int, int> > v(5);
+    d >> flat_map_of(v);
+    CHECK(v.size() == 2);
+    CHECK(d.read_uint() == 9);
+  }
+
+  const char fs[] = "\xc4\x03\x01\x03\xc5\x09";
+  {
+    MemoryReader r(fs, sizeof(fs) - 1);
+    Decoder d(&r);
+    boost::container::flat_set<int> s;
+    d >> s;
+    CHECK(s.size() == 2 && *s.begin() == 1);
+    CHECK(d.read_uint() == 9);
+  }
+}
+
+int main()
+{
+  test_backpatched();
+  test_fixed_buffer_spill();
+  test_markers();
+  test_deep_nesting();
+  test_fields_and_flat();
+  return check_result();
+}
@@ -0,0 +1,226 @@
+/*
+ * msgpack-grep: writes the records of msgpack streams that match all
+ * conditions to stdout, as they are.
+ *
+ *   msgpack-grep [-c] [-j threads] CONDITION... [FILE...]
+ *
+ *   -e path=string   field equal to string
+ *   -p path=string   field starting with string
+ *   -n path=integer  field equal to integer
+ *   -r path=lo:hi    field between lo and hi (floats if either has a '.')
+ *   -c               print the number of matching records instead
+ *   -j threads       threads per file (default: number of CPUs)
+ *
+ * Files are mapped into memory; without FILE, stdin is read. Paths name
+ * map keys separated by '.' (see Filter.h). The exit status is 0 if a
+ * record matched, 1 if none did, 2 on errors.
+ *
+ * Build: c++ -std=c++11 -O2 -pthread -Iinclude -o msgpack-grep tools/msgpack-grep.cc
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include "MessagePack/MessagePack.h"
+#include "MessagePack/PrefetchReader.h"
+#include "MessagePack/Filter.h"
+
+using namespace MessagePack;
+
+static void usage()
+{
+  fprintf(stderr, "usage: msgpack-grep [-c] [-j threads] "
+                  "{-e|-p|-n|-r path=value}... [file...]\n");
+  exit(2);
+}
+
+static bool split(char *arg, std::string &path, char *&value)
+{
+  char *eq = strchr(arg, '=');
+  if (!eq || eq == arg) return false;
+  path.assign(arg, eq - arg);
+  value = eq + 1;
+  return true;
+}
+
+static bool parse_int(const char *s, int64_t &v)
+{
+  char *end;
+  errno = 0;
+  v = strtoll(s, &end, 10);
+  return *s && !*end && errno == 0;
+}
+
+static bool parse_double(const char *s, double &v)
+{
+  char *end;
+  v = strtod(s, &end);
+  return *s && !*end;
+}
+
+static bool add_range(Filter &f, const std::string &path, char *value)
+{
+  char *colon = strchr(value, ':');
+  if (!colon) return false;
+  *colon = '\0';
+  const char *lo = value, *hi = colon + 1;
+
+  int64_t ilo, ihi;
+  if (parse_int(lo, ilo) && parse_int(hi, ihi))
+  {
+    f.range(path, ilo, ihi);
+    return true;
+  }
+  double dlo, dhi;
+  if (parse_double(lo, dlo) && parse_double(hi, dhi))
+  {
+    f.range(path, dlo, dhi);
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Filters one input to out. Returns the number of matches, or -1 on
+ * errors (reported).
+ */
+template <class W>
+static long grep(Filter &f, Reader &in, W &out, unsigned threads, const char *name)
+{
+  in.set_throws(false);
+  out.set_throws(false);
+  size_t n = f.filter(in, out, threads);
+  if (in.failed())
+  {
+    fprintf(stderr, "msgpack-grep: %s: %s\n", name, in.error_message());
+    return -1;
+  }
+  if (out.failed())
+  {
+    fprintf(stderr, "msgpack-grep: write error\n");
+    return -1;
+  }
+  return (long)n;
+}
+
+template <class W>
+static long grep_file(Filter &f, const char *filename, W &out, unsigned threads)
+{
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    perror(filename);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  if (st.st_size == 0)
+  {
+    close(fd);
+    return 0;
+  }
+
+  void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+  {
+    perror(filename);
+    return -1;
+  }
+  madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  MemoryReader in((const char*)p, (size_t)st.st_size);
+  long n = grep(f, in, out, threads, filename);
+  munmap(p, (size_t)st.st_size);
+  return n;
+}
+
+template <class W>
+static int run(Filter &f, char **files, int nfiles, W &out, unsigned threads, size_t &total)
+{
+  bool error = false;
+  if (nfiles == 0)
+  {
+    PrefetchFileReader in(0, 1 << 20, 3);
+    long n = grep(f, in, out, 1, "(stdin)");
+    if (n < 0) error = true;
+    else total += n;
+  }
+  for (int i = 0; i < nfiles; ++i)
+  {
+    long n = grep_file(f, files[i], out, threads);
+    if (n < 0) error = true;
+    else total += n;
+  }
+  return error ? 2 : (total > 0 ? 0 : 1);
+}
+
+int main(int argc, char **argv)
+{
+  Filter f;
+  bool count = false;
+  bool conditions = false;
+  unsigned threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "ce:j:n:p:r:")) != -1)
+  {
+    std::string path;
+    char *value;
+    int64_t i;
+    switch (opt)
+    {
+      case 'c':
+        count = true;
+        break;
+      case 'j':
+        threads = (unsigned)atoi(optarg);
+        if (threads == 0) usage();
+        break;
+      case 'e':
+        if (!split(optarg, path, value)) usage();
+        f.equals(path, std::string(value));
+        conditions = true;
+        break;
+      case 'p':
+        if (!split(optarg, path, value)) usage();
+        f.prefix(path, std::string(value));
+        conditions = true;
+        break;
+      case 'n':
+        if (!split(optarg, path, value) || !parse_int(value, i)) usage();
+        f.equals(path, i);
+        conditions = true;
+        break;
+      case 'r':
+        if (!split(optarg, path, value) || !add_range(f, path, value)) usage();
+        conditions = true;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (!conditions) usage();
+
+  size_t total = 0;
+  int status;
+  if (count)
+  {
+    CountingWriter out;
+    status = run(f, argv + optind, argc - optind, out, threads, total);
+    printf("%zu\n", total);
+  }
+  else
+  {
+    FileWriter out(stdout);
+    status = run(f, argv + optind, argc - optind, out, threads, total);
+    if (fflush(stdout) != 0 && status != 2) status = 2;
+  }
+  return status;
+}